@@ -0,0 +1,84 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "fakeunit.h"
+
+#include <QCoreApplication>
+#include <QDBusConnection>
+#include <QDBusConnectionInterface>
+#include <QTimer>
+#include <QDebug>
+
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+FakeUnit::FakeUnit(Mode mode, const QString &name, int delay, QObject *parent) :
+    QObject(parent),
+    m_mode(mode),
+    m_name(name)
+{
+    // The benchmark only kills the session manager,
+    // make sure we don't outlive it
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() == 1) {
+        ::exit(0);
+    }
+
+    QTimer::singleShot(delay, this, SLOT(becomeReady()));
+}
+
+void FakeUnit::becomeReady()
+{
+    if (m_mode == DBusService) {
+        if (!QDBusConnection::sessionBus().registerService(m_name)) {
+            qWarning() << "Failed to claim" << m_name;
+            QCoreApplication::exit(1);
+        }
+        return;
+    }
+
+    const QByteArray path = qgetenv("NOTIFY_SOCKET");
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.isEmpty() || path.size() >= int(sizeof(addr.sun_path))) {
+        qWarning() << "Invalid NOTIFY_SOCKET" << path;
+        QCoreApplication::exit(1);
+        return;
+    }
+    memcpy(addr.sun_path, path.constData(), path.size());
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        QCoreApplication::exit(1);
+        return;
+    }
+
+    static const char ready[] = "READY=1\nSTATUS=Running";
+    if (sendto(fd, ready, sizeof(ready) - 1, MSG_NOSIGNAL,
+               reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0) {
+        qWarning() << "Failed to notify" << strerror(errno);
+    }
+    close(fd);
+}
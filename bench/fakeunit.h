@@ -0,0 +1,50 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef FAKEUNIT_H
+#define FAKEUNIT_H
+
+#include <QObject>
+
+/**
+ * @brief The FakeUnit class
+ * What the synthetic units of the benchmark run, after a
+ * configurable delay it either claims a D-Bus name on the
+ * session bus or sends READY=1 to NOTIFY_SOCKET, then idles
+ * until the session manager goes away.
+ */
+class FakeUnit : public QObject
+{
+    Q_OBJECT
+public:
+    enum Mode {
+        DBusService,
+        Notify
+    };
+    FakeUnit(Mode mode, const QString &name, int delay, QObject *parent = 0);
+
+private Q_SLOTS:
+    void becomeReady();
+
+private:
+    Mode m_mode;
+    QString m_name;
+};
+
+#endif // FAKEUNIT_H
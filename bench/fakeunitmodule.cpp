@@ -0,0 +1,54 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+
+#include "fakeunit.h"
+
+/**
+ * Entry point of the fake units when lemuri-session-launcher
+ * forks them, argv is what the generated Exec= lines pass.
+ */
+extern "C" Q_DECL_EXPORT int lemuri_launcher_main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    QCommandLineOption fakeServiceOption(QStringList() << "fake-service",
+            QCoreApplication::translate("main", "Act as a unit claiming <name> on the session bus."),
+            QCoreApplication::translate("main", "name"));
+    parser.addOption(fakeServiceOption);
+
+    QCommandLineOption fakeNotifyOption(QStringList() << "fake-notify",
+            QCoreApplication::translate("main", "Act as a unit sending READY=1 to NOTIFY_SOCKET."));
+    parser.addOption(fakeNotifyOption);
+
+    QCommandLineOption delayOption(QStringList() << "delay",
+            QCoreApplication::translate("main", "Time the fake unit takes to become ready."),
+            QCoreApplication::translate("main", "msecs"),
+            QLatin1String("0"));
+    parser.addOption(delayOption);
+
+    parser.process(app);
+
+    FakeUnit unit(parser.isSet(fakeServiceOption) ? FakeUnit::DBusService : FakeUnit::Notify,
+                  parser.value(fakeServiceOption), parser.value(delayOption).toInt());
+    return app.exec();
+}
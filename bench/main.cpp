@@ -0,0 +1,184 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDebug>
+
+#include "fakeunit.h"
+#include "sessionbench.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("lemuri-session-bench");
+    QCoreApplication::setApplicationVersion("0.0.1");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Lemuri session startup benchmark");
+    parser.addHelpOption();
+
+    QCommandLineOption sizesOption(QStringList() << "sizes",
+            QCoreApplication::translate("main", "Comma separated number of units of each session <sizes>."),
+            QCoreApplication::translate("main", "sizes"),
+            QLatin1String("10,100,1000,5000"));
+    parser.addOption(sizesOption);
+
+    QCommandLineOption runsOption(QStringList() << "runs",
+            QCoreApplication::translate("main", "Start each session <runs> times and report the median."),
+            QCoreApplication::translate("main", "runs"),
+            QLatin1String("3"));
+    parser.addOption(runsOption);
+
+    QCommandLineOption shellRatioOption(QStringList() << "shell-ratio",
+            QCoreApplication::translate("main", "Fraction of shell units."),
+            QCoreApplication::translate("main", "ratio"),
+            QLatin1String("0.02"));
+    parser.addOption(shellRatioOption);
+
+    QCommandLineOption serviceRatioOption(QStringList() << "service-ratio",
+            QCoreApplication::translate("main", "Fraction of service units, the rest are applications."),
+            QCoreApplication::translate("main", "ratio"),
+            QLatin1String("0.4"));
+    parser.addOption(serviceRatioOption);
+
+    QCommandLineOption dependencyOption(QStringList() << "dependency-chance",
+            QCoreApplication::translate("main", "Probability of a unit requiring the bus name of a recent service."),
+            QCoreApplication::translate("main", "chance"),
+            QLatin1String("0.3"));
+    parser.addOption(dependencyOption);
+
+    QCommandLineOption maxChainOption(QStringList() << "max-chain",
+            QCoreApplication::translate("main", "How many of the most recent services a dependency is picked from."),
+            QCoreApplication::translate("main", "count"),
+            QLatin1String("4"));
+    parser.addOption(maxChainOption);
+
+    QCommandLineOption minDelayOption(QStringList() << "min-delay",
+            QCoreApplication::translate("main", "Minimum time a fake unit takes to become ready."),
+            QCoreApplication::translate("main", "msecs"),
+            QLatin1String("0"));
+    parser.addOption(minDelayOption);
+
+    QCommandLineOption maxDelayOption(QStringList() << "max-delay",
+            QCoreApplication::translate("main", "Maximum time a fake unit takes to become ready."),
+            QCoreApplication::translate("main", "msecs"),
+            QLatin1String("50"));
+    parser.addOption(maxDelayOption);
+
+    QCommandLineOption timeoutOption(QStringList() << "timeout",
+            QCoreApplication::translate("main", "Give up on a run after <secs>."),
+            QCoreApplication::translate("main", "secs"),
+            QLatin1String("120"));
+    parser.addOption(timeoutOption);
+
+    QCommandLineOption seedOption(QStringList() << "seed",
+            QCoreApplication::translate("main", "Seed of the generated sessions."),
+            QCoreApplication::translate("main", "seed"),
+            QLatin1String("1"));
+    parser.addOption(seedOption);
+
+    QCommandLineOption sessionBinaryOption(QStringList() << "session-binary",
+            QCoreApplication::translate("main", "The lemuri-session <binary> to measure."),
+            QCoreApplication::translate("main", "binary"),
+            QLatin1String(LEMURI_SESSION_BINARY));
+    parser.addOption(sessionBinaryOption);
+
+    QCommandLineOption coldOption(QStringList() << "cold",
+            QCoreApplication::translate("main", "Drop the unit cache before every run."));
+    parser.addOption(coldOption);
+
+    QCommandLineOption launcherOption(QStringList() << "launcher",
+            QCoreApplication::translate("main", "Start applications through the launcher helper: off, on or both."),
+            QCoreApplication::translate("main", "mode"),
+            QLatin1String("off"));
+    parser.addOption(launcherOption);
+
+    QCommandLineOption maxStartingOption(QStringList() << "max-starting",
+            QCoreApplication::translate("main", "Have the session start at most <count> units of a phase at once, 0 for all at once."),
+            QCoreApplication::translate("main", "count"));
+    parser.addOption(maxStartingOption);
+
+    QCommandLineOption csvOption(QStringList() << "csv",
+            QCoreApplication::translate("main", "Print the results as CSV."));
+    parser.addOption(csvOption);
+
+    // Used by the generated units
+    QCommandLineOption fakeServiceOption(QStringList() << "fake-service",
+            QCoreApplication::translate("main", "Act as a unit claiming <name> on the session bus."),
+            QCoreApplication::translate("main", "name"));
+    parser.addOption(fakeServiceOption);
+
+    QCommandLineOption fakeNotifyOption(QStringList() << "fake-notify",
+            QCoreApplication::translate("main", "Act as a unit sending READY=1 to NOTIFY_SOCKET."));
+    parser.addOption(fakeNotifyOption);
+
+    QCommandLineOption delayOption(QStringList() << "delay",
+            QCoreApplication::translate("main", "Time the fake unit takes to become ready."),
+            QCoreApplication::translate("main", "msecs"),
+            QLatin1String("0"));
+    parser.addOption(delayOption);
+
+    parser.process(app);
+
+    if (parser.isSet(fakeServiceOption)) {
+        FakeUnit unit(FakeUnit::DBusService, parser.value(fakeServiceOption),
+                      parser.value(delayOption).toInt());
+        return app.exec();
+    } else if (parser.isSet(fakeNotifyOption)) {
+        FakeUnit unit(FakeUnit::Notify, QString(), parser.value(delayOption).toInt());
+        return app.exec();
+    }
+
+    SessionBench::Config config;
+    foreach (const QString &size, parser.value(sizesOption).split(QLatin1Char(','), QString::SkipEmptyParts)) {
+        if (size.toInt() > 0) {
+            config.sizes << size.toInt();
+        }
+    }
+    config.runs = qMax(1, parser.value(runsOption).toInt());
+    config.shellRatio = parser.value(shellRatioOption).toDouble();
+    config.serviceRatio = parser.value(serviceRatioOption).toDouble();
+    config.dependencyChance = parser.value(dependencyOption).toDouble();
+    config.maxChain = qMax(1, parser.value(maxChainOption).toInt());
+    config.minDelay = qMax(0, parser.value(minDelayOption).toInt());
+    config.maxDelay = qMax(config.minDelay, parser.value(maxDelayOption).toInt());
+    config.timeout = qMax(1, parser.value(timeoutOption).toInt());
+    config.seed = parser.value(seedOption).toUInt();
+    config.coldCache = parser.isSet(coldOption);
+    config.csv = parser.isSet(csvOption);
+    if (parser.isSet(maxStartingOption)) {
+        config.maxStarting = qMax(0, parser.value(maxStartingOption).toInt());
+    }
+    const QString launcher = parser.value(launcherOption);
+    if (launcher == QLatin1String("on")) {
+        config.launcher = SessionBench::LauncherOn;
+    } else if (launcher == QLatin1String("both")) {
+        config.launcher = SessionBench::LauncherBoth;
+    } else if (launcher != QLatin1String("off")) {
+        qWarning() << "Unknown launcher mode" << launcher;
+        return 1;
+    }
+    config.launcherModules = QLatin1String(LEMURI_BENCH_LAUNCHER_MODULES);
+    config.sessionBinary = parser.value(sessionBinaryOption);
+    config.benchBinary = QCoreApplication::applicationFilePath();
+
+    SessionBench bench(config);
+    return bench.run();
+}
@@ -0,0 +1,459 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "sessionbench.h"
+
+#include "startuptrace.h"
+
+#include <QProcess>
+#include <QProcessEnvironment>
+#include <QTemporaryDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QThread>
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusReply>
+#include <QDBusMetaType>
+#include <QStringBuilder>
+#include <QRegularExpression>
+#include <QHash>
+#include <QDebug>
+
+#include <algorithm>
+
+#include <spawn.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+static qint64 monotonicUsecs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return qint64(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+static qint64 median(QList<qint64> values)
+{
+    values.removeAll(-1);
+    if (values.isEmpty()) {
+        return -1;
+    }
+    std::sort(values.begin(), values.end());
+    return values.at(values.size() / 2);
+}
+
+static QString quoted(const QString &arg)
+{
+    QString ret = arg;
+    ret.replace(QLatin1Char('\\'), QLatin1String("\\\\"));
+    ret.replace(QLatin1Char('"'), QLatin1String("\\\""));
+    return QLatin1Char('"') % ret % QLatin1Char('"');
+}
+
+SessionBench::SessionBench(const Config &config) :
+    m_config(config)
+{
+    qDBusRegisterMetaType<TraceEvent>();
+    qDBusRegisterMetaType<TraceEventList>();
+}
+
+int SessionBench::run()
+{
+    if (!QFileInfo(m_config.sessionBinary).isExecutable()) {
+        qWarning() << "Session binary not found" << m_config.sessionBinary;
+        return 1;
+    }
+
+    QList<Result> results;
+    foreach (int size, m_config.sizes) {
+        QTemporaryDir tempDir;
+        if (!tempDir.isValid()) {
+            qWarning() << "Unable to create a temporary directory";
+            return 1;
+        }
+
+        QDir root(tempDir.path());
+        root.mkpath(QLatin1String("units"));
+        root.mkpath(QLatin1String("cache"));
+        root.mkpath(QLatin1String("config"));
+        root.mkpath(QLatin1String("state"));
+        root.mkpath(QLatin1String("runtime"));
+        QFile::setPermissions(root.filePath(QLatin1String("runtime")),
+                              QFile::ReadOwner | QFile::WriteOwner | QFile::ExeOwner);
+
+        // Same seed per size so runs are comparable between builds
+        qsrand(m_config.seed + size);
+        generateUnits(QDir(root.filePath(QLatin1String("units"))), size);
+
+        // The same units with and without the helper
+        QList<bool> modes;
+        if (m_config.launcher != LauncherOn) {
+            modes << false;
+        }
+        if (m_config.launcher != LauncherOff) {
+            modes << true;
+        }
+
+        foreach (bool launcher, modes) {
+            QList<qint64> shell, services, autostart, application, peakRss, cpuTime;
+            for (int i = 0; i < m_config.runs; ++i) {
+                if (m_config.coldCache) {
+                    QDir(root.filePath(QLatin1String("cache"))).removeRecursively();
+                    root.mkpath(QLatin1String("cache"));
+                }
+
+                Result result;
+                if (!runOnce(root, size, launcher, &result)) {
+                    qWarning() << "Run" << i + 1 << "with" << size << "units did not complete";
+                }
+                shell.append(result.shell);
+                services.append(result.services);
+                autostart.append(result.autostart);
+                application.append(result.application);
+                peakRss.append(result.peakRss);
+                cpuTime.append(result.cpuTime);
+            }
+
+            Result result;
+            result.units = size;
+            result.launcher = launcher;
+            result.shell = median(shell);
+            result.services = median(services);
+            result.autostart = median(autostart);
+            result.application = median(application);
+            result.peakRss = median(peakRss);
+            result.cpuTime = median(cpuTime);
+            results.append(result);
+        }
+    }
+
+    print(results);
+    return 0;
+}
+
+int SessionBench::firstApplication(int size) const
+{
+    // Shells come first, then services
+    return qMax(1, int(size * m_config.shellRatio)) + int(size * m_config.serviceRatio);
+}
+
+void SessionBench::generateUnits(const QDir &dir, int size) const
+{
+    const int shells = qMax(1, int(size * m_config.shellRatio));
+    const int applications = firstApplication(size);
+    const int delaySpread = qMax(1, m_config.maxDelay - m_config.minDelay + 1);
+
+    QStringList serviceNames;
+    for (int i = 0; i < size; ++i) {
+        QString type;
+        QString name = QString::fromLatin1("org.lemuri.bench.Unit%1").arg(i);
+        if (i < shells) {
+            type = QLatin1String("Shell");
+        } else if (i < applications) {
+            type = QLatin1String("Service");
+        } else {
+            type = QLatin1String("Application");
+        }
+
+        const int delay = m_config.minDelay + qrand() % delaySpread;
+        QString exec = quoted(m_config.benchBinary);
+        bool notify = type == QLatin1String("Application");
+        if (notify) {
+            exec += QLatin1String(" --fake-notify");
+        } else {
+            exec += QLatin1String(" --fake-service ") % name;
+        }
+        exec += QLatin1String(" --delay ") % QString::number(delay);
+
+        // Chains of bus name dependencies on recent services,
+        // maxChain bounds how far back a unit may reach
+        QStringList requires;
+        if (!serviceNames.isEmpty() &&
+                qrand() % 1000 < int(m_config.dependencyChance * 1000)) {
+            int window = qMin(serviceNames.size(), m_config.maxChain);
+            requires << serviceNames.at(serviceNames.size() - 1 - qrand() % window);
+        }
+
+        QFile file(dir.filePath(QString::fromLatin1("bench-unit-%1.desktop").arg(i)));
+        if (!file.open(QFile::WriteOnly | QFile::Truncate)) {
+            qWarning() << "Unable to write" << file.fileName();
+            continue;
+        }
+
+        QTextStream stream(&file);
+        stream << "[Desktop Entry]\n"
+               << "Name=Bench unit " << i << "\n"
+               << "Type=" << type << "\n"
+               << "Exec=" << exec << "\n"
+               << "Enabled=true\n";
+        if (notify) {
+            // Only used when the session runs the helper
+            stream << "ReadyNotify=notify\n"
+                   << "Launcher=true\n";
+        } else {
+            stream << "DBusName=" << name << "\n";
+        }
+        if (!requires.isEmpty()) {
+            stream << "DBusSessionRequires=" << requires.join(QLatin1Char(' ')) << "\n";
+        }
+
+        if (!notify) {
+            serviceNames.append(name);
+        }
+    }
+}
+
+bool SessionBench::runOnce(const QDir &root, int size, bool launcher, Result *result) const
+{
+    result->units = size;
+    result->launcher = launcher;
+
+    QProcess bus;
+    bus.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    bus.start(QLatin1String("dbus-daemon"),
+              QStringList() << QLatin1String("--session")
+                            << QLatin1String("--nofork")
+                            << QLatin1String("--print-address=1"));
+    if (!bus.waitForStarted() || !bus.waitForReadyRead(10000)) {
+        qWarning() << "Unable to start a private dbus-daemon";
+        return false;
+    }
+    const QString busAddress = QString::fromLocal8Bit(bus.readLine().trimmed());
+
+    const QString traceFile = root.filePath(QLatin1String("trace.json"));
+    QFile::remove(traceFile);
+
+    const qint64 origin = monotonicUsecs();
+    pid_t pid = spawnSession(root, busAddress, launcher);
+    if (pid <= 0) {
+        bus.terminate();
+        bus.waitForFinished();
+        return false;
+    }
+
+    // The trace file is written once both the services and the
+    // autostart milestones are reached, polling for it keeps the
+    // bench off the session bus while the session starts
+    bool completed = false;
+    const qint64 deadline = origin + qint64(m_config.timeout) * 1000000;
+    while (monotonicUsecs() < deadline) {
+        if (QFile::exists(traceFile)) {
+            completed = true;
+            break;
+        }
+
+        int status;
+        if (waitpid(pid, &status, WNOHANG) == pid) {
+            qWarning() << "lemuri-session exited early with status" << status;
+            pid = -1;
+            break;
+        }
+        QThread::msleep(5);
+    }
+
+    if (completed) {
+        completed = readMilestones(busAddress, origin, result);
+        readUsage(pid, result);
+    }
+
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        waitpid(pid, 0, 0);
+    }
+
+    bus.terminate();
+    if (!bus.waitForFinished(5000)) {
+        bus.kill();
+        bus.waitForFinished();
+    }
+
+    return completed;
+}
+
+pid_t SessionBench::spawnSession(const QDir &root, const QString &busAddress, bool launcher) const
+{
+    QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+    environment.insert(QLatin1String("DBUS_SESSION_BUS_ADDRESS"), busAddress);
+    environment.insert(QLatin1String("XDG_CACHE_HOME"), root.filePath(QLatin1String("cache")));
+    environment.insert(QLatin1String("XDG_CONFIG_HOME"), root.filePath(QLatin1String("config")));
+    environment.insert(QLatin1String("XDG_STATE_HOME"), root.filePath(QLatin1String("state")));
+    environment.insert(QLatin1String("XDG_RUNTIME_DIR"), root.filePath(QLatin1String("runtime")));
+    environment.insert(QLatin1String("QT_QPA_PLATFORM"), QLatin1String("minimal"));
+    environment.remove(QLatin1String("NOTIFY_SOCKET"));
+
+    QList<QByteArray> envData;
+    foreach (const QString &entry, environment.toStringList()) {
+        envData << entry.toLocal8Bit();
+    }
+
+    QList<QByteArray> argData;
+    argData << QFile::encodeName(m_config.sessionBinary)
+            << QByteArrayLiteral("--session-name") << QByteArrayLiteral("bench")
+            << QByteArrayLiteral("--bus-address") << busAddress.toLocal8Bit()
+            << QByteArrayLiteral("--units-dir") << QFile::encodeName(root.filePath(QLatin1String("units")))
+            << QByteArrayLiteral("--trace-file") << QFile::encodeName(root.filePath(QLatin1String("trace.json")));
+    if (m_config.maxStarting >= 0) {
+        argData << QByteArrayLiteral("--max-starting") << QByteArray::number(m_config.maxStarting);
+    }
+    if (launcher) {
+        argData << QByteArrayLiteral("--launcher-modules") << QFile::encodeName(m_config.launcherModules);
+    } else {
+        argData << QByteArrayLiteral("--no-launcher");
+    }
+
+    QVector<char *> argv;
+    foreach (const QByteArray &arg, argData) {
+        argv << const_cast<char *>(arg.constData());
+    }
+    argv << 0;
+
+    QVector<char *> envp;
+    foreach (const QByteArray &entry, envData) {
+        envp << const_cast<char *>(entry.constData());
+    }
+    envp << 0;
+
+    pid_t pid;
+    int ret = posix_spawn(&pid, argv.at(0), 0, 0, argv.data(), envp.data());
+    if (ret != 0) {
+        qWarning() << "Failed to spawn" << m_config.sessionBinary << strerror(ret);
+        return -1;
+    }
+    return pid;
+}
+
+bool SessionBench::readMilestones(const QString &busAddress, qint64 origin, Result *result) const
+{
+    QDBusConnection connection = QDBusConnection::connectToBus(busAddress,
+                                                               QLatin1String("lemuri-session-bench"));
+    QDBusMessage message = QDBusMessage::createMethodCall(QLatin1String("org.lemuri.session"),
+                                                          QLatin1String("/org/lemuri/session"),
+                                                          QLatin1String("org.lemuri.session"),
+                                                          QLatin1String("GetStartupTrace"));
+    QDBusReply<TraceEventList> reply = connection.call(message);
+    QDBusConnection::disconnectFromBus(QLatin1String("lemuri-session-bench"));
+    if (!reply.isValid()) {
+        qWarning() << "GetStartupTrace failed" << reply.error().message();
+        return false;
+    }
+
+    // Trace timestamps are on the same monotonic clock,
+    // so they are measured from the exec of the manager.
+    // Milestones are never evicted from the trace and the
+    // ring is sized from the unit count, so spawn/ready
+    // pairs survive even the largest runs
+    const QString milestone = StartupTrace::kindName(StartupTrace::Milestone);
+    const QString spawnRequested = StartupTrace::kindName(StartupTrace::SpawnRequested);
+    const QString ready = StartupTrace::kindName(StartupTrace::Ready);
+    const QRegularExpression unitName(QLatin1String("^bench-unit-(\\d+)\\.desktop$"));
+    const int applications = firstApplication(result->units);
+    QHash<QString, qulonglong> spawned;
+    QList<qint64> startup;
+    foreach (const TraceEvent &event, reply.value()) {
+        if (event.event == spawnRequested) {
+            spawned.insert(event.unit, event.timestamp);
+            continue;
+        } else if (event.event == ready) {
+            QRegularExpressionMatch match = unitName.match(event.unit);
+            if (match.hasMatch() && match.captured(1).toInt() >= applications &&
+                    spawned.contains(event.unit)) {
+                startup.append(qint64(event.timestamp - spawned.take(event.unit)));
+            }
+            continue;
+        } else if (event.event != milestone) {
+            continue;
+        }
+
+        const qint64 elapsed = qint64(event.timestamp) - origin;
+        if (event.detail == QLatin1String("ShellStarted")) {
+            result->shell = elapsed;
+        } else if (event.detail == QLatin1String("ServicesStarted")) {
+            result->services = elapsed;
+        } else if (event.detail == QLatin1String("AutostartStarted")) {
+            result->autostart = elapsed;
+        }
+    }
+    result->application = median(startup);
+    return true;
+}
+
+void SessionBench::readUsage(pid_t pid, Result *result)
+{
+    // The manager itself only, wait4() rusage would also
+    // account for every unit it reaped
+    QFile status(QString::fromLatin1("/proc/%1/status").arg(pid));
+    if (status.open(QFile::ReadOnly)) {
+        foreach (const QByteArray &line, status.readAll().split('\n')) {
+            if (line.startsWith("VmHWM:")) {
+                result->peakRss = line.mid(6).trimmed().split(' ').first().toLongLong();
+            }
+        }
+    }
+
+    QFile stat(QString::fromLatin1("/proc/%1/stat").arg(pid));
+    if (stat.open(QFile::ReadOnly)) {
+        // comm may contain spaces, fields are counted after it
+        const QByteArray data = stat.readAll();
+        const QList<QByteArray> fields = data.mid(data.lastIndexOf(')') + 2).split(' ');
+        if (fields.size() > 12) {
+            const qint64 ticks = fields.at(11).toLongLong() + fields.at(12).toLongLong();
+            result->cpuTime = ticks * 1000000 / sysconf(_SC_CLK_TCK);
+        }
+    }
+}
+
+void SessionBench::print(const QList<Result> &results) const
+{
+    QTextStream out(stdout);
+    if (m_config.csv) {
+        out << "units,shell_ms,services_ms,autostart_ms,peak_rss_kib,cpu_ms,launcher,app_ms\n";
+    } else {
+        out << qSetFieldWidth(8) << "units"
+            << qSetFieldWidth(12) << "shell ms" << "services ms" << "autostart ms"
+            << "rss KiB" << "cpu ms" << "launcher" << "app ms" << qSetFieldWidth(0) << "\n";
+    }
+
+    foreach (const Result &result, results) {
+        QStringList columns;
+        columns << QString::number(result.units)
+                << (result.shell < 0 ? QStringLiteral("-") : QString::number(result.shell / 1000.0, 'f', 1))
+                << (result.services < 0 ? QStringLiteral("-") : QString::number(result.services / 1000.0, 'f', 1))
+                << (result.autostart < 0 ? QStringLiteral("-") : QString::number(result.autostart / 1000.0, 'f', 1))
+                << (result.peakRss < 0 ? QStringLiteral("-") : QString::number(result.peakRss))
+                << (result.cpuTime < 0 ? QStringLiteral("-") : QString::number(result.cpuTime / 1000.0, 'f', 1))
+                << (result.launcher ? QStringLiteral("on") : QStringLiteral("off"))
+                << (result.application < 0 ? QStringLiteral("-") : QString::number(result.application / 1000.0, 'f', 1));
+
+        if (m_config.csv) {
+            out << columns.join(QLatin1Char(',')) << "\n";
+        } else {
+            out << qSetFieldWidth(8) << columns.takeFirst() << qSetFieldWidth(12);
+            foreach (const QString &column, columns) {
+                out << column;
+            }
+            out << qSetFieldWidth(0) << "\n";
+        }
+    }
+}
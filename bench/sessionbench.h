@@ -0,0 +1,100 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef SESSIONBENCH_H
+#define SESSIONBENCH_H
+
+#include <QString>
+#include <QList>
+#include <QDir>
+
+#include <sys/types.h>
+
+/**
+ * @brief The SessionBench class
+ * Starts lemuri-session against synthetic sessions of
+ * increasing size, each run gets a private dbus-daemon and
+ * private XDG directories inside a temporary directory so
+ * nothing of the user session leaks into the numbers.
+ *
+ * Every unit is a FakeUnit, shells and services become ready
+ * by claiming a bus name, applications by sd_notify, so the
+ * measured times are the manager's own overhead plus the
+ * configured readiness delays along the critical path.
+ *
+ * Applications opt in to the launcher helper, sessions can be
+ * measured with it, without it or both ways.
+ */
+class SessionBench
+{
+public:
+    enum LauncherMode {
+        LauncherOff,
+        LauncherOn,
+        LauncherBoth
+    };
+
+    struct Config {
+        QList<int> sizes;
+        int runs = 3;
+        double shellRatio = 0.02;
+        double serviceRatio = 0.4;
+        double dependencyChance = 0.3;
+        int maxChain = 4;
+        int minDelay = 0;
+        int maxDelay = 50;
+        int timeout = 120;
+        uint seed = 1;
+        bool coldCache = false;
+        bool csv = false;
+        LauncherMode launcher = LauncherOff;
+        int maxStarting = -1;    // the session default
+        QString launcherModules;
+        QString sessionBinary;
+        QString benchBinary;
+    };
+
+    struct Result {
+        int units = 0;
+        bool launcher = false;
+        qint64 shell = -1;     // usecs since exec
+        qint64 services = -1;
+        qint64 autostart = -1;
+        qint64 application = -1; // usecs, median spawn to ready
+        qint64 peakRss = -1;   // KiB
+        qint64 cpuTime = -1;   // usecs
+    };
+
+    explicit SessionBench(const Config &config);
+
+    int run();
+
+private:
+    int firstApplication(int size) const;
+    void generateUnits(const QDir &dir, int size) const;
+    bool runOnce(const QDir &root, int size, bool launcher, Result *result) const;
+    pid_t spawnSession(const QDir &root, const QString &busAddress, bool launcher) const;
+    bool readMilestones(const QString &busAddress, qint64 origin, Result *result) const;
+    static void readUsage(pid_t pid, Result *result);
+    void print(const QList<Result> &results) const;
+
+    Config m_config;
+};
+
+#endif // SESSIONBENCH_H
@@ -0,0 +1,286 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "admissioncontroller.h"
+
+#include "unitlauncher.h"
+#include "timerqueue.h"
+
+#include <QThread>
+#include <QDebug>
+
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A unit starting for longer gives its slot back
+#define SLOT_TIMEOUT 3000
+
+// How often pressure is sampled while units are queued or starting
+#define SAMPLE_INTERVAL 200
+
+// Share of the interval some task stalled on a resource
+#define PRESSURE_HIGH 0.4
+#define PRESSURE_LOW 0.1
+
+AdmissionController::AdmissionController(QObject *parent) :
+    QObject(parent),
+    m_limit(qMax(2, QThread::idealThreadCount()))
+{
+    m_adaptive = m_limit;
+
+    const char *files[ResourceCount] = {
+        "/proc/pressure/cpu",
+        "/proc/pressure/io",
+        "/proc/pressure/memory"
+    };
+    for (int i = 0; i < ResourceCount; ++i) {
+        // Missing without CONFIG_PSI, limits are static then
+        m_pressureFds[i] = open(files[i], O_RDONLY | O_CLOEXEC);
+        m_stalled[i] = 0;
+    }
+}
+
+AdmissionController::~AdmissionController()
+{
+    TimerQueue::global()->cancel(m_timer);
+    for (int i = 0; i < ResourceCount; ++i) {
+        if (m_pressureFds[i] >= 0) {
+            close(m_pressureFds[i]);
+        }
+    }
+}
+
+void AdmissionController::setLimit(int limit)
+{
+    m_limit = qMax(0, limit);
+    m_adaptive = m_limit;
+    drain();
+}
+
+int AdmissionController::limit() const
+{
+    return m_limit;
+}
+
+void AdmissionController::submit(UnitLauncher *launcher, qreal priority)
+{
+    remove(launcher);
+
+    Phase &phase = m_phases[phaseOf(launcher)];
+    if (m_limit == 0 || (phase.queue.isEmpty() && phase.starting.size() < phaseLimit(phaseOf(launcher)))) {
+        admit(launcher, &phase);
+        return;
+    }
+
+    // Equal priorities keep their submission order
+    Pending pending;
+    pending.launcher = launcher;
+    pending.priority = priority;
+    pending.sequence = ++m_sequence;
+    QVector<Pending>::Iterator it = std::upper_bound(phase.queue.begin(), phase.queue.end(), pending,
+                                                     [](const Pending &a, const Pending &b) {
+        return a.priority > b.priority || (a.priority == b.priority && a.sequence < b.sequence);
+    });
+    phase.queue.insert(it, pending);
+    qDebug() << "Queueing unit" << launcher->name() << phase.queue.size() << "waiting";
+    scheduleSample();
+}
+
+void AdmissionController::remove(UnitLauncher *launcher)
+{
+    Phase &phase = m_phases[phaseOf(launcher)];
+    QVector<Pending>::Iterator it = phase.queue.begin();
+    while (it != phase.queue.end()) {
+        if (it->launcher == launcher) {
+            it = phase.queue.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    finish(launcher);
+}
+
+void AdmissionController::unitStateChanged()
+{
+    UnitLauncher *launcher = qobject_cast<UnitLauncher *>(sender());
+    if (launcher && launcher->state() == QProcess::NotRunning) {
+        // Exited before being ready
+        finish(launcher);
+    }
+}
+
+void AdmissionController::unitDone()
+{
+    UnitLauncher *launcher = qobject_cast<UnitLauncher *>(sender());
+    if (launcher) {
+        finish(launcher);
+    }
+}
+
+int AdmissionController::phaseOf(UnitLauncher *launcher)
+{
+    const int type = launcher->type();
+    return type >= 0 && type < PhaseCount ? type : UnitLauncher::Unknown;
+}
+
+int AdmissionController::phaseLimit(int phase) const
+{
+    if (phase == UnitLauncher::Shell || phase == UnitLauncher::Custom) {
+        return m_limit;
+    }
+    return m_adaptive;
+}
+
+void AdmissionController::admit(UnitLauncher *launcher, Phase *phase)
+{
+    launcher->Start();
+
+    // Waiting for D-Bus names, activatable or failed,
+    // nothing is starting so there is no slot to hold
+    if (m_limit == 0 || launcher->state() == QProcess::NotRunning || launcher->isReady()) {
+        return;
+    }
+
+    phase->starting.insert(launcher, TimerQueue::now());
+    m_notReady.insert(launcher, phaseOf(launcher));
+    connect(launcher, &UnitLauncher::ready,
+            this, &AdmissionController::unitDone, Qt::UniqueConnection);
+    connect(launcher, &UnitLauncher::failed,
+            this, &AdmissionController::unitDone, Qt::UniqueConnection);
+    connect(launcher, &UnitLauncher::stateChanged,
+            this, &AdmissionController::unitStateChanged, Qt::UniqueConnection);
+    scheduleSample();
+}
+
+void AdmissionController::finish(UnitLauncher *launcher)
+{
+    QHash<UnitLauncher *, int>::Iterator it = m_notReady.find(launcher);
+    if (it == m_notReady.end()) {
+        return;
+    }
+
+    m_phases[it.value()].starting.remove(launcher);
+    m_notReady.erase(it);
+    disconnect(launcher, 0, this, 0);
+    drain();
+}
+
+void AdmissionController::drain()
+{
+    for (int i = 0; i < PhaseCount; ++i) {
+        Phase &phase = m_phases[i];
+        while (!phase.queue.isEmpty() && (m_limit == 0 || phase.starting.size() < phaseLimit(i))) {
+            UnitLauncher *launcher = phase.queue.first().launcher;
+            phase.queue.removeFirst();
+            admit(launcher, &phase);
+        }
+    }
+}
+
+void AdmissionController::scheduleSample()
+{
+    if (m_timer || m_limit == 0) {
+        return;
+    }
+
+    m_timer = TimerQueue::global()->start(SAMPLE_INTERVAL, this, [this]() {
+        m_timer = 0;
+        sample();
+    });
+}
+
+void AdmissionController::sample()
+{
+    // Slow units free their slot but still count as not ready
+    const qint64 now = TimerQueue::now();
+    int queued = 0;
+    for (int i = 0; i < PhaseCount; ++i) {
+        QHash<UnitLauncher *, qint64> &starting = m_phases[i].starting;
+        QHash<UnitLauncher *, qint64>::Iterator it = starting.begin();
+        while (it != starting.end()) {
+            if (now - it.value() >= SLOT_TIMEOUT) {
+                qDebug() << "Unit slow to get ready, releasing its slot" << it.key()->name();
+                it = starting.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        queued += m_phases[i].queue.size();
+    }
+
+    const qreal pressure = readPressure();
+    const int adaptive = m_adaptive;
+    if (pressure >= PRESSURE_HIGH) {
+        m_adaptive = qMax(1, m_adaptive / 2);
+    } else if (pressure >= 0 && pressure <= PRESSURE_LOW && queued &&
+               m_notReady.size() <= m_limit) {
+        m_adaptive = qMin(m_limit, m_adaptive + 1);
+    }
+    if (adaptive != m_adaptive) {
+        qDebug() << "Spawn limit" << m_adaptive << "pressure" << pressure
+                 << queued << "queued" << m_notReady.size() << "not ready";
+    }
+
+    drain();
+
+    if (queued || !m_notReady.isEmpty()) {
+        scheduleSample();
+    } else {
+        // Idle, the next burst starts from scratch
+        m_adaptive = m_limit;
+        m_sampledAt = 0;
+    }
+}
+
+qreal AdmissionController::readPressure()
+{
+    // Stall time deltas of the "some" lines, avg10
+    // is far too slow for a login
+    const qint64 now = TimerQueue::now();
+    const qint64 elapsed = now - m_sampledAt;
+    qreal pressure = -1;
+    for (int i = 0; i < ResourceCount; ++i) {
+        if (m_pressureFds[i] < 0) {
+            continue;
+        }
+
+        char buffer[256];
+        ssize_t size = pread(m_pressureFds[i], buffer, sizeof(buffer) - 1, 0);
+        if (size <= 0) {
+            continue;
+        }
+        buffer[size] = '\0';
+
+        const char *total = strstr(buffer, "total=");
+        if (!total) {
+            continue;
+        }
+        const qulonglong stalled = strtoull(total + 6, 0, 10); // usecs
+        if (m_sampledAt && elapsed > 0) {
+            pressure = qMax(pressure, qreal(stalled - m_stalled[i]) / (elapsed * 1000));
+        }
+        m_stalled[i] = stalled;
+    }
+    m_sampledAt = now;
+    return pressure;
+}
@@ -0,0 +1,113 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef ADMISSIONCONTROLLER_H
+#define ADMISSIONCONTROLLER_H
+
+#include <QObject>
+#include <QHash>
+#include <QVector>
+
+#include "unitlauncher.h"
+
+/**
+ * @brief The AdmissionController class
+ * Sits between the UnitScheduler and the spawns so a phase
+ * doesn't start all its units at once. Each phase (unit type)
+ * has at most limit() units starting, queued units are started
+ * highest priority first as slots free up.
+ *
+ * A unit holds its slot until it is ready, failed or exited, or
+ * for SLOT_TIMEOUT so a unit slow to get ready doesn't block its
+ * phase. Service and application phases adapt their limit to the
+ * CPU, IO and memory pressure (PSI): it's halved when tasks stall
+ * and grows back by one while they don't and no more than the
+ * limit are still not ready. Shell units are the time to shell,
+ * they always get the configured limit.
+ */
+class AdmissionController : public QObject
+{
+    Q_OBJECT
+public:
+    explicit AdmissionController(QObject *parent = 0);
+    virtual ~AdmissionController();
+
+    /**
+     * At most \p limit units of a phase are starting
+     * at once, 0 starts everything right away
+     */
+    void setLimit(int limit);
+    int limit() const;
+
+    /**
+     * Starts \p launcher once its phase has a free slot,
+     * higher \p priority units are started first
+     */
+    void submit(UnitLauncher *launcher, qreal priority);
+    void remove(UnitLauncher *launcher);
+
+private Q_SLOTS:
+    void unitStateChanged();
+    void unitDone();
+
+private:
+    enum Resource {
+        Cpu,
+        Io,
+        Memory,
+        ResourceCount
+    };
+
+    struct Pending {
+        UnitLauncher *launcher;
+        qreal priority;
+        quint64 sequence;
+    };
+
+    struct Phase {
+        QVector<Pending> queue;
+        QHash<UnitLauncher *, qint64> starting; // admitted at, msecs
+    };
+
+    enum {
+        PhaseCount = UnitLauncher::Application + 1
+    };
+
+    static int phaseOf(UnitLauncher *launcher);
+    int phaseLimit(int phase) const;
+    void admit(UnitLauncher *launcher, Phase *phase);
+    void finish(UnitLauncher *launcher);
+    void drain();
+    void scheduleSample();
+    void sample();
+    qreal readPressure();
+
+    // Fixed, Start() may call back into submit()
+    Phase m_phases[PhaseCount];
+    QHash<UnitLauncher *, int> m_notReady;
+    int m_limit;
+    int m_adaptive;
+    quint64 m_sequence = 0;
+    quint64 m_timer = 0;
+    int m_pressureFds[ResourceCount];
+    qulonglong m_stalled[ResourceCount];
+    qint64 m_sampledAt = 0;
+};
+
+#endif // ADMISSIONCONTROLLER_H
@@ -0,0 +1,292 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "cgroupmanager.h"
+
+#include "unitlauncher.h"
+
+#include <QFile>
+#include <QDir>
+#include <QStringBuilder>
+#include <QDebug>
+
+#include <sys/statfs.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#ifndef CGROUP2_SUPER_MAGIC
+#define CGROUP2_SUPER_MAGIC 0x63677270
+#endif
+
+#define CGROUP_MOUNT_POINT "/sys/fs/cgroup"
+
+namespace {
+
+struct SliceWeights {
+    int type;
+    const char *name;
+    int login;  // cpu.weight and io.weight while logging in
+};
+
+// The default weight is 100, everything goes
+// back to it once the shell is ready
+const SliceWeights Slices[] = {
+    { UnitLauncher::Custom, "custom.slice", 1000 },
+    { UnitLauncher::Shell, "shell.slice", 1000 },
+    { UnitLauncher::Service, "service.slice", 100 },
+    { UnitLauncher::Application, "application.slice", 20 }
+};
+
+}
+
+CGroupManager *CGroupManager::global()
+{
+    static CGroupManager *instance = new CGroupManager;
+    return instance;
+}
+
+CGroupManager::CGroupManager()
+{
+}
+
+bool CGroupManager::init()
+{
+    if (m_enabled) {
+        return true;
+    }
+
+    struct statfs fs;
+    if (statfs(CGROUP_MOUNT_POINT, &fs) != 0 || fs.f_type != CGROUP2_SUPER_MAGIC) {
+        qDebug() << "No cgroup2 hierarchy, units share our cgroup";
+        return false;
+    }
+
+    // 0::/user.slice/user-1000.slice/session-2.scope
+    QFile self(QLatin1String("/proc/self/cgroup"));
+    if (!self.open(QFile::ReadOnly)) {
+        return false;
+    }
+    foreach (const QByteArray &line, self.readAll().split('\n')) {
+        if (line.startsWith("0::")) {
+            m_root = QLatin1String(CGROUP_MOUNT_POINT) % QFile::decodeName(line.mid(3).trimmed());
+        }
+    }
+
+    if (m_root.isEmpty() ||
+            access(QFile::encodeName(m_root % QLatin1String("/cgroup.subtree_control")).constData(), W_OK) != 0) {
+        qDebug() << "cgroup" << m_root << "is not delegated to us";
+        return false;
+    }
+
+    // No internal processes: whatever lives in our group,
+    // ourselves included, moves to a leaf before the
+    // controllers are enabled for the children
+    const QString manager = m_root % QLatin1String("/manager");
+    QDir().mkdir(manager);
+    QFile procs(m_root % QLatin1String("/cgroup.procs"));
+    if (procs.open(QFile::ReadOnly)) {
+        foreach (const QByteArray &pid, procs.readAll().split('\n')) {
+            if (!pid.isEmpty()) {
+                writeFile(manager % QLatin1String("/cgroup.procs"), pid);
+            }
+        }
+    }
+
+    // Not every controller might be delegated, use what we get
+    const QByteArray controllers[] = { "+cpu", "+io", "+memory" };
+    for (const QByteArray &controller : controllers) {
+        writeFile(m_root % QLatin1String("/cgroup.subtree_control"), controller);
+    }
+
+    for (const SliceWeights &slice : Slices) {
+        const QString path = m_root % QLatin1Char('/') % QLatin1String(slice.name);
+        if (!QDir().mkpath(path)) {
+            qWarning() << "Unable to create cgroup" << path;
+            return false;
+        }
+        // Units only need memory limits of their own
+        writeFile(path % QLatin1String("/cgroup.subtree_control"), "+memory");
+        m_slices.insert(slice.type, path);
+    }
+
+    m_enabled = true;
+    setWeights(true);
+    qDebug() << "Units are placed in cgroups below" << m_root;
+    return true;
+}
+
+bool CGroupManager::isEnabled() const
+{
+    return m_enabled;
+}
+
+QString CGroupManager::createGroup(int type, const QString &unit, qint64 memoryMax, qint64 memoryHigh)
+{
+    if (!m_enabled) {
+        return QString();
+    }
+
+    QString slice = m_slices.value(type);
+    if (slice.isEmpty()) {
+        slice = m_slices.value(UnitLauncher::Application);
+    }
+
+    QString name = unit;
+    name.replace(QLatin1Char('/'), QLatin1Char('_'));
+    const QString path = slice % QLatin1Char('/') % name;
+    if (!QDir().mkpath(path)) {
+        qWarning() << "Unable to create cgroup" << path;
+        return QString();
+    }
+
+    setMemoryLimits(path, memoryMax, memoryHigh);
+    return path;
+}
+
+void CGroupManager::setMemoryLimits(const QString &path, qint64 memoryMax, qint64 memoryHigh)
+{
+    writeFile(path % QLatin1String("/memory.max"),
+              memoryMax < 0 ? QByteArray("max") : QByteArray::number(memoryMax));
+    writeFile(path % QLatin1String("/memory.high"),
+              memoryHigh < 0 ? QByteArray("max") : QByteArray::number(memoryHigh));
+}
+
+void CGroupManager::removeGroup(const QString &path)
+{
+    if (!path.isEmpty()) {
+        rmdir(QFile::encodeName(path).constData());
+    }
+}
+
+int CGroupManager::openGroup(const QString &path) const
+{
+    if (path.isEmpty()) {
+        return -1;
+    }
+    return open(QFile::encodeName(path).constData(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+}
+
+bool CGroupManager::attach(const QString &path, pid_t pid) const
+{
+    return writeFile(path % QLatin1String("/cgroup.procs"), QByteArray::number(pid));
+}
+
+bool CGroupManager::isPopulated(const QString &path) const
+{
+    QFile events(path % QLatin1String("/cgroup.events"));
+    if (!events.open(QFile::ReadOnly)) {
+        return false;
+    }
+    return events.readAll().contains("populated 1");
+}
+
+int CGroupManager::signal(const QString &path, int signal) const
+{
+    QFile procs(path % QLatin1String("/cgroup.procs"));
+    if (!procs.open(QFile::ReadOnly)) {
+        return 0;
+    }
+
+    int ret = 0;
+    foreach (const QByteArray &line, procs.readAll().split('\n')) {
+        const pid_t pid = line.toInt();
+        if (pid > 0 && ::kill(pid, signal) == 0) {
+            ++ret;
+        }
+    }
+    return ret;
+}
+
+void CGroupManager::kill(const QString &path) const
+{
+    // Linux >= 5.14, also catches processes forking meanwhile
+    if (!writeFile(path % QLatin1String("/cgroup.kill"), "1")) {
+        signal(path, SIGKILL);
+    }
+}
+
+void CGroupManager::relaxWeights()
+{
+    if (m_enabled && !m_relaxed) {
+        m_relaxed = true;
+        setWeights(false);
+    }
+}
+
+qint64 CGroupManager::parseSize(const QString &value)
+{
+    QString size = value.trimmed();
+    if (size.isEmpty()) {
+        return -1;
+    }
+    if (size == QLatin1String("infinity")) {
+        return -1;
+    }
+
+    qint64 multiplier = 1;
+    const QChar suffix = size.at(size.size() - 1).toUpper();
+    if (suffix == QLatin1Char('K')) {
+        multiplier = Q_INT64_C(1) << 10;
+    } else if (suffix == QLatin1Char('M')) {
+        multiplier = Q_INT64_C(1) << 20;
+    } else if (suffix == QLatin1Char('G')) {
+        multiplier = Q_INT64_C(1) << 30;
+    } else if (suffix == QLatin1Char('T')) {
+        multiplier = Q_INT64_C(1) << 40;
+    }
+    if (multiplier != 1) {
+        size.chop(1);
+    }
+
+    bool ok;
+    const qint64 ret = size.toLongLong(&ok);
+    if (!ok || ret < 0) {
+        return -1;
+    }
+    return ret * multiplier;
+}
+
+void CGroupManager::setWeights(bool login)
+{
+    for (const SliceWeights &slice : Slices) {
+        const QString path = m_slices.value(slice.type);
+        const QByteArray weight = QByteArray::number(login ? slice.login : 100);
+        writeFile(path % QLatin1String("/cpu.weight"), weight);
+        writeFile(path % QLatin1String("/io.weight"), "default " + weight);
+    }
+}
+
+bool CGroupManager::writeFile(const QString &fileName, const QByteArray &data)
+{
+    // Plain write(), QFile would buffer and lose the errno
+    int fd = open(QFile::encodeName(fileName).constData(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool ret = write(fd, data.constData(), data.size()) == data.size();
+    if (!ret && errno != ENOENT && errno != ENODEV) {
+        qDebug() << "Failed to write" << data << "to" << fileName << strerror(errno);
+    }
+    close(fd);
+    return ret;
+}
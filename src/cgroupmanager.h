@@ -0,0 +1,117 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef CGROUPMANAGER_H
+#define CGROUPMANAGER_H
+
+#include <QString>
+#include <QHash>
+
+#include <sys/types.h>
+
+/**
+ * @brief The CGroupManager class
+ * Places units in cgroup v2 groups below the subtree
+ * delegated to the session, the manager itself moves to
+ * a "manager" leaf and every unit type gets a slice:
+ *
+ *   <session cgroup>/manager
+ *   <session cgroup>/custom.slice/<unit>
+ *   <session cgroup>/shell.slice/<unit>
+ *   <session cgroup>/service.slice/<unit>
+ *   <session cgroup>/application.slice/<unit>
+ *
+ * While logging in the Window Manager and the shell get
+ * most of the CPU and IO, the weights are evened out once
+ * the shell is ready. When there is no writable cgroup2
+ * hierarchy everything is a no-op.
+ */
+class CGroupManager
+{
+public:
+    static CGroupManager *global();
+
+    /**
+     * Sets up the slices, returns false when
+     * cgroups are not available to us
+     */
+    bool init();
+    bool isEnabled() const;
+
+    /**
+     * Creates the cgroup of \p unit in the slice of \p type
+     * and applies the memory limits, -1 leaves them unset.
+     * Returns an empty path on failure.
+     */
+    QString createGroup(int type, const QString &unit, qint64 memoryMax, qint64 memoryHigh);
+
+    /**
+     * Writes memory.max and memory.high, -1 means no limit
+     */
+    void setMemoryLimits(const QString &path, qint64 memoryMax, qint64 memoryHigh);
+
+    /**
+     * Removes the group if it's empty
+     */
+    void removeGroup(const QString &path);
+
+    /**
+     * O_PATH descriptor of the group for spawning
+     * straight into it, -1 on failure
+     */
+    int openGroup(const QString &path) const;
+
+    bool attach(const QString &path, pid_t pid) const;
+    bool isPopulated(const QString &path) const;
+
+    /**
+     * Sends \p signal to every process in the group,
+     * returns how many processes were signalled
+     */
+    int signal(const QString &path, int signal) const;
+
+    /**
+     * SIGKILLs the whole group atomically through cgroup.kill,
+     * or process by process on older kernels
+     */
+    void kill(const QString &path) const;
+
+    /**
+     * Drops the login time priorities
+     */
+    void relaxWeights();
+
+    /**
+     * Parses MemoryMax= style values: bytes with an optional
+     * K, M, G or T suffix, or infinity. Returns -1 for no limit.
+     */
+    static qint64 parseSize(const QString &value);
+
+private:
+    CGroupManager();
+    void setWeights(bool login);
+    static bool writeFile(const QString &fileName, const QByteArray &data);
+
+    QString m_root;
+    QHash<int, QString> m_slices;
+    bool m_enabled = false;
+    bool m_relaxed = false;
+};
+
+#endif // CGROUPMANAGER_H
@@ -0,0 +1,274 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "childsupervisor.h"
+
+#include "unitlauncher.h"
+
+#include <QCoreApplication>
+#include <QSocketNotifier>
+#include <QDebug>
+
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+#define EPOLL_BATCH 64
+
+namespace {
+
+int s_pipe[2] = { -1, -1 };
+struct sigaction s_previous;
+
+int pidfdOpen(pid_t pid)
+{
+    return int(syscall(SYS_pidfd_open, pid, 0));
+}
+
+// Back to the status waitpid() would have given
+int waitStatus(const siginfo_t &info)
+{
+    if (info.si_code == CLD_EXITED) {
+        return (info.si_status & 0xff) << 8;
+    }
+    return (info.si_status & 0x7f) | (info.si_code == CLD_DUMPED ? 0x80 : 0);
+}
+
+}
+
+ChildSupervisor *ChildSupervisor::global()
+{
+    static ChildSupervisor *instance = new ChildSupervisor(qApp);
+    return instance;
+}
+
+ChildSupervisor::ChildSupervisor(QObject *parent) :
+    QObject(parent)
+{
+    // waitid(P_PIDFD) needs Linux 5.4, on our own pidfd
+    // it fails with ECHILD there and EINVAL before
+    int self = pidfdOpen(getpid());
+    if (self >= 0) {
+        siginfo_t info;
+        bool supported = waitid(idtype_t(P_PIDFD), self, &info, WEXITED | WNOHANG) == 0 || errno == ECHILD;
+        close(self);
+
+        if (supported) {
+            m_epoll = epoll_create1(EPOLL_CLOEXEC);
+        }
+    }
+
+    if (m_epoll >= 0) {
+        m_epollNotifier = new QSocketNotifier(m_epoll, QSocketNotifier::Read, this);
+        connect(m_epollNotifier, &QSocketNotifier::activated,
+                this, &ChildSupervisor::reapPidfds);
+    } else {
+        qDebug() << "No pidfd support, reaping units on SIGCHLD";
+        installSigchld();
+    }
+}
+
+ChildSupervisor::~ChildSupervisor()
+{
+    foreach (const Child &child, m_children) {
+        if (child.pidfd >= 0) {
+            close(child.pidfd);
+        }
+    }
+    if (m_epoll >= 0) {
+        close(m_epoll);
+    }
+}
+
+void ChildSupervisor::watch(pid_t pid, UnitLauncher *launcher)
+{
+    Child child;
+    child.launcher = launcher;
+    child.pidfd = -1;
+
+    if (m_epoll >= 0) {
+        // Not racy, an unreaped child keeps its pid
+        child.pidfd = pidfdOpen(pid);
+        if (child.pidfd >= 0) {
+            struct epoll_event event;
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN;
+            event.data.u64 = quint64(pid);
+            if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, child.pidfd, &event) != 0) {
+                close(child.pidfd);
+                child.pidfd = -1;
+            }
+        }
+
+        if (child.pidfd < 0) {
+            qWarning() << "Unable to get a pidfd for" << pid << strerror(errno);
+            installSigchld();
+        }
+    }
+
+    if (child.pidfd < 0) {
+        ++m_polled;
+    }
+    m_children.insert(pid, child);
+}
+
+void ChildSupervisor::unwatch(pid_t pid)
+{
+    QHash<pid_t, Child>::Iterator it = m_children.find(pid);
+    if (it != m_children.end()) {
+        // Forgetting it would leave a zombie behind
+        it.value().launcher = 0;
+    }
+}
+
+void ChildSupervisor::reapPidfds()
+{
+    // Collect first, launchers may spawn again while handling the exit
+    ExitedChildren exited;
+    struct epoll_event events[EPOLL_BATCH];
+    Q_FOREVER {
+        int count = epoll_wait(m_epoll, events, EPOLL_BATCH, 0);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            const pid_t pid = pid_t(events[i].data.u64);
+            QHash<pid_t, Child>::Iterator it = m_children.find(pid);
+            if (it == m_children.end()) {
+                continue;
+            }
+
+            siginfo_t info;
+            memset(&info, 0, sizeof(info));
+            if (waitid(idtype_t(P_PIDFD), it.value().pidfd, &info, WEXITED | WNOHANG) != 0) {
+                if (errno != ECHILD) {
+                    continue;
+                }
+            } else if (info.si_pid == 0) {
+                continue;
+            }
+
+            exited.append(qMakePair(QPointer<UnitLauncher>(it.value().launcher), waitStatus(info)));
+            close(it.value().pidfd);
+            m_children.erase(it);
+        }
+
+        if (count < EPOLL_BATCH) {
+            break;
+        }
+    }
+
+    dispatch(exited);
+}
+
+void ChildSupervisor::reap()
+{
+    char buffer[64];
+    while (read(s_pipe[0], buffer, sizeof(buffer)) > 0) {
+    }
+
+    if (!m_polled) {
+        return;
+    }
+
+    ExitedChildren exited;
+    QHash<pid_t, Child>::Iterator it = m_children.begin();
+    while (it != m_children.end()) {
+        if (it.value().pidfd >= 0) {
+            ++it;
+            continue;
+        }
+
+        int status;
+        pid_t ret = waitpid(it.key(), &status, WNOHANG);
+        if (ret == it.key() || (ret < 0 && errno == ECHILD)) {
+            exited.append(qMakePair(QPointer<UnitLauncher>(it.value().launcher), ret < 0 ? 0 : status));
+            it = m_children.erase(it);
+            --m_polled;
+        } else {
+            ++it;
+        }
+    }
+
+    dispatch(exited);
+}
+
+void ChildSupervisor::installSigchld()
+{
+    if (m_notifier) {
+        return;
+    }
+
+    if (pipe2(s_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+        qCritical() << "Unable to create the SIGCHLD pipe" << strerror(errno);
+        return;
+    }
+
+    m_notifier = new QSocketNotifier(s_pipe[0], QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated,
+            this, &ChildSupervisor::reap);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = &ChildSupervisor::sigchld;
+    action.sa_flags = SA_SIGINFO | SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGCHLD, &action, &s_previous);
+}
+
+void ChildSupervisor::dispatch(const ExitedChildren &exited)
+{
+    // A launcher handling its exit may delete another one
+    for (int i = 0; i < exited.size(); ++i) {
+        if (exited.at(i).first) {
+            exited.at(i).first->processExited(exited.at(i).second);
+        }
+    }
+}
+
+void ChildSupervisor::sigchld(int signal, siginfo_t *info, void *context)
+{
+    int savedErrno = errno;
+    char c = 0;
+    ssize_t ret = write(s_pipe[1], &c, 1);
+    Q_UNUSED(ret)
+    errno = savedErrno;
+
+    if (s_previous.sa_flags & SA_SIGINFO) {
+        if (s_previous.sa_sigaction) {
+            s_previous.sa_sigaction(signal, info, context);
+        }
+    } else if (s_previous.sa_handler != SIG_DFL && s_previous.sa_handler != SIG_IGN) {
+        s_previous.sa_handler(signal);
+    }
+}
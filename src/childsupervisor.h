@@ -0,0 +1,88 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef CHILDSUPERVISOR_H
+#define CHILDSUPERVISOR_H
+
+#include <QObject>
+#include <QHash>
+#include <QPointer>
+#include <QVector>
+#include <QPair>
+
+#include <sys/types.h>
+#include <signal.h>
+
+class QSocketNotifier;
+class UnitLauncher;
+
+typedef QVector<QPair<QPointer<UnitLauncher>, int> > ExitedChildren;
+
+/**
+ * @brief The ChildSupervisor class
+ * Reaps the unit processes. Every child gets a pidfd in a
+ * single epoll set watched by one QSocketNotifier, a wakeup
+ * reaps all children that exited with waitid(P_PIDFD) and
+ * only then reports them, so the cost per child is constant.
+ *
+ * On kernels without pidfds (< 5.4) a SIGCHLD handler wakes
+ * the event loop through a pipe and the tracked pids are
+ * polled with waitpid(). signalfd is not an option, SIGCHLD
+ * would have to be blocked in every thread, breaking QProcess.
+ * Either way only the pids we spawned are waited for and the
+ * previous SIGCHLD handler is chained.
+ */
+class ChildSupervisor : public QObject
+{
+    Q_OBJECT
+public:
+    static ChildSupervisor *global();
+    virtual ~ChildSupervisor();
+
+    void watch(pid_t pid, UnitLauncher *launcher);
+
+    /**
+     * The launcher of \p pid is going away, the child is
+     * still reaped when it exits but nobody is notified
+     */
+    void unwatch(pid_t pid);
+
+private Q_SLOTS:
+    void reapPidfds();
+    void reap();
+
+private:
+    explicit ChildSupervisor(QObject *parent = 0);
+    void installSigchld();
+    void dispatch(const ExitedChildren &exited);
+    static void sigchld(int signal, siginfo_t *info, void *context);
+
+    struct Child {
+        UnitLauncher *launcher;
+        int pidfd;
+    };
+
+    QHash<pid_t, Child> m_children;
+    int m_polled = 0;
+    int m_epoll = -1;
+    QSocketNotifier *m_epollNotifier = 0;
+    QSocketNotifier *m_notifier = 0;
+};
+
+#endif // CHILDSUPERVISOR_H
@@ -0,0 +1,225 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+#include "dbusactivator.h"
+
+#include "timerqueue.h"
+
+#include <QCoreApplication>
+#include <QDBusConnection>
+#include <QDBusConnectionInterface>
+#include <QStandardPaths>
+#include <QSaveFile>
+#include <QFile>
+#include <QDir>
+#include <QHash>
+#include <QStringBuilder>
+#include <QDebug>
+
+// The bus gives up on an activation after its own
+// timeout, the helper must not give up before
+#define ACTIVATION_REPLY_TIMEOUT 120000
+
+// Marks the service files we wrote
+#define ACTIVATION_MARKER "X-Lemuri-Activator=true"
+
+namespace {
+
+QHash<QString, DBusActivator *> &activators()
+{
+    static QHash<QString, DBusActivator *> activators;
+    return activators;
+}
+
+// The transient directory every session bus searches
+// first, see <standard_session_servicedirs/>
+QString serviceDirectory()
+{
+    const QString runtime = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation);
+    if (runtime.isEmpty()) {
+        return QString();
+    }
+    return runtime % QLatin1String("/dbus-1/services");
+}
+
+// Left behind by a session that didn't exit cleanly
+void removeStaleFiles(const QString &directory)
+{
+    static bool removed = false;
+    if (removed) {
+        return;
+    }
+    removed = true;
+
+    QDir dir(directory);
+    foreach (const QString &fileName, dir.entryList(QStringList() << QLatin1String("*.service"), QDir::Files)) {
+        QFile file(dir.filePath(fileName));
+        if (file.open(QIODevice::ReadOnly) && file.readAll().contains(ACTIVATION_MARKER)) {
+            file.remove();
+        }
+    }
+}
+
+}
+
+DBusActivator::DBusActivator(const QString &service, QObject *parent) :
+    QObject(parent),
+    m_service(service)
+{
+}
+
+DBusActivator::~DBusActivator()
+{
+    discard(QLatin1String("org.freedesktop.DBus.Error.ServiceUnknown"),
+            QLatin1String("The unit providing the service was removed"));
+    release();
+}
+
+QString DBusActivator::service() const
+{
+    return m_service;
+}
+
+DBusActivator *DBusActivator::find(const QString &service)
+{
+    return activators().value(service);
+}
+
+bool DBusActivator::arm()
+{
+    if (m_armed) {
+        return true;
+    }
+
+    DBusActivator *other = activators().value(m_service);
+    if (other && other != this) {
+        qWarning() << "Another unit already activates" << m_service;
+        return false;
+    }
+
+    const QString dbusSend = QStandardPaths::findExecutable(QLatin1String("dbus-send"));
+    const QString address = QString::fromLocal8Bit(qgetenv("DBUS_SESSION_BUS_ADDRESS"));
+    const QString fileName = serviceFile();
+    if (dbusSend.isEmpty() || address.isEmpty() || fileName.isEmpty() ||
+            !QDir().mkpath(serviceDirectory())) {
+        qWarning() << "Unable to make" << m_service << "activatable, no dbus-send or runtime directory";
+        return false;
+    }
+
+    removeStaleFiles(serviceDirectory());
+
+    // The helper lives until we answer, the bus only
+    // counts the activation as failed if it exits first
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Unable to write" << fileName << file.errorString();
+        return false;
+    }
+    file.write("[D-BUS Service]\n");
+    file.write("Name=" + m_service.toUtf8() + '\n');
+    file.write("Exec=" + QFile::encodeName(dbusSend) +
+               " '--bus=" + address.toUtf8() + "' --print-reply" +
+               " --reply-timeout=" + QByteArray::number(ACTIVATION_REPLY_TIMEOUT) +
+               " --dest=org.lemuri.session /org/lemuri/session" +
+               " org.lemuri.session.ActivateService string:" + m_service.toUtf8() + '\n');
+    file.write(ACTIVATION_MARKER "\n");
+    if (!file.commit()) {
+        qWarning() << "Unable to write" << fileName << file.errorString();
+        return false;
+    }
+
+    activators().insert(m_service, this);
+    m_armed = true;
+    reloadConfig();
+    return true;
+}
+
+bool DBusActivator::isArmed() const
+{
+    return m_armed;
+}
+
+void DBusActivator::release()
+{
+    if (!m_armed) {
+        return;
+    }
+
+    m_armed = false;
+    activators().remove(m_service);
+    QFile::remove(serviceFile());
+    reloadConfig();
+}
+
+void DBusActivator::activate(const QDBusMessage &request)
+{
+    m_requests.append(request);
+    if (m_requests.size() == 1) {
+        qDebug() << "Activating" << m_service;
+        emit activationRequested();
+    }
+}
+
+void DBusActivator::flush()
+{
+    const QList<QDBusMessage> requests = m_requests;
+    m_requests.clear();
+
+    foreach (const QDBusMessage &request, requests) {
+        QDBusConnection::sessionBus().send(request.createReply());
+    }
+}
+
+void DBusActivator::discard(const QString &errorName, const QString &errorMessage)
+{
+    const QList<QDBusMessage> requests = m_requests;
+    m_requests.clear();
+
+    foreach (const QDBusMessage &request, requests) {
+        QDBusConnection::sessionBus().send(request.createErrorReply(errorName, errorMessage));
+    }
+}
+
+QString DBusActivator::serviceFile() const
+{
+    const QString directory = serviceDirectory();
+    if (directory.isEmpty()) {
+        return QString();
+    }
+    return directory % QLatin1Char('/') % m_service % QLatin1String(".service");
+}
+
+void DBusActivator::reloadConfig()
+{
+    // The bus also notices the directory changed on its own,
+    // asking is only faster. One call without waiting for the
+    // reply covers every name armed or released in this pass
+    static bool pending = false;
+    if (pending) {
+        return;
+    }
+    pending = true;
+
+    TimerQueue::global()->start(0, qApp, []() {
+        pending = false;
+        QDBusConnectionInterface *interface = QDBusConnection::sessionBus().interface();
+        if (interface) {
+            interface->asyncCall(QLatin1String("ReloadConfig"));
+        }
+    });
+}
@@ -0,0 +1,93 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+#ifndef DBUSACTIVATOR_H
+#define DBUSACTIVATOR_H
+
+#include <QObject>
+#include <QDBusMessage>
+#include <QList>
+
+/**
+ * @brief The DBusActivator class
+ * Makes the well-known name of a DBusExec unit activatable
+ * by the bus itself. A transient .service file is written
+ * whose Exec= asks us to start the unit, the bus then holds
+ * the callers' messages, with their real sender, until the
+ * unit claims the name. The activation request is answered
+ * once the name is owned, or with an error if the unit
+ * couldn't be started so the bus fails the pending calls.
+ */
+class DBusActivator : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DBusActivator(const QString &service, QObject *parent = 0);
+    virtual ~DBusActivator();
+
+    QString service() const;
+
+    /**
+     * The activator of \p service, if one is armed
+     */
+    static DBusActivator *find(const QString &service);
+
+    /**
+     * Installs the service file, returns false if the
+     * name can't be made activatable
+     */
+    bool arm();
+    bool isArmed() const;
+
+    /**
+     * Removes the service file, the name is no
+     * longer activated through us
+     */
+    void release();
+
+    /**
+     * An activation \p request from the bus, answered
+     * by flush() or discard()
+     */
+    void activate(const QDBusMessage &request);
+
+    /**
+     * Answers the activation requests, to be called
+     * once the unit owns the name
+     */
+    void flush();
+
+    /**
+     * Fails the activation requests with \p errorName,
+     * used when the unit couldn't be started
+     */
+    void discard(const QString &errorName, const QString &errorMessage);
+
+Q_SIGNALS:
+    void activationRequested();
+
+private:
+    QString serviceFile() const;
+    static void reloadConfig();
+
+    QString m_service;
+    QList<QDBusMessage> m_requests;
+    bool m_armed = false;
+};
+
+#endif // DBUSACTIVATOR_H
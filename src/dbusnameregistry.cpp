@@ -0,0 +1,160 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "dbusnameregistry.h"
+
+#include "unitlauncher.h"
+
+#include <QDBusServiceWatcher>
+#include <QDBusConnectionInterface>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
+#include <QDebug>
+
+DBusNameRegistry::DBusNameRegistry(QDBusConnection::BusType bus, QObject *parent) :
+    QObject(parent),
+    m_bus(bus),
+    m_connection(bus == QDBusConnection::SystemBus ? QDBusConnection::systemBus() : QDBusConnection::sessionBus())
+{
+    m_watcher = new QDBusServiceWatcher(this);
+    m_watcher->setConnection(m_connection);
+    m_watcher->setWatchMode(QDBusServiceWatcher::WatchForOwnerChange);
+    connect(m_watcher, &QDBusServiceWatcher::serviceOwnerChanged,
+            this, &DBusNameRegistry::serviceOwnerChanged);
+}
+
+DBusNameRegistry::~DBusNameRegistry()
+{
+}
+
+QDBusConnection::BusType DBusNameRegistry::bus() const
+{
+    return m_bus;
+}
+
+void DBusNameRegistry::addUnit(UnitLauncher *launcher)
+{
+    foreach (const QString &service, watchedNames(launcher)) {
+        QVector<UnitLauncher *> &waiting = m_waiting[service];
+        if (waiting.contains(launcher)) {
+            continue;
+        }
+
+        if (waiting.isEmpty()) {
+            m_watcher->addWatchedService(service);
+            if (m_seeded && m_connection.interface() &&
+                    m_connection.interface()->isServiceRegistered(service)) {
+                m_registered.insert(service);
+            }
+        }
+        waiting.append(launcher);
+
+        if (m_registered.contains(service)) {
+            launcher->serviceOwnerChanged(m_bus, service, true);
+        }
+    }
+}
+
+void DBusNameRegistry::removeUnit(UnitLauncher *launcher)
+{
+    foreach (const QString &service, watchedNames(launcher)) {
+        QHash<QString, QVector<UnitLauncher *> >::Iterator it = m_waiting.find(service);
+        if (it == m_waiting.end()) {
+            continue;
+        }
+
+        it.value().removeOne(launcher);
+        if (it.value().isEmpty()) {
+            m_waiting.erase(it);
+            m_watcher->removeWatchedService(service);
+            m_registered.remove(service);
+        }
+    }
+}
+
+bool DBusNameRegistry::isRegistered(const QString &service) const
+{
+    return m_registered.contains(service);
+}
+
+void DBusNameRegistry::seed()
+{
+    QDBusConnectionInterface *interface = m_connection.interface();
+    if (!interface) {
+        qWarning() << "Not connected to bus" << m_bus;
+        return;
+    }
+
+    QDBusPendingCallWatcher *call = new QDBusPendingCallWatcher(interface->asyncCall(QLatin1String("ListNames")), this);
+    connect(call, &QDBusPendingCallWatcher::finished,
+            this, &DBusNameRegistry::listNamesFinished);
+}
+
+void DBusNameRegistry::serviceOwnerChanged(const QString &service, const QString &oldOwner, const QString &newOwner)
+{
+    Q_UNUSED(oldOwner)
+    setRegistered(service, !newOwner.isEmpty());
+}
+
+void DBusNameRegistry::listNamesFinished(QDBusPendingCallWatcher *call)
+{
+    QDBusPendingReply<QStringList> reply = *call;
+    call->deleteLater();
+    m_seeded = true;
+
+    if (reply.isError()) {
+        qWarning() << "Failed to list names on bus" << m_bus << reply.error().message();
+        return;
+    }
+
+    foreach (const QString &service, reply.value()) {
+        if (m_waiting.contains(service)) {
+            setRegistered(service, true);
+        }
+    }
+}
+
+QStringList DBusNameRegistry::watchedNames(UnitLauncher *launcher) const
+{
+    QStringList ret = launcher->dbusRequires(m_bus);
+    if (m_bus == QDBusConnection::SessionBus && !launcher->dbusName().isEmpty() &&
+            !ret.contains(launcher->dbusName())) {
+        ret.append(launcher->dbusName());
+    }
+    return ret;
+}
+
+void DBusNameRegistry::setRegistered(const QString &service, bool registered)
+{
+    if (registered == m_registered.contains(service)) {
+        return;
+    }
+
+    if (registered) {
+        m_registered.insert(service);
+    } else {
+        m_registered.remove(service);
+    }
+
+    // Copy as units might start or stop in the callback
+    const QVector<UnitLauncher *> waiting = m_waiting.value(service);
+    foreach (UnitLauncher *launcher, waiting) {
+        launcher->serviceOwnerChanged(m_bus, service, registered);
+    }
+}
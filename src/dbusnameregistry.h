@@ -0,0 +1,77 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef DBUSNAMEREGISTRY_H
+#define DBUSNAMEREGISTRY_H
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QVector>
+#include <QDBusConnection>
+
+class QDBusServiceWatcher;
+class QDBusPendingCallWatcher;
+class UnitLauncher;
+
+/**
+ * @brief The DBusNameRegistry class
+ * Tracks the D-Bus names units depend on for a single bus,
+ * there is one instance per bus for the whole session.
+ * Units are told when one of their names appears or
+ * vanishes, they keep a counter of missing names so
+ * checking if they can start is O(1).
+ */
+class DBusNameRegistry : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DBusNameRegistry(QDBusConnection::BusType bus, QObject *parent = 0);
+    virtual ~DBusNameRegistry();
+
+    QDBusConnection::BusType bus() const;
+
+    void addUnit(UnitLauncher *launcher);
+    void removeUnit(UnitLauncher *launcher);
+
+    bool isRegistered(const QString &service) const;
+
+    /**
+     * Queries all names already on the bus with a single
+     * ListNames call, names added later are queried one by one.
+     */
+    void seed();
+
+private Q_SLOTS:
+    void serviceOwnerChanged(const QString &service, const QString &oldOwner, const QString &newOwner);
+    void listNamesFinished(QDBusPendingCallWatcher *call);
+
+private:
+    QStringList watchedNames(UnitLauncher *launcher) const;
+    void setRegistered(const QString &service, bool registered);
+
+    QDBusConnection::BusType m_bus;
+    QDBusConnection m_connection;
+    QDBusServiceWatcher *m_watcher;
+    QHash<QString, QVector<UnitLauncher *> > m_waiting;
+    QSet<QString> m_registered;
+    bool m_seeded = false;
+};
+
+#endif // DBUSNAMEREGISTRY_H
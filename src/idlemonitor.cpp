@@ -0,0 +1,168 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "idlemonitor.h"
+
+#include "timerqueue.h"
+
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
+#include <QFile>
+#include <QDebug>
+
+// Quiet time needed unless the session configures it
+#define IDLE_WINDOW 15000
+
+#define IDLE_SAMPLE_INTERVAL 1000
+
+// Busy share of the CPUs still considered quiet
+#define IDLE_CPU_THRESHOLD 0.25
+
+IdleMonitor::IdleMonitor(QObject *parent) :
+    QObject(parent),
+    m_window(IDLE_WINDOW)
+{
+}
+
+IdleMonitor::~IdleMonitor()
+{
+    TimerQueue::global()->cancel(m_timer);
+}
+
+void IdleMonitor::setWindow(int msecs)
+{
+    m_window = qMax(0, msecs);
+}
+
+int IdleMonitor::window() const
+{
+    return m_window;
+}
+
+void IdleMonitor::start()
+{
+    if (m_active) {
+        return;
+    }
+    m_active = true;
+
+    // Quiet is only trusted once it was measured for a window
+    const qint64 now = TimerQueue::now();
+    m_loadQuietSince = now;
+    m_inputQuietSince = now;
+    m_cpuTotal = 0;
+    sample();
+}
+
+void IdleMonitor::stop()
+{
+    m_active = false;
+    TimerQueue::global()->cancel(m_timer);
+    m_timer = 0;
+}
+
+bool IdleMonitor::isActive() const
+{
+    return m_active;
+}
+
+void IdleMonitor::scheduleSample()
+{
+    if (m_timer || !m_active) {
+        return;
+    }
+
+    m_timer = TimerQueue::global()->start(IDLE_SAMPLE_INTERVAL, this, [this]() {
+        m_timer = 0;
+        sample();
+    });
+}
+
+void IdleMonitor::sample()
+{
+    const qint64 now = TimerQueue::now();
+
+    QFile stat(QLatin1String("/proc/stat"));
+    if (stat.open(QFile::ReadOnly)) {
+        // cpu user nice system idle iowait irq softirq steal...
+        const QList<QByteArray> fields = stat.readLine().simplified().split(' ');
+        qulonglong total = 0;
+        for (int i = 1; i < fields.size(); ++i) {
+            total += fields.at(i).toULongLong();
+        }
+        // Waiting on IO isn't quiet
+        const qulonglong idle = fields.size() > 4 ? fields.at(4).toULongLong() : 0;
+
+        if (m_cpuTotal && total > m_cpuTotal) {
+            const double busy = 1.0 - double(idle - m_cpuIdle) / (total - m_cpuTotal);
+            if (busy > IDLE_CPU_THRESHOLD) {
+                m_loadQuietSince = now;
+            }
+        }
+        m_cpuTotal = total;
+        m_cpuIdle = idle;
+    }
+
+    if (m_inputSupported && !m_inputCall) {
+        QDBusMessage message = QDBusMessage::createMethodCall(QLatin1String("org.freedesktop.ScreenSaver"),
+                                                              QLatin1String("/org/freedesktop/ScreenSaver"),
+                                                              QLatin1String("org.freedesktop.ScreenSaver"),
+                                                              QLatin1String("GetSessionIdleTime"));
+        m_inputCall = new QDBusPendingCallWatcher(QDBusConnection::sessionBus().asyncCall(message), this);
+        connect(m_inputCall, &QDBusPendingCallWatcher::finished,
+                this, &IdleMonitor::inputIdleFinished);
+    } else {
+        check();
+    }
+}
+
+void IdleMonitor::inputIdleFinished(QDBusPendingCallWatcher *call)
+{
+    QDBusPendingReply<uint> reply = *call;
+    call->deleteLater();
+    m_inputCall = 0;
+
+    if (reply.isError()) {
+        qDebug() << "No input idle time, only the load is watched" << reply.error().message();
+        m_inputSupported = false;
+    } else {
+        // msecs since the last input
+        m_inputQuietSince = qMax(m_inputQuietSince, TimerQueue::now() - qint64(reply.value()));
+    }
+    check();
+}
+
+void IdleMonitor::check()
+{
+    if (!m_active) {
+        return;
+    }
+
+    const qint64 now = TimerQueue::now();
+    const qint64 quiet = now - qMax(m_loadQuietSince, m_inputQuietSince);
+    if (quiet >= m_window) {
+        qDebug() << "Session idle for" << quiet << "msecs";
+        stop();
+        emit idle();
+        return;
+    }
+    scheduleSample();
+}
@@ -0,0 +1,72 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef IDLEMONITOR_H
+#define IDLEMONITOR_H
+
+#include <QObject>
+
+class QDBusPendingCallWatcher;
+
+/**
+ * @brief The IdleMonitor class
+ * Tells when the session has been quiet for window() msecs:
+ * the CPUs were mostly idle (from /proc/stat) and there was no
+ * user input, as org.freedesktop.ScreenSaver reports it. Without
+ * a screensaver service only the load is looked at.
+ *
+ * It only samples between start() and the idle() signal.
+ */
+class IdleMonitor : public QObject
+{
+    Q_OBJECT
+public:
+    explicit IdleMonitor(QObject *parent = 0);
+    virtual ~IdleMonitor();
+
+    void setWindow(int msecs);
+    int window() const;
+
+    void start();
+    void stop();
+    bool isActive() const;
+
+Q_SIGNALS:
+    void idle();
+
+private Q_SLOTS:
+    void inputIdleFinished(QDBusPendingCallWatcher *call);
+
+private:
+    void scheduleSample();
+    void sample();
+    void check();
+
+    int m_window;
+    bool m_active = false;
+    quint64 m_timer = 0;
+    qulonglong m_cpuTotal = 0;
+    qulonglong m_cpuIdle = 0;
+    qint64 m_loadQuietSince = 0;
+    qint64 m_inputQuietSince = 0;
+    bool m_inputSupported = true;
+    QDBusPendingCallWatcher *m_inputCall = 0;
+};
+
+#endif // IDLEMONITOR_H
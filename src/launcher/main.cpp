@@ -0,0 +1,304 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+/**
+ * lemuri-session-launcher, started by lemuri-session early in
+ * the session. It preloads the common toolkit libraries once and
+ * then forks units on request, children load the module of the
+ * program and run its entry point, so they skip exec, dynamic
+ * linking and relocation of everything already loaded here.
+ *
+ * Children are cloned with CLONE_PARENT, they are children of
+ * lemuri-session which reaps them like any other unit.
+ *
+ * This stays free of Qt on purpose, the modules create their
+ * own QCoreApplication in the forked child.
+ */
+
+#include "launcherprotocol.h"
+
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+extern char **environ;
+
+static const char *defaultPreload[] = {
+    "libQt5Core.so.5",
+    "libQt5Gui.so.5",
+    "libQt5DBus.so.5",
+    "libQt5Network.so.5",
+    "libQt5Widgets.so.5",
+    "libglib-2.0.so.0",
+    "libgobject-2.0.so.0",
+    "libgio-2.0.so.0",
+    "libgtk-3.so.0",
+    0
+};
+
+static char requestBuffer[LAUNCHER_MAX_REQUEST];
+
+static void reply(int socket, int error, pid_t pid)
+{
+    LauncherReply reply;
+    reply.error = error;
+    reply.pid = pid;
+    if (send(socket, &reply, sizeof(reply), MSG_NOSIGNAL) != sizeof(reply)) {
+        // lemuri-session is gone, the next recv() says so
+        fprintf(stderr, "lemuri-session-launcher: failed to reply: %s\n", strerror(errno));
+    }
+}
+
+static void preload(const std::vector<const char *> &libraries)
+{
+    for (const char *library : libraries) {
+        // Resolved now, children don't pay for it anymore
+        if (!dlopen(library, RTLD_NOW | RTLD_GLOBAL)) {
+            fprintf(stderr, "lemuri-session-launcher: not preloading %s\n", dlerror());
+        }
+    }
+}
+
+static const char *baseName(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+static void runChild(int socket, const std::string &module, char **argv, char **envp, int fds[3])
+{
+    close(socket);
+
+    if (fds[2] >= 0) {
+        // Before running anything, forks of the unit end up there too
+        int procs = openat(fds[2], "cgroup.procs", O_WRONLY | O_CLOEXEC);
+        if (procs < 0 || write(procs, "0", 1) != 1) {
+            fprintf(stderr, "lemuri-session-launcher: failed to join cgroup: %s\n", strerror(errno));
+        }
+        if (procs >= 0) {
+            close(procs);
+        }
+        close(fds[2]);
+    }
+
+    if (fds[0] >= 0) {
+        dup2(fds[0], STDOUT_FILENO);
+        close(fds[0]);
+    }
+    if (fds[1] >= 0) {
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[1]);
+    }
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, 0);
+    prctl(PR_SET_NAME, baseName(argv[0]));
+
+    environ = envp;
+
+    int argc = 0;
+    while (argv[argc]) {
+        ++argc;
+    }
+
+    void *handle = dlopen(module.c_str(), RTLD_NOW | RTLD_LOCAL);
+    LauncherEntryPoint entry = handle ? reinterpret_cast<LauncherEntryPoint>(dlsym(handle, LAUNCHER_ENTRY_POINT)) : 0;
+    if (entry) {
+        exit(entry(argc, argv));
+    }
+
+    // A broken module still gets the program started
+    fprintf(stderr, "lemuri-session-launcher: %s, executing %s\n", dlerror(), argv[0]);
+    execvpe(argv[0], argv, envp);
+    fprintf(stderr, "lemuri-session-launcher: failed to execute %s: %s\n", argv[0], strerror(errno));
+    _exit(127);
+}
+
+static void handleRequest(int socket, const std::string &moduleDir, ssize_t size, int flags, int received[3])
+{
+    int fds[3] = { -1, -1, -1 };
+    const LauncherRequest *request = reinterpret_cast<const LauncherRequest *>(requestBuffer);
+
+    int error = 0;
+    if (flags & MSG_TRUNC) {
+        error = E2BIG;
+    } else if (size < ssize_t(sizeof(LauncherRequest)) ||
+               request->version != LAUNCHER_PROTOCOL_VERSION || request->argc == 0) {
+        error = EINVAL;
+    }
+
+    if (!error) {
+        int index = 0;
+        const uint32_t bits[] = { LauncherStdout, LauncherStderr, LauncherCGroup };
+        for (int i = 0; i < 3; ++i) {
+            if (request->fds & bits[i]) {
+                fds[i] = received[index++];
+            }
+        }
+    }
+
+    // Split the strings in place
+    std::vector<char *> argv;
+    std::vector<char *> envp;
+    char *it = requestBuffer + sizeof(LauncherRequest);
+    char *end = requestBuffer + size;
+    if (!error) {
+        const uint32_t count = request->argc + request->envc;
+        for (uint32_t i = 0; i < count && it < end; ++i) {
+            char *string = it;
+            it = static_cast<char *>(memchr(it, '\0', end - it));
+            if (!it) {
+                break;
+            }
+            ++it;
+            if (i < request->argc) {
+                argv.push_back(string);
+            } else {
+                envp.push_back(string);
+            }
+        }
+        if (argv.size() + envp.size() != count) {
+            error = EINVAL;
+        }
+    }
+
+    std::string module;
+    if (!error) {
+        argv.push_back(0);
+        envp.push_back(0);
+        module = moduleDir + '/' + baseName(argv[0]) + ".so";
+        if (access(module.c_str(), R_OK) != 0) {
+            // Not compatible, lemuri-session spawns it itself
+            error = ENOEXEC;
+        }
+    }
+
+    pid_t pid = 0;
+    if (!error) {
+        // Like fork(), but the child belongs to our parent
+        pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, 0, 0, 0);
+        if (pid == 0) {
+            runChild(socket, module, argv.data(), envp.data(), fds);
+        } else if (pid < 0) {
+            error = errno;
+            pid = 0;
+        }
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        if (received[i] >= 0) {
+            close(received[i]);
+        }
+    }
+    reply(socket, error, pid);
+}
+
+int main(int argc, char *argv[])
+{
+    int socket = LAUNCHER_SOCKET_FD;
+    std::string moduleDir;
+    std::vector<const char *> libraries;
+    bool defaults = true;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--module-dir") == 0 && i + 1 < argc) {
+            moduleDir = argv[++i];
+        } else if (strcmp(argv[i], "--preload") == 0 && i + 1 < argc) {
+            libraries.push_back(argv[++i]);
+        } else if (strcmp(argv[i], "--no-default-preload") == 0) {
+            defaults = false;
+        } else {
+            fprintf(stderr, "Usage: %s --module-dir <dir> [--preload <library>]... [--no-default-preload]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (moduleDir.empty()) {
+        fprintf(stderr, "lemuri-session-launcher: no module directory\n");
+        return 1;
+    }
+
+    // Only lemuri-session has a use for us
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (fcntl(socket, F_SETFD, FD_CLOEXEC) < 0) {
+        fprintf(stderr, "lemuri-session-launcher: no launcher socket\n");
+        return 1;
+    }
+
+    if (defaults) {
+        for (const char **library = defaultPreload; *library; ++library) {
+            libraries.push_back(*library);
+        }
+    }
+    preload(libraries);
+
+    union {
+        struct cmsghdr header;
+        char data[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+
+    for (;;) {
+        struct iovec iov;
+        iov.iov_base = requestBuffer;
+        iov.iov_len = sizeof(requestBuffer);
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = &control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t size = recvmsg(socket, &msg, MSG_CMSG_CLOEXEC);
+        if (size == 0) {
+            // lemuri-session closed its end
+            return 0;
+        } else if (size < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "lemuri-session-launcher: failed to read request: %s\n", strerror(errno));
+            return 1;
+        }
+
+        int received[3] = { -1, -1, -1 };
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                const int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                memcpy(received, CMSG_DATA(cmsg), std::min(count, 3) * sizeof(int));
+            }
+        }
+
+        handleRequest(socket, moduleDir, size, msg.msg_flags, received);
+    }
+}
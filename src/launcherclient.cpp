@@ -0,0 +1,336 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "launcherclient.h"
+
+#include "launcherprotocol.h"
+#include "childsupervisor.h"
+#include "timerqueue.h"
+
+#include <QCoreApplication>
+#include <QSocketNotifier>
+#include <QFileInfo>
+#include <QFile>
+#include <QDebug>
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+extern char **environ;
+
+// A helper that takes longer than this to reply is considered hung
+#define LAUNCHER_REPLY_TIMEOUT 1000
+
+LauncherClient *LauncherClient::global()
+{
+    static LauncherClient *instance = new LauncherClient(qApp);
+    return instance;
+}
+
+LauncherClient::LauncherClient(QObject *parent) :
+    QObject(parent)
+{
+}
+
+LauncherClient::~LauncherClient()
+{
+    // Closing our end makes it exit
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool LauncherClient::start(const QString &program, const QString &moduleDir)
+{
+    if (isRunning()) {
+        return true;
+    }
+
+    if (!QFileInfo(program).isExecutable()) {
+        qDebug() << "No launcher helper at" << program;
+        return false;
+    }
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+        qWarning() << "Unable to create the launcher socket" << strerror(errno);
+        return false;
+    }
+
+    // dup2() onto itself would keep FD_CLOEXEC
+    if (fds[1] == LAUNCHER_SOCKET_FD) {
+        int fd = fcntl(fds[1], F_DUPFD_CLOEXEC, LAUNCHER_SOCKET_FD + 1);
+        close(fds[1]);
+        fds[1] = fd;
+    }
+
+    const QByteArray path = QFile::encodeName(program);
+    const QByteArray modules = QFile::encodeName(moduleDir);
+    char *const argv[] = {
+        const_cast<char *>(path.constData()),
+        const_cast<char *>("--module-dir"),
+        const_cast<char *>(modules.constData()),
+        0
+    };
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], LAUNCHER_SOCKET_FD);
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t mask;
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    sigset_t defaults;
+    sigfillset(&defaults);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    int ret = posix_spawn(&m_pid, argv[0], &actions, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+    if (ret != 0) {
+        qWarning() << "Unable to start the launcher helper" << program << strerror(ret);
+        close(fds[0]);
+        m_pid = 0;
+        return false;
+    }
+
+    m_fd = fds[0];
+
+    // Replies and its exit both make it readable
+    m_notifier = new QSocketNotifier(m_fd, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated,
+            this, &LauncherClient::socketActivated);
+
+    qDebug() << "Launcher helper started" << m_pid << "modules from" << moduleDir;
+    return true;
+}
+
+bool LauncherClient::isRunning() const
+{
+    return m_fd >= 0;
+}
+
+int LauncherClient::spawn(char *const argv[], char *const envp[], int stdoutFd, int stderrFd,
+                          int cgroupFd, QObject *context, const std::function<void(int, pid_t)> &callback)
+{
+    if (m_fd < 0) {
+        return ENOEXEC;
+    }
+
+    LauncherRequest request;
+    request.version = LAUNCHER_PROTOCOL_VERSION;
+    request.argc = 0;
+    request.envc = 0;
+    request.fds = 0;
+
+    // The buffer is kept, most requests fit in the last allocation
+    m_request.resize(sizeof(LauncherRequest));
+    for (char *const *arg = argv; *arg; ++arg) {
+        m_request.append(*arg, strlen(*arg) + 1);
+        ++request.argc;
+    }
+    for (char *const *var = envp; *var; ++var) {
+        m_request.append(*var, strlen(*var) + 1);
+        ++request.envc;
+    }
+    if (m_request.size() > LAUNCHER_MAX_REQUEST) {
+        qDebug() << "Launcher request too large, spawning" << argv[0];
+        return E2BIG;
+    }
+
+    int fds[3];
+    int fdCount = 0;
+    if (stdoutFd >= 0) {
+        fds[fdCount++] = stdoutFd;
+        request.fds |= LauncherStdout;
+    }
+    if (stderrFd >= 0) {
+        fds[fdCount++] = stderrFd;
+        request.fds |= LauncherStderr;
+    }
+    if (cgroupFd >= 0) {
+        fds[fdCount++] = cgroupFd;
+        request.fds |= LauncherCGroup;
+    }
+    memcpy(m_request.data(), &request, sizeof(request));
+
+    union {
+        struct cmsghdr header;
+        char data[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+
+    struct iovec iov;
+    iov.iov_base = m_request.data();
+    iov.iov_len = m_request.size();
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fdCount) {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = &control;
+        msg.msg_controllen = CMSG_SPACE(fdCount * sizeof(int));
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(fdCount * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, fdCount * sizeof(int));
+    }
+
+    ssize_t size;
+    do {
+        size = sendmsg(m_fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    } while (size < 0 && errno == EINTR);
+    if (size < 0 && errno == EAGAIN) {
+        // Still busy with the earlier requests, not worth waiting for
+        qDebug() << "Launcher helper busy, spawning" << argv[0];
+        return EAGAIN;
+    }
+    if (size != ssize_t(m_request.size())) {
+        qWarning() << "Launcher helper gone, spawning units directly" << strerror(errno);
+        stop();
+        return ECONNRESET;
+    }
+
+    // The descriptors were duplicated into the message, the
+    // caller may close them but keeps them for a direct spawn
+    PendingSpawn pending;
+    pending.context = context;
+    pending.callback = callback;
+    m_pending.enqueue(pending);
+    if (m_pending.size() == 1) {
+        armReplyTimer();
+    }
+    return 0;
+}
+
+void LauncherClient::socketActivated()
+{
+    LauncherReply reply;
+    ssize_t size;
+    while ((size = recv(m_fd, &reply, sizeof(reply), MSG_DONTWAIT)) == ssize_t(sizeof(reply))) {
+        replied(reply.error, reply.pid);
+        if (m_fd < 0) {
+            // A callback found the helper gone
+            return;
+        }
+    }
+
+    if (size < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    }
+
+    qWarning() << "Launcher helper exited, spawning units directly";
+    stop();
+}
+
+void LauncherClient::replied(int error, pid_t pid)
+{
+    if (m_pending.isEmpty()) {
+        qWarning() << "Unexpected launcher reply" << pid;
+        return;
+    }
+
+    const PendingSpawn pending = m_pending.dequeue();
+    armReplyTimer();
+
+    if (!pending.context) {
+        if (error == 0) {
+            // Its unit went away meanwhile, still reap it
+            ::kill(pid, SIGTERM);
+            ChildSupervisor::global()->watch(pid, 0);
+        }
+        return;
+    }
+
+    if (error != 0 && error != ENOEXEC) {
+        qDebug() << "Launcher helper failed to fork" << strerror(error);
+    }
+    pending.callback(error, pid);
+}
+
+void LauncherClient::armReplyTimer()
+{
+    TimerQueue::global()->cancel(m_replyTimer);
+    m_replyTimer = 0;
+    if (m_pending.isEmpty()) {
+        return;
+    }
+
+    // The helper forks one request after the other
+    m_replyTimer = TimerQueue::global()->start(LAUNCHER_REPLY_TIMEOUT, this, [this]() {
+        m_replyTimer = 0;
+        replyTimedOut();
+    });
+}
+
+void LauncherClient::replyTimedOut()
+{
+    // The reply might only be waiting for the event loop
+    socketActivated();
+    if (m_fd < 0 || m_replyTimer || m_pending.isEmpty()) {
+        return;
+    }
+
+    qWarning() << "Launcher helper did not reply, spawning units directly";
+    stop();
+}
+
+void LauncherClient::stop()
+{
+    if (m_fd < 0) {
+        return;
+    }
+
+    // Might be called from its activated() signal
+    m_notifier->setEnabled(false);
+    m_notifier->deleteLater();
+    m_notifier = 0;
+    close(m_fd);
+    m_fd = -1;
+
+    // It isn't watched by the ChildSupervisor
+    ::kill(m_pid, SIGKILL);
+    waitpid(m_pid, 0, 0);
+    m_pid = 0;
+
+    TimerQueue::global()->cancel(m_replyTimer);
+    m_replyTimer = 0;
+
+    // Whatever was not answered gets spawned by its caller
+    QQueue<PendingSpawn> pending;
+    pending.swap(m_pending);
+    while (!pending.isEmpty()) {
+        const PendingSpawn spawn = pending.dequeue();
+        if (spawn.context) {
+            spawn.callback(ECONNRESET, 0);
+        }
+    }
+}
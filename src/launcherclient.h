@@ -0,0 +1,92 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef LAUNCHERCLIENT_H
+#define LAUNCHERCLIENT_H
+
+#include <QObject>
+#include <QPointer>
+#include <QQueue>
+
+#include <functional>
+
+#include <sys/types.h>
+
+class QSocketNotifier;
+
+/**
+ * @brief The LauncherClient class
+ * Talks to lemuri-session-launcher, the helper that forks
+ * units with Launcher=true out of a process that has the
+ * toolkit libraries loaded already. Spawning through it is
+ * a single request/reply round trip, the reply is read when
+ * the socket gets readable so the event loop never waits for
+ * it. Whenever the helper is missing, gone, late or has no
+ * module for the program the caller spawns the unit itself.
+ */
+class LauncherClient : public QObject
+{
+    Q_OBJECT
+public:
+    static LauncherClient *global();
+    virtual ~LauncherClient();
+
+    /**
+     * Starts \p program, modules are loaded from \p moduleDir
+     */
+    bool start(const QString &program, const QString &moduleDir);
+    bool isRunning() const;
+
+    /**
+     * Asks the helper to fork \p argv with \p envp, the child is
+     * ours like a posix_spawn() one. Returns 0 once the request
+     * is sent, \p callback then gets 0 and the pid or an errno,
+     * ENOEXEC when the helper can't start it and ECONNRESET when
+     * it's gone or did not reply in time. Otherwise the errno is
+     * returned and \p callback is never called, neither is it
+     * when \p context is deleted meanwhile.
+     */
+    int spawn(char *const argv[], char *const envp[], int stdoutFd, int stderrFd,
+              int cgroupFd, QObject *context, const std::function<void(int, pid_t)> &callback);
+
+private Q_SLOTS:
+    void socketActivated();
+
+private:
+    explicit LauncherClient(QObject *parent = 0);
+    void replied(int error, pid_t pid);
+    void armReplyTimer();
+    void replyTimedOut();
+    void stop();
+
+    struct PendingSpawn {
+        QPointer<QObject> context;
+        std::function<void(int, pid_t)> callback;
+    };
+
+    int m_fd = -1;
+    pid_t m_pid = 0;
+    QSocketNotifier *m_notifier = 0;
+    QByteArray m_request;
+    // Replies come in request order
+    QQueue<PendingSpawn> m_pending;
+    quint64 m_replyTimer = 0;
+};
+
+#endif // LAUNCHERCLIENT_H
@@ -0,0 +1,68 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef LAUNCHERPROTOCOL_H
+#define LAUNCHERPROTOCOL_H
+
+#include <stdint.h>
+
+/**
+ * What lemuri-session and lemuri-session-launcher exchange over
+ * their SOCK_SEQPACKET socket, one request and one reply per spawn.
+ *
+ * A request is a LauncherRequest followed by argc and then envc
+ * NUL terminated strings, the descriptors flagged in fds are
+ * passed with SCM_RIGHTS in the LauncherFd order.
+ */
+#define LAUNCHER_PROTOCOL_VERSION 1
+
+// The launcher socket is passed to the helper as this descriptor
+#define LAUNCHER_SOCKET_FD 3
+
+// Requests (mostly the environment) must fit in one datagram
+#define LAUNCHER_MAX_REQUEST (128 * 1024)
+
+// Exported by launcher modules, called like main()
+#define LAUNCHER_ENTRY_POINT "lemuri_launcher_main"
+
+enum LauncherFd {
+    LauncherStdout = 0x1,
+    LauncherStderr = 0x2,
+    LauncherCGroup = 0x4
+};
+
+struct LauncherRequest {
+    uint32_t version;
+    uint32_t argc;
+    uint32_t envc;
+    uint32_t fds;
+};
+
+/**
+ * error is 0 and pid the child, or an errno, ENOEXEC
+ * when there is no module for the program
+ */
+struct LauncherReply {
+    int32_t error;
+    int32_t pid;
+};
+
+typedef int (*LauncherEntryPoint)(int argc, char *argv[]);
+
+#endif // LAUNCHERPROTOCOL_H
@@ -26,6 +26,8 @@
 
 #include "sessionmanager.h"
 
+#include <limits.h>
+
 using namespace std;
 
 int main(int argc, char *argv[])
@@ -46,6 +48,50 @@ int main(int argc, char *argv[])
             QCoreApplication::translate("main", "session"));
     parser.addOption(targetSessionOption);
 
+    QCommandLineOption busAddressOption(QStringList() << "bus-address",
+            QCoreApplication::translate("main", "Use the already running session bus at <address>."),
+            QCoreApplication::translate("main", "address"));
+    parser.addOption(busAddressOption);
+
+    QCommandLineOption busListenFdOption(QStringList() << "bus-listen-fd",
+            QCoreApplication::translate("main", "Start a private dbus-daemon on the listening socket <fd>."),
+            QCoreApplication::translate("main", "fd"));
+    parser.addOption(busListenFdOption);
+
+    QCommandLineOption traceFileOption(QStringList() << "trace-file",
+            QCoreApplication::translate("main", "Write a Chrome trace of the session startup to <file>."),
+            QCoreApplication::translate("main", "file"));
+    parser.addOption(traceFileOption);
+
+    QCommandLineOption unitsDirOption(QStringList() << "units-dir",
+            QCoreApplication::translate("main", "Load units from <directory> instead of the session and XDG autostart directories, can be repeated."),
+            QCoreApplication::translate("main", "directory"));
+    parser.addOption(unitsDirOption);
+
+    QCommandLineOption logFileOption(QStringList() << "log-file",
+            QCoreApplication::translate("main", "Append the output of the units to <file> instead of stderr."),
+            QCoreApplication::translate("main", "file"));
+    parser.addOption(logFileOption);
+
+    QCommandLineOption noLauncherOption(QStringList() << "no-launcher",
+            QCoreApplication::translate("main", "Don't start the launcher helper, every unit is spawned directly."));
+    parser.addOption(noLauncherOption);
+
+    QCommandLineOption launcherModulesOption(QStringList() << "launcher-modules",
+            QCoreApplication::translate("main", "Load launcher modules from <directory>."),
+            QCoreApplication::translate("main", "directory"));
+    parser.addOption(launcherModulesOption);
+
+    QCommandLineOption maxStartingOption(QStringList() << "max-starting",
+            QCoreApplication::translate("main", "Start at most <count> units of a phase at once, 0 starts them all together."),
+            QCoreApplication::translate("main", "count"));
+    parser.addOption(maxStartingOption);
+
+    QCommandLineOption idleWindowOption(QStringList() << "idle-window",
+            QCoreApplication::translate("main", "Start units with StartClass=idle after <secs> without load or input."),
+            QCoreApplication::translate("main", "secs"));
+    parser.addOption(idleWindowOption);
+
     SessionManager app(argc, argv);
 
     // Process the actual command line arguments given by the user
@@ -57,6 +103,54 @@ int main(int argc, char *argv[])
         parser.showHelp(1);
     }
 
+    if (parser.isSet(busAddressOption)) {
+        app.setBusAddress(parser.value(busAddressOption));
+    }
+
+    if (parser.isSet(busListenFdOption)) {
+        bool ok;
+        const int fd = parser.value(busListenFdOption).toInt(&ok);
+        if (!ok || fd < 0) {
+            parser.showHelp(1);
+        }
+        app.setBusListenFd(fd);
+    }
+
+    if (parser.isSet(unitsDirOption)) {
+        app.setUnitDirectories(parser.values(unitsDirOption));
+    }
+
+    if (parser.isSet(traceFileOption)) {
+        app.setTraceFile(parser.value(traceFileOption));
+    }
+
+    if (parser.isSet(logFileOption)) {
+        app.setLogFile(parser.value(logFileOption));
+    }
+
+    if (parser.isSet(maxStartingOption)) {
+        bool ok;
+        const int limit = parser.value(maxStartingOption).toInt(&ok);
+        if (!ok || limit < 0) {
+            parser.showHelp(1);
+        }
+        app.setSpawnLimit(limit);
+    }
+
+    if (parser.isSet(idleWindowOption)) {
+        bool ok;
+        const double window = parser.value(idleWindowOption).toDouble(&ok);
+        if (!ok || !(window >= 0 && window <= INT_MAX / 1000)) {
+            parser.showHelp(1);
+        }
+        app.setIdleWindow(int(window * 1000));
+    }
+
+    app.setLauncherEnabled(!parser.isSet(noLauncherOption));
+    if (parser.isSet(launcherModulesOption)) {
+        app.setLauncherModuleDirectory(parser.value(launcherModulesOption));
+    }
+
     app.init();
 
     return app.exec();
@@ -0,0 +1,149 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "notifysocket.h"
+
+#include <QSocketNotifier>
+#include <QCoreApplication>
+#include <QStringBuilder>
+#include <QFile>
+#include <QDir>
+#include <QDebug>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+NotifySocket::NotifySocket(QObject *parent) :
+    QObject(parent)
+{
+    QString runtimeDir = QFile::decodeName(qgetenv("XDG_RUNTIME_DIR"));
+    if (runtimeDir.isEmpty()) {
+        runtimeDir = QDir::tempPath();
+    }
+    m_path = runtimeDir % QLatin1String("/lemuri-session-notify.")
+            % QString::number(QCoreApplication::applicationPid());
+
+    QByteArray path = QFile::encodeName(m_path);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= int(sizeof(addr.sun_path))) {
+        qWarning() << "Notify socket path too long" << m_path;
+        return;
+    }
+    memcpy(addr.sun_path, path.constData(), path.size());
+
+    m_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (m_fd < 0) {
+        qWarning() << "Unable to create notify socket" << strerror(errno);
+        return;
+    }
+
+    unlink(path.constData());
+    if (bind(m_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0) {
+        qWarning() << "Unable to bind notify socket" << m_path << strerror(errno);
+        close(m_fd);
+        m_fd = -1;
+        return;
+    }
+
+    int one = 1;
+    setsockopt(m_fd, SOL_SOCKET, SO_PASSCRED, &one, sizeof(one));
+
+    m_notifier = new QSocketNotifier(m_fd, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated,
+            this, &NotifySocket::readDatagrams);
+}
+
+NotifySocket::~NotifySocket()
+{
+    if (m_fd >= 0) {
+        close(m_fd);
+        unlink(QFile::encodeName(m_path).constData());
+    }
+}
+
+bool NotifySocket::isValid() const
+{
+    return m_fd >= 0;
+}
+
+QString NotifySocket::path() const
+{
+    return m_path;
+}
+
+void NotifySocket::readDatagrams()
+{
+    char buffer[4096];
+    union {
+        struct cmsghdr header;
+        char data[CMSG_SPACE(sizeof(struct ucred))];
+    } control;
+
+    Q_FOREVER {
+        struct iovec iov;
+        iov.iov_base = buffer;
+        iov.iov_len = sizeof(buffer) - 1;
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = &control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t size = recvmsg(m_fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+        if (size < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                qWarning() << "Failed to read notify socket" << strerror(errno);
+            }
+            return;
+        }
+
+        struct ucred *credentials = 0;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_CREDENTIALS &&
+                    cmsg->cmsg_len == CMSG_LEN(sizeof(struct ucred))) {
+                credentials = reinterpret_cast<struct ucred *>(CMSG_DATA(cmsg));
+            }
+        }
+
+        if (!credentials || credentials->pid <= 0) {
+            qWarning() << "Ignoring notification without credentials";
+            continue;
+        }
+
+        QHash<QByteArray, QByteArray> fields;
+        const QList<QByteArray> lines = QByteArray::fromRawData(buffer, size).split('\n');
+        foreach (const QByteArray &line, lines) {
+            int equalIndex = line.indexOf('=');
+            if (equalIndex > 0) {
+                fields.insert(line.left(equalIndex), line.mid(equalIndex + 1));
+            }
+        }
+
+        if (!fields.isEmpty()) {
+            emit notification(credentials->pid, fields);
+        }
+    }
+}
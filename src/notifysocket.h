@@ -0,0 +1,57 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef NOTIFYSOCKET_H
+#define NOTIFYSOCKET_H
+
+#include <QObject>
+#include <QHash>
+
+class QSocketNotifier;
+
+/**
+ * @brief The NotifySocket class
+ * A datagram socket speaking the sd_notify() protocol,
+ * its path is exported as NOTIFY_SOCKET so units can
+ * send READY=1 and STATUS=... messages, the sender is
+ * identified by the kernel provided credentials.
+ */
+class NotifySocket : public QObject
+{
+    Q_OBJECT
+public:
+    explicit NotifySocket(QObject *parent = 0);
+    virtual ~NotifySocket();
+
+    bool isValid() const;
+    QString path() const;
+
+Q_SIGNALS:
+    void notification(qint64 pid, const QHash<QByteArray, QByteArray> &fields);
+
+private Q_SLOTS:
+    void readDatagrams();
+
+private:
+    QString m_path;
+    int m_fd = -1;
+    QSocketNotifier *m_notifier = 0;
+};
+
+#endif // NOTIFYSOCKET_H
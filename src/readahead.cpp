@@ -0,0 +1,182 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "readahead.h"
+
+#include <QAtomicInt>
+#include <QSaveFile>
+#include <QStringBuilder>
+#include <QFileInfo>
+#include <QFile>
+#include <QDir>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QDebug>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Parallel requests, enough to fill the disk queue
+#define READAHEAD_THREADS 4
+// Files kept in the list
+#define READAHEAD_MAX_FILES 4096
+
+struct Readahead::Job
+{
+    QVector<QByteArray> files;
+    QAtomicInt next;
+    QAtomicInt cancelled;
+};
+
+Readahead::Readahead(const QString &sessionName, QObject *parent) :
+    QObject(parent)
+{
+    QString stateHome = QFile::decodeName(qgetenv("XDG_STATE_HOME"));
+    if (stateHome.isEmpty()) {
+        stateHome = QDir::homePath() % QLatin1String("/.local/state");
+    }
+    m_fileName = stateHome % QLatin1String("/lemuri-session/") % sessionName % QLatin1String(".readahead");
+
+    m_pool.setMaxThreadCount(READAHEAD_THREADS);
+}
+
+Readahead::~Readahead()
+{
+    // Pages not read yet aren't worth delaying the exit
+    if (m_job) {
+        m_job->cancelled.store(1);
+    }
+    m_pool.waitForDone();
+}
+
+void Readahead::prefetch()
+{
+    QFile file(m_fileName);
+    if (!file.open(QFile::ReadOnly)) {
+        return;
+    }
+
+    m_job = QSharedPointer<Job>::create();
+    Q_FOREVER {
+        QByteArray line = file.readLine();
+        if (line.isEmpty()) {
+            break;
+        }
+        line.chop(1);
+        if (line.startsWith('/')) {
+            m_job->files.append(line);
+        }
+    }
+
+    qDebug() << "Prefetching" << m_job->files.size() << "files of the previous login";
+    const int threads = qMin(READAHEAD_THREADS, m_job->files.size());
+    for (int i = 0; i < threads; ++i) {
+        QtConcurrent::run(&m_pool, &Readahead::prefetchFiles, m_job);
+    }
+}
+
+void Readahead::prefetchFiles(QSharedPointer<Job> job)
+{
+    // Each thread takes the next file, so the list
+    // is requested in the order it was needed
+    Q_FOREVER {
+        const int index = job->next.fetchAndAddRelaxed(1);
+        if (index >= job->files.size() || job->cancelled.load()) {
+            return;
+        }
+
+        int fd = open(job->files.at(index).constData(), O_RDONLY | O_CLOEXEC | O_NOATIME);
+        if (fd < 0) {
+            // O_NOATIME needs us to own the file
+            fd = open(job->files.at(index).constData(), O_RDONLY | O_CLOEXEC);
+        }
+        if (fd < 0) {
+            continue;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            // Blocks until the request is queued, not read
+            if (readahead(fd, 0, st.st_size) != 0) {
+                posix_fadvise(fd, 0, st.st_size, POSIX_FADV_WILLNEED);
+            }
+        }
+        close(fd);
+    }
+}
+
+void Readahead::recordProcess(qint64 pid)
+{
+    if (m_saved || pid <= 0 || m_files.size() >= READAHEAD_MAX_FILES) {
+        return;
+    }
+
+    QFile maps(QLatin1String("/proc/") % QString::number(pid) % QLatin1String("/maps"));
+    if (!maps.open(QFile::ReadOnly)) {
+        return;
+    }
+
+    // address perms offset dev inode path
+    const QList<QByteArray> lines = maps.readAll().split('\n');
+    foreach (const QByteArray &line, lines) {
+        const int path = line.indexOf(" /");
+        if (path == -1 || line.endsWith(" (deleted)")) {
+            continue;
+        }
+
+        const QByteArray fileName = line.mid(path + 1);
+        if (fileName.startsWith("/dev/") || fileName.startsWith("/memfd:") || m_seen.contains(fileName)) {
+            continue;
+        }
+
+        m_seen.insert(fileName);
+        m_files.append(fileName);
+        if (m_files.size() >= READAHEAD_MAX_FILES) {
+            break;
+        }
+    }
+}
+
+void Readahead::save()
+{
+    if (m_saved) {
+        return;
+    }
+    m_saved = true;
+
+    if (m_files.isEmpty()) {
+        return;
+    }
+
+    QDir().mkpath(QFileInfo(m_fileName).absolutePath());
+    QSaveFile file(m_fileName);
+    if (!file.open(QFile::WriteOnly)) {
+        qWarning() << "Unable to write the readahead list" << m_fileName << file.errorString();
+        return;
+    }
+
+    foreach (const QByteArray &fileName, m_files) {
+        file.write(fileName);
+        file.write("\n", 1);
+    }
+    file.commit();
+
+    m_files.clear();
+    m_seen.clear();
+}
@@ -0,0 +1,75 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <QObject>
+#include <QVector>
+#include <QSet>
+#include <QSharedPointer>
+#include <QThreadPool>
+
+/**
+ * @brief The Readahead class
+ * Records the files the units mapped by the time they were
+ * ready, in the order they were first needed, and on the next
+ * login asks the kernel to read them in before the units are
+ * spawned. A few pool threads walk the list in order so slow
+ * disks see parallel requests.
+ *
+ * Kept in $XDG_STATE_HOME/lemuri-session/<session>.readahead.
+ */
+class Readahead : public QObject
+{
+    Q_OBJECT
+public:
+    explicit Readahead(const QString &sessionName, QObject *parent = 0);
+    virtual ~Readahead();
+
+    /**
+     * Prefetches what the previous login recorded,
+     * returns right away
+     */
+    void prefetch();
+
+    /**
+     * Adds the files mapped by \p pid to this login list
+     */
+    void recordProcess(qint64 pid);
+
+    /**
+     * Writes this login list, nothing is recorded after
+     */
+    void save();
+
+private:
+    struct Job;
+
+    static void prefetchFiles(QSharedPointer<Job> job);
+
+    QString m_fileName;
+    QVector<QByteArray> m_files;
+    QSet<QByteArray> m_seen;
+    QThreadPool m_pool;
+    QSharedPointer<Job> m_job;
+    bool m_saved = false;
+};
+
+#endif // READAHEAD_H
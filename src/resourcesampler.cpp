@@ -0,0 +1,278 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "resourcesampler.h"
+
+#include "unitlauncher.h"
+#include "timerqueue.h"
+
+#include <QCoreApplication>
+#include <QDBusMetaType>
+#include <QFile>
+#include <QStringBuilder>
+#include <QDebug>
+
+#include <unistd.h>
+
+#define SAMPLE_FAST 1000
+#define SAMPLE_ACTIVE 5000
+#define SAMPLE_IDLE_MAX 30000
+// Units younger than this are sampled every SAMPLE_FAST
+#define SAMPLE_STARTUP_PERIOD 30000
+
+namespace {
+
+QByteArray readProcFile(const QString &fileName)
+{
+    // /proc and cgroupfs files report a size of 0
+    QFile file(fileName);
+    if (!file.open(QFile::ReadOnly | QFile::Unbuffered)) {
+        return QByteArray();
+    }
+    return file.readAll();
+}
+
+qulonglong keyValue(const QByteArray &data, const char *key)
+{
+    const int keySize = qstrlen(key);
+    foreach (const QByteArray &line, data.split('\n')) {
+        if (line.startsWith(key) && line.size() > keySize &&
+                (line.at(keySize) == ' ' || line.at(keySize) == ':')) {
+            return line.mid(keySize + 1).trimmed().split(' ').first().toULongLong();
+        }
+    }
+    return 0;
+}
+
+}
+
+QVariantMap ResourceUsage::toVariantMap() const
+{
+    QVariantMap ret;
+    ret.insert(QStringLiteral("CpuTime"), cpuTime);
+    ret.insert(QStringLiteral("MemoryRSS"), rss);
+    ret.insert(QStringLiteral("MemoryPSS"), pss);
+    ret.insert(QStringLiteral("IORead"), ioRead);
+    ret.insert(QStringLiteral("IOWrite"), ioWrite);
+    ret.insert(QStringLiteral("Processes"), processes);
+    ret.insert(QStringLiteral("Threads"), threads);
+    ret.insert(QStringLiteral("SampledAt"), sampledAt);
+    return ret;
+}
+
+ResourceSampler *ResourceSampler::global()
+{
+    static ResourceSampler *instance = new ResourceSampler(qApp);
+    return instance;
+}
+
+ResourceSampler::ResourceSampler(QObject *parent) :
+    QObject(parent)
+{
+    qDBusRegisterMetaType<UnitResourceMap>();
+
+    m_timer.setSingleShot(true);
+    connect(&m_timer, &QTimer::timeout,
+            this, &ResourceSampler::sampleDue);
+}
+
+void ResourceSampler::addUnit(UnitLauncher *launcher)
+{
+    if (m_units.contains(launcher)) {
+        return;
+    }
+
+    m_units.insert(launcher, Watched());
+    connect(launcher, &UnitLauncher::started,
+            this, &ResourceSampler::unitStarted);
+}
+
+void ResourceSampler::removeUnit(UnitLauncher *launcher)
+{
+    if (m_units.remove(launcher)) {
+        disconnect(launcher, 0, this, 0);
+    }
+}
+
+UnitResourceMap ResourceSampler::snapshot() const
+{
+    UnitResourceMap ret;
+    QHash<UnitLauncher *, Watched>::ConstIterator it = m_units.constBegin();
+    while (it != m_units.constEnd()) {
+        ResourceUsage usage = it.key()->resourceUsage();
+        QVariantMap map = usage.toVariantMap();
+        map.insert(QStringLiteral("Uptime"), it.key()->uptime());
+        ret.insert(it.key()->name(), map);
+        ++it;
+    }
+    return ret;
+}
+
+void ResourceSampler::unitStarted()
+{
+    UnitLauncher *launcher = qobject_cast<UnitLauncher *>(sender());
+    QHash<UnitLauncher *, Watched>::Iterator it = m_units.find(launcher);
+    if (it == m_units.end()) {
+        return;
+    }
+
+    it.value().interval = SAMPLE_FAST;
+    it.value().next = TimerQueue::now() + SAMPLE_FAST;
+    rearm();
+}
+
+void ResourceSampler::sampleDue()
+{
+    const qint64 now = TimerQueue::now();
+    QHash<UnitLauncher *, Watched>::Iterator it = m_units.begin();
+    while (it != m_units.end()) {
+        Watched &watched = it.value();
+        UnitLauncher *launcher = it.key();
+        if (!watched.next || watched.next > now) {
+            ++it;
+            continue;
+        }
+
+        const ResourceUsage previous = launcher->resourceUsage();
+        ResourceUsage usage = sample(launcher);
+        usage.sampledAt = now;
+        launcher->setResourceUsage(usage);
+
+        if (!usage.processes) {
+            // Nothing left to account until it starts again
+            watched.next = 0;
+        } else {
+            if (launcher->uptime() < SAMPLE_STARTUP_PERIOD) {
+                watched.interval = SAMPLE_FAST;
+            } else if (usage.cpuTime != previous.cpuTime) {
+                watched.interval = SAMPLE_ACTIVE;
+            } else {
+                watched.interval = qMin(watched.interval * 2, SAMPLE_IDLE_MAX);
+            }
+            watched.next = now + watched.interval;
+        }
+        ++it;
+    }
+    rearm();
+}
+
+void ResourceSampler::rearm()
+{
+    qint64 next = 0;
+    foreach (const Watched &watched, m_units) {
+        if (watched.next && (!next || watched.next < next)) {
+            next = watched.next;
+        }
+    }
+
+    if (!next) {
+        m_timer.stop();
+        return;
+    }
+    m_timer.start(int(qMax(Q_INT64_C(0), next - TimerQueue::now())));
+}
+
+ResourceUsage ResourceSampler::sample(UnitLauncher *launcher)
+{
+    ResourceUsage usage;
+    const QString cgroup = launcher->cgroup();
+
+    QVector<pid_t> pids;
+    bool fromCGroup = false;
+    if (!cgroup.isEmpty()) {
+        const QByteArray procs = readProcFile(cgroup % QLatin1String("/cgroup.procs"));
+        foreach (const QByteArray &line, procs.split('\n')) {
+            if (line.toInt() > 0) {
+                pids.append(line.toInt());
+            }
+        }
+
+        const QByteArray cpuStat = readProcFile(cgroup % QLatin1String("/cpu.stat"));
+        if (!cpuStat.isEmpty()) {
+            // Includes the children that already exited
+            usage.cpuTime = keyValue(cpuStat, "usage_usec");
+            fromCGroup = true;
+
+            // 8:0 rbytes=1 wbytes=2 rios=3 ...
+            const QByteArray ioStat = readProcFile(cgroup % QLatin1String("/io.stat"));
+            foreach (const QByteArray &line, ioStat.split('\n')) {
+                foreach (const QByteArray &field, line.split(' ')) {
+                    if (field.startsWith("rbytes=")) {
+                        usage.ioRead += field.mid(7).toULongLong();
+                    } else if (field.startsWith("wbytes=")) {
+                        usage.ioWrite += field.mid(7).toULongLong();
+                    }
+                }
+            }
+        }
+    } else if (launcher->pid() > 0) {
+        pids = processTree(launcher->pid());
+    }
+
+    foreach (pid_t pid, pids) {
+        addProcess(pid, !fromCGroup, &usage);
+    }
+    return usage;
+}
+
+QVector<pid_t> ResourceSampler::processTree(pid_t pid)
+{
+    // Needs CONFIG_PROC_CHILDREN, otherwise only the main process
+    QVector<pid_t> ret;
+    ret.append(pid);
+    for (int i = 0; i < ret.size(); ++i) {
+        const QByteArray children = readProcFile(QLatin1String("/proc/") % QString::number(ret.at(i))
+                                                  % QLatin1String("/task/") % QString::number(ret.at(i))
+                                                  % QLatin1String("/children"));
+        foreach (const QByteArray &child, children.split(' ')) {
+            if (child.trimmed().toInt() > 0) {
+                ret.append(child.trimmed().toInt());
+            }
+        }
+    }
+    return ret;
+}
+
+void ResourceSampler::addProcess(pid_t pid, bool withCpuAndIo, ResourceUsage *usage)
+{
+    const QString proc = QLatin1String("/proc/") % QString::number(pid);
+
+    // Fields after the comm, which may contain spaces
+    const QByteArray stat = readProcFile(proc % QLatin1String("/stat"));
+    const QList<QByteArray> fields = stat.mid(stat.lastIndexOf(')') + 2).split(' ');
+    if (fields.size() < 18) {
+        return;
+    }
+    ++usage->processes;
+    usage->threads += fields.at(17).toUInt();
+
+    if (withCpuAndIo) {
+        static const qulonglong ticks = sysconf(_SC_CLK_TCK);
+        usage->cpuTime += (fields.at(11).toULongLong() + fields.at(12).toULongLong()) * 1000000 / ticks;
+
+        const QByteArray io = readProcFile(proc % QLatin1String("/io"));
+        usage->ioRead += keyValue(io, "read_bytes");
+        usage->ioWrite += keyValue(io, "write_bytes");
+    }
+
+    // One read gives both, in kB
+    const QByteArray rollup = readProcFile(proc % QLatin1String("/smaps_rollup"));
+    usage->rss += keyValue(rollup, "Rss") * 1024;
+    usage->pss += keyValue(rollup, "Pss") * 1024;
+}
@@ -0,0 +1,99 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef RESOURCESAMPLER_H
+#define RESOURCESAMPLER_H
+
+#include <QObject>
+#include <QHash>
+#include <QMap>
+#include <QVariantMap>
+#include <QTimer>
+
+#include <sys/types.h>
+
+class UnitLauncher;
+
+/**
+ * Resources used by a unit and everything it forked
+ */
+struct ResourceUsage
+{
+    qulonglong cpuTime = 0;    // usecs
+    qulonglong rss = 0;        // bytes
+    qulonglong pss = 0;        // bytes
+    qulonglong ioRead = 0;     // bytes
+    qulonglong ioWrite = 0;    // bytes
+    uint processes = 0;
+    uint threads = 0;
+    qint64 sampledAt = 0;      // monotonic msecs, 0 if never sampled
+
+    QVariantMap toVariantMap() const;
+};
+
+typedef QMap<QString, QVariantMap> UnitResourceMap;
+Q_DECLARE_METATYPE(UnitResourceMap)
+
+/**
+ * @brief The ResourceSampler class
+ * Samples every running unit from a single timer, all units
+ * that are due are read in one batch. A unit is sampled every
+ * second right after it started, then less often the longer
+ * it stays idle, up to every 30 seconds.
+ *
+ * Units in a cgroup are read from cpu.stat, io.stat and
+ * cgroup.procs so exited children are accounted, others
+ * by walking their process tree in /proc.
+ */
+class ResourceSampler : public QObject
+{
+    Q_OBJECT
+public:
+    static ResourceSampler *global();
+
+    void addUnit(UnitLauncher *launcher);
+    void removeUnit(UnitLauncher *launcher);
+
+    /**
+     * Latest sample of every unit, keyed by unit name
+     */
+    UnitResourceMap snapshot() const;
+
+private Q_SLOTS:
+    void unitStarted();
+    void sampleDue();
+
+private:
+    explicit ResourceSampler(QObject *parent = 0);
+
+    struct Watched {
+        qint64 next = 0;   // 0 while not running
+        int interval = 0;
+    };
+
+    void rearm();
+    static ResourceUsage sample(UnitLauncher *launcher);
+    static QVector<pid_t> processTree(pid_t pid);
+    static void addProcess(pid_t pid, bool withCpuAndIo, ResourceUsage *usage);
+
+    QHash<UnitLauncher *, Watched> m_units;
+    QTimer m_timer;
+};
+
+#endif // RESOURCESAMPLER_H
@@ -0,0 +1,100 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "restartscheduler.h"
+
+#include "unitlauncher.h"
+#include "timerqueue.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+
+#define MAX_CONCURRENT_RESTARTS 4
+
+// A restarted unit not ready by then gives its slot back
+#define SLOT_TIMEOUT 3000
+
+RestartScheduler *RestartScheduler::global()
+{
+    static RestartScheduler *instance = new RestartScheduler(qApp);
+    return instance;
+}
+
+RestartScheduler::RestartScheduler(QObject *parent) :
+    QObject(parent)
+{
+}
+
+qint64 RestartScheduler::schedule(UnitLauncher *launcher, qint64 msecs)
+{
+    cancel(launcher);
+
+    TimerQueue *queue = TimerQueue::global();
+    quint64 id = queue->start(msecs, launcher, [this, launcher]() {
+        m_timers.remove(launcher);
+        due(launcher);
+    });
+    m_timers.insert(launcher, id);
+    return queue->deadline(id);
+}
+
+void RestartScheduler::cancel(UnitLauncher *launcher)
+{
+    QHash<UnitLauncher *, quint64>::Iterator it = m_timers.find(launcher);
+    if (it != m_timers.end()) {
+        TimerQueue::global()->cancel(it.value());
+        m_timers.erase(it);
+    }
+    m_waiting.removeAll(launcher);
+    release(launcher);
+}
+
+void RestartScheduler::release(UnitLauncher *launcher)
+{
+    QHash<UnitLauncher *, quint64>::Iterator it = m_inFlight.find(launcher);
+    if (it == m_inFlight.end()) {
+        return;
+    }
+    TimerQueue::global()->cancel(it.value());
+    m_inFlight.erase(it);
+
+    while (!m_waiting.isEmpty() && m_inFlight.size() < MAX_CONCURRENT_RESTARTS) {
+        restart(m_waiting.takeFirst());
+    }
+}
+
+void RestartScheduler::due(UnitLauncher *launcher)
+{
+    if (m_inFlight.size() >= MAX_CONCURRENT_RESTARTS) {
+        qDebug() << "Too many units restarting, delaying" << launcher->name();
+        m_waiting.append(launcher);
+        return;
+    }
+    restart(launcher);
+}
+
+void RestartScheduler::restart(UnitLauncher *launcher)
+{
+    quint64 id = TimerQueue::global()->start(SLOT_TIMEOUT, launcher, [this, launcher]() {
+        qDebug() << "Restarted unit slow to get ready, releasing its slot" << launcher->name();
+        release(launcher);
+    });
+    m_inFlight.insert(launcher, id);
+    launcher->restart();
+}
@@ -0,0 +1,68 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef RESTARTSCHEDULER_H
+#define RESTARTSCHEDULER_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+
+class UnitLauncher;
+
+/**
+ * @brief The RestartScheduler class
+ * Session wide gate for unit restarts, once a restart
+ * delay expires the unit only starts if less than
+ * MAX_CONCURRENT_RESTARTS restarted units are still on
+ * their way to ready, otherwise it waits for a free slot.
+ * Keeps a crash loop of one unit from starving the rest,
+ * a unit that never gets ready gives its slot back after
+ * SLOT_TIMEOUT.
+ */
+class RestartScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    static RestartScheduler *global();
+
+    /**
+     * Restarts \p launcher in \p msecs, or later when too
+     * many restarts are in flight. Returns the deadline.
+     */
+    qint64 schedule(UnitLauncher *launcher, qint64 msecs);
+    void cancel(UnitLauncher *launcher);
+
+    /**
+     * The restarted unit is ready or gone, frees its slot
+     */
+    void release(UnitLauncher *launcher);
+
+private:
+    explicit RestartScheduler(QObject *parent = 0);
+    void due(UnitLauncher *launcher);
+    void restart(UnitLauncher *launcher);
+
+    QHash<UnitLauncher *, quint64> m_timers;
+    QList<UnitLauncher *> m_waiting;
+    // Slot timeout timer of each restart on its way to ready
+    QHash<UnitLauncher *, quint64> m_inFlight;
+};
+
+#endif // RESTARTSCHEDULER_H
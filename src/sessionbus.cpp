@@ -0,0 +1,260 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "sessionbus.h"
+
+#include "sessionenvironment.h"
+
+#include <QFile>
+#include <QDebug>
+
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <string.h>
+
+namespace {
+
+/**
+ * Hands the listening socket to dbus-daemon as fd 3,
+ * the LISTEN_FDS protocol used by the systemd: address
+ */
+class ListeningDaemonProcess : public QProcess
+{
+public:
+    ListeningDaemonProcess(int listenFd, QObject *parent) : QProcess(parent), m_listenFd(listenFd) {}
+
+protected:
+    void setupChildProcess() Q_DECL_OVERRIDE {
+        if (m_listenFd != 3) {
+            dup2(m_listenFd, 3);
+        } else {
+            int flags = fcntl(3, F_GETFD);
+            fcntl(3, F_SETFD, flags & ~FD_CLOEXEC);
+        }
+    }
+
+private:
+    int m_listenFd;
+};
+
+QString socketAddress(int fd)
+{
+    struct sockaddr_un addr;
+    socklen_t size = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    if (getsockname(fd, reinterpret_cast<struct sockaddr *>(&addr), &size) != 0 ||
+            addr.sun_family != AF_UNIX || size <= offsetof(struct sockaddr_un, sun_path)) {
+        return QString();
+    }
+
+    if (addr.sun_path[0] == '\0') {
+        size_t length = size - offsetof(struct sockaddr_un, sun_path) - 1;
+        return QLatin1String("unix:abstract=") + QString::fromLocal8Bit(addr.sun_path + 1, length);
+    }
+    return QLatin1String("unix:path=") + QFile::decodeName(addr.sun_path);
+}
+
+}
+
+SessionBus::SessionBus(QObject *parent) :
+    QObject(parent)
+{
+}
+
+SessionBus::~SessionBus()
+{
+    if (m_daemon) {
+        m_daemon->terminate();
+        m_daemon->waitForFinished(1000);
+    }
+}
+
+void SessionBus::setAddress(const QString &address)
+{
+    m_address = address;
+}
+
+void SessionBus::setListenFd(int fd)
+{
+    m_listenFd = fd;
+}
+
+void SessionBus::start()
+{
+    if (m_address.isEmpty()) {
+        m_address = QString::fromLocal8Bit(qgetenv("DBUS_SESSION_BUS_ADDRESS"));
+    }
+
+    if (!m_address.isEmpty() && m_listenFd == -1) {
+        // Queued so callers can connect to ready() first
+        QMetaObject::invokeMethod(this, "ready", Qt::QueuedConnection);
+        setReady(m_address.toLocal8Bit());
+    } else if (m_listenFd != -1) {
+        startListeningDaemon();
+    } else {
+        startDaemon();
+    }
+}
+
+bool SessionBus::isReady() const
+{
+    return m_ready;
+}
+
+QString SessionBus::address() const
+{
+    return m_address;
+}
+
+void SessionBus::daemonReadyRead()
+{
+    m_daemonOutput.append(m_daemon->readAllStandardOutput());
+    int newLine = m_daemonOutput.indexOf('\n');
+    if (newLine != -1 && !m_ready) {
+        QByteArray address = m_daemonOutput.left(newLine).trimmed();
+        m_daemonOutput.clear();
+        setReady(address);
+        emit ready();
+    }
+}
+
+void SessionBus::daemonError(QProcess::ProcessError error)
+{
+    if (error == QProcess::FailedToStart && !m_ready) {
+        qWarning() << "Unable to start dbus-daemon, trying dbus-launch";
+        startLaunch();
+    }
+}
+
+void SessionBus::daemonFinished(int exitCode, QProcess::ExitStatus exitStatus)
+{
+    qWarning() << "dbus-daemon finished" << exitCode << exitStatus;
+    if (!m_ready) {
+        startLaunch();
+    }
+}
+
+void SessionBus::launchFinished(int exitCode, QProcess::ExitStatus exitStatus)
+{
+    m_launch->deleteLater();
+    if (exitStatus != QProcess::NormalExit || exitCode != 0) {
+        qWarning() << "dbus-launch failed" << exitCode << exitStatus;
+        emit failed();
+        return;
+    }
+
+    QByteArray address;
+    QByteArray line = m_launch->readAllStandardOutput();
+    QList<QByteArray> vars = line.trimmed().split('\n');
+    foreach (const QByteArray &env, vars) {
+        int equalIndex = env.indexOf('=');
+        if (equalIndex <= 0) {
+            continue;
+        }
+
+        QByteArray name = env.mid(0, equalIndex);
+        QByteArray value = env.mid(equalIndex + 1);
+        if (name == "DBUS_SESSION_BUS_ADDRESS") {
+            address = value;
+        } else {
+            // Only the units need these
+            SessionEnvironment::global()->set(name, value);
+        }
+    }
+
+    if (address.isEmpty()) {
+        qWarning() << "dbus-launch did not provide an address";
+        emit failed();
+        return;
+    }
+
+    setReady(address);
+    emit ready();
+}
+
+void SessionBus::startListeningDaemon()
+{
+    if (m_address.isEmpty()) {
+        m_address = socketAddress(m_listenFd);
+    }
+
+    if (m_address.isEmpty()) {
+        qWarning() << "Unable to find the address of the listening socket" << m_listenFd;
+        startDaemon();
+        return;
+    }
+
+    m_daemon = new ListeningDaemonProcess(m_listenFd, this);
+    m_daemon->setProcessChannelMode(QProcess::ForwardedChannels);
+    connect(m_daemon, SIGNAL(finished(int,QProcess::ExitStatus)),
+            this, SLOT(daemonFinished(int,QProcess::ExitStatus)));
+    // LISTEN_PID must be the daemon itself, let the shell
+    // fill it in right before it execs dbus-daemon
+    m_daemon->start(QLatin1String("/bin/sh"),
+                    { QLatin1String("-c"),
+                      QLatin1String("LISTEN_PID=$$ LISTEN_FDS=1 exec dbus-daemon --session --nofork --nopidfile --address=systemd:") });
+
+    // Clients connecting before the daemon runs
+    // just wait in the socket backlog
+    QMetaObject::invokeMethod(this, "ready", Qt::QueuedConnection);
+    setReady(m_address.toLocal8Bit());
+}
+
+void SessionBus::startDaemon()
+{
+    qWarning() << "Launching DBus";
+    m_daemon = new QProcess(this);
+    m_daemon->setReadChannel(QProcess::StandardOutput);
+    m_daemon->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    connect(m_daemon, &QProcess::readyReadStandardOutput,
+            this, &SessionBus::daemonReadyRead);
+    connect(m_daemon, SIGNAL(error(QProcess::ProcessError)),
+            this, SLOT(daemonError(QProcess::ProcessError)));
+    connect(m_daemon, SIGNAL(finished(int,QProcess::ExitStatus)),
+            this, SLOT(daemonFinished(int,QProcess::ExitStatus)));
+    m_daemon->start(QLatin1String("dbus-daemon"),
+                    { QLatin1String("--session"), QLatin1String("--nofork"),
+                      QLatin1String("--nopidfile"), QLatin1String("--print-address=1") });
+}
+
+void SessionBus::startLaunch()
+{
+    if (m_launch) {
+        return;
+    }
+
+    m_launch = new QProcess(this);
+    m_launch->closeReadChannel(QProcess::StandardError);
+    connect(m_launch, SIGNAL(finished(int,QProcess::ExitStatus)),
+            this, SLOT(launchFinished(int,QProcess::ExitStatus)));
+    m_launch->start(QLatin1String("dbus-launch"), {"--close-stderr", "--exit-with-session"});
+}
+
+void SessionBus::setReady(const QByteArray &address)
+{
+    m_address = QString::fromLocal8Bit(address);
+    // Ours is what QDBusConnection::sessionBus() connects to
+    qputenv("DBUS_SESSION_BUS_ADDRESS", address);
+    SessionEnvironment::global()->set("DBUS_SESSION_BUS_ADDRESS", address);
+    m_ready = true;
+    qDebug() << "Session bus at" << m_address;
+}
@@ -0,0 +1,77 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef SESSIONBUS_H
+#define SESSIONBUS_H
+
+#include <QProcess>
+
+/**
+ * @brief The SessionBus class
+ * Brings up the D-Bus session bus without blocking, in order of preference:
+ * - an address given with setAddress(), or the one already in the environment
+ * - a dbus-daemon we start on a listening socket we already own,
+ *   the address is known before the daemon even runs
+ * - a private dbus-daemon printing its address
+ * - dbus-launch, if dbus-daemon could not be started
+ *
+ * ready() is emitted once DBUS_SESSION_BUS_ADDRESS is set
+ * in our environment, nothing may touch the session bus
+ * before that as QDBusConnection caches the first attempt.
+ */
+class SessionBus : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SessionBus(QObject *parent = 0);
+    virtual ~SessionBus();
+
+    void setAddress(const QString &address);
+    void setListenFd(int fd);
+
+    void start();
+
+    bool isReady() const;
+    QString address() const;
+
+Q_SIGNALS:
+    void ready();
+    void failed();
+
+private Q_SLOTS:
+    void daemonReadyRead();
+    void daemonError(QProcess::ProcessError error);
+    void daemonFinished(int exitCode, QProcess::ExitStatus exitStatus);
+    void launchFinished(int exitCode, QProcess::ExitStatus exitStatus);
+
+private:
+    void startListeningDaemon();
+    void startDaemon();
+    void startLaunch();
+    void setReady(const QByteArray &address);
+
+    QString m_address;
+    QByteArray m_daemonOutput;
+    QProcess *m_daemon = 0;
+    QProcess *m_launch = 0;
+    int m_listenFd = -1;
+    bool m_ready = false;
+};
+
+#endif // SESSIONBUS_H
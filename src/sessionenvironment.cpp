@@ -0,0 +1,188 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "sessionenvironment.h"
+
+#include <QCoreApplication>
+#include <QDBusMetaType>
+#include <QDebug>
+
+#include <string.h>
+
+extern char **environ;
+
+char *const *EnvironmentBlock::envp() const
+{
+    return m_envp.constData();
+}
+
+SessionEnvironment *SessionEnvironment::global()
+{
+    static SessionEnvironment *instance = new SessionEnvironment(qApp);
+    return instance;
+}
+
+SessionEnvironment::SessionEnvironment(QObject *parent) :
+    QObject(parent)
+{
+    qDBusRegisterMetaType<EnvironmentMap>();
+
+    // Seeded with what we were started with
+    for (char **variable = environ; *variable; ++variable) {
+        const char *equal = strchr(*variable, '=');
+        if (equal && equal != *variable) {
+            m_variables.insert(QByteArray(*variable, equal - *variable), QByteArray(equal + 1));
+        }
+    }
+}
+
+QByteArray SessionEnvironment::value(const QByteArray &name) const
+{
+    return m_variables.value(name);
+}
+
+void SessionEnvironment::set(const QByteArray &name, const QByteArray &value)
+{
+    if (name.isEmpty() || name.contains('=')) {
+        qWarning() << "Invalid environment variable name" << name;
+        return;
+    }
+
+    QHash<QByteArray, QByteArray>::Iterator it = m_variables.find(name);
+    if (it != m_variables.end() && it.value() == value) {
+        return;
+    }
+    m_variables.insert(name, value);
+    invalidate();
+}
+
+void SessionEnvironment::unset(const QByteArray &name)
+{
+    if (m_variables.remove(name)) {
+        invalidate();
+    }
+}
+
+void SessionEnvironment::update(const EnvironmentMap &changes)
+{
+    bool modified = false;
+    EnvironmentMap::ConstIterator it = changes.constBegin();
+    while (it != changes.constEnd()) {
+        const QByteArray name = it.key().toLocal8Bit();
+        if (name.isEmpty() || name.contains('=')) {
+            qWarning() << "Invalid environment variable name" << it.key();
+        } else if (it.value().isEmpty()) {
+            modified |= m_variables.remove(name) > 0;
+        } else {
+            const QByteArray value = it.value().toLocal8Bit();
+            QHash<QByteArray, QByteArray>::Iterator variable = m_variables.find(name);
+            if (variable == m_variables.end()) {
+                m_variables.insert(name, value);
+                modified = true;
+            } else if (variable.value() != value) {
+                variable.value() = value;
+                modified = true;
+            }
+        }
+        ++it;
+    }
+
+    // One new block and one signal for the whole batch
+    if (modified) {
+        invalidate();
+    }
+}
+
+EnvironmentMap SessionEnvironment::toMap() const
+{
+    EnvironmentMap ret;
+    QHash<QByteArray, QByteArray>::ConstIterator it = m_variables.constBegin();
+    while (it != m_variables.constEnd()) {
+        ret.insert(QString::fromLocal8Bit(it.key()), QString::fromLocal8Bit(it.value()));
+        ++it;
+    }
+    return ret;
+}
+
+quint64 SessionEnvironment::generation() const
+{
+    return m_generation;
+}
+
+QSharedPointer<const EnvironmentBlock> SessionEnvironment::block()
+{
+    if (!m_block) {
+        m_block = serialize(m_variables);
+    }
+    return m_block;
+}
+
+QSharedPointer<const EnvironmentBlock> SessionEnvironment::overlay(const QList<QByteArray> &overlay) const
+{
+    QHash<QByteArray, QByteArray> variables = m_variables;
+    foreach (const QByteArray &variable, overlay) {
+        const int equal = variable.indexOf('=');
+        if (equal > 0) {
+            variables.insert(variable.left(equal), variable.mid(equal + 1));
+        }
+    }
+    return serialize(variables);
+}
+
+void SessionEnvironment::invalidate()
+{
+    // Blocks handed out stay valid, the next spawn gets a new one
+    m_block.reset();
+    ++m_generation;
+    emit changed();
+}
+
+QSharedPointer<const EnvironmentBlock> SessionEnvironment::serialize(const QHash<QByteArray, QByteArray> &variables)
+{
+    QSharedPointer<EnvironmentBlock> block = QSharedPointer<EnvironmentBlock>::create();
+
+    int size = 0;
+    QHash<QByteArray, QByteArray>::ConstIterator it = variables.constBegin();
+    while (it != variables.constEnd()) {
+        size += it.key().size() + it.value().size() + 2;
+        ++it;
+    }
+
+    // One allocation, the pointers are taken once it's filled
+    block->m_data.reserve(size);
+    QVector<int> offsets;
+    offsets.reserve(variables.size());
+    it = variables.constBegin();
+    while (it != variables.constEnd()) {
+        offsets.append(block->m_data.size());
+        block->m_data.append(it.key());
+        block->m_data.append('=');
+        block->m_data.append(it.value());
+        block->m_data.append('\0');
+        ++it;
+    }
+
+    char *data = block->m_data.data();
+    block->m_envp.reserve(offsets.size() + 1);
+    foreach (int offset, offsets) {
+        block->m_envp.append(data + offset);
+    }
+    block->m_envp.append(0);
+    return block;
+}
@@ -0,0 +1,107 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef SESSIONENVIRONMENT_H
+#define SESSIONENVIRONMENT_H
+
+#include <QObject>
+#include <QHash>
+#include <QMap>
+#include <QVector>
+#include <QSharedPointer>
+#include <QMetaType>
+
+typedef QMap<QString, QString> EnvironmentMap;
+Q_DECLARE_METATYPE(EnvironmentMap)
+
+/**
+ * @brief The EnvironmentBlock class
+ * A serialized environment, ready to be passed to exec
+ */
+class EnvironmentBlock
+{
+public:
+    char *const *envp() const;
+
+private:
+    friend class SessionEnvironment;
+
+    QByteArray m_data;
+    QVector<char *> m_envp;
+};
+
+/**
+ * @brief The SessionEnvironment class
+ * The environment units are started with. It's serialized
+ * once into an EnvironmentBlock shared by every spawn and
+ * only serialized again after it changed, units with their
+ * own Environment= get a merged block they keep until the
+ * session environment changes.
+ *
+ * Our own process environment is not touched.
+ */
+class SessionEnvironment : public QObject
+{
+    Q_OBJECT
+public:
+    static SessionEnvironment *global();
+
+    QByteArray value(const QByteArray &name) const;
+    void set(const QByteArray &name, const QByteArray &value);
+    void unset(const QByteArray &name);
+
+    /**
+     * Applies all \p changes at once, an empty
+     * value unsets the variable
+     */
+    void update(const EnvironmentMap &changes);
+
+    EnvironmentMap toMap() const;
+
+    /**
+     * Bumped on every change, to know when
+     * an overlay must be merged again
+     */
+    quint64 generation() const;
+
+    /**
+     * The session environment as a block
+     */
+    QSharedPointer<const EnvironmentBlock> block();
+
+    /**
+     * The session environment with \p overlay
+     * (NAME=VALUE entries) applied on top
+     */
+    QSharedPointer<const EnvironmentBlock> overlay(const QList<QByteArray> &overlay) const;
+
+Q_SIGNALS:
+    void changed();
+
+private:
+    explicit SessionEnvironment(QObject *parent = 0);
+    void invalidate();
+    static QSharedPointer<const EnvironmentBlock> serialize(const QHash<QByteArray, QByteArray> &variables);
+
+    QHash<QByteArray, QByteArray> m_variables;
+    QSharedPointer<const EnvironmentBlock> m_block;
+    quint64 m_generation = 1;
+};
+
+#endif // SESSIONENVIRONMENT_H
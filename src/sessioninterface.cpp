@@ -20,56 +20,80 @@
 #include "sessioninterface.h"
 
 #include "sessionadaptor.h"
+#include "unitlauncher.h"
+#include "startupprofile.h"
+#include "dbusactivator.h"
 
 #include <QtDBus/QDBusConnection>
+#include <QtDBus/QDBusArgument>
+#include <QtDBus/QDBusMessage>
+#include <QtDBus/QDBusMetaType>
 
-#include <QProcess>
 #include <QDebug>
 
+// How long state changes are collected before being signaled
+#define UNITS_CHANGED_DELAY 100
+
+QDBusArgument &operator<<(QDBusArgument &argument, const UnitStatus &status)
+{
+    argument.beginStructure();
+    argument << status.name << status.path << status.type << status.state << status.ready
+             << status.pid << status.startTimestamp << status.readyTimestamp;
+    argument.endStructure();
+    return argument;
+}
+
+const QDBusArgument &operator>>(const QDBusArgument &argument, UnitStatus &status)
+{
+    argument.beginStructure();
+    argument >> status.name >> status.path >> status.type >> status.state >> status.ready
+             >> status.pid >> status.startTimestamp >> status.readyTimestamp;
+    argument.endStructure();
+    return argument;
+}
+
 SessionInterface::SessionInterface(QObject *parent) :
     QObject(parent),
-    m_registered(true)
-{
-    if (qgetenv("DBUS_SESSION_BUS_ADDRESS").isNull()) {
-        qWarning() << "Launching DBus";
-        QProcess process;
-        process.closeReadChannel(QProcess::StandardError);
-        process.start(QLatin1String("dbus-launch"), {"--close-stderr", "--exit-with-session"},
-                      QProcess::ReadWrite | QProcess::Unbuffered);
-        process.waitForFinished(5000);
-
-        QByteArray line = process.readAllStandardOutput();
-        QList<QByteArray> vars = line.trimmed().split('\n');
-        foreach (const QByteArray &env, vars) {
-            int equalIndex = env.indexOf('=');
-             qputenv(env.mid(0, equalIndex), env.mid(equalIndex + 1));
-        }
-    }
+    m_registered(false)
+{
+    qDBusRegisterMetaType<UnitStatus>();
+    qDBusRegisterMetaType<UnitStatusList>();
 
     (void) new SessionAdaptor(this);
+
+    m_flushTimer.setSingleShot(true);
+    m_flushTimer.setInterval(UNITS_CHANGED_DELAY);
+    connect(&m_flushTimer, &QTimer::timeout,
+            this, &SessionInterface::flushChanges);
+}
+
+bool SessionInterface::registerService()
+{
     if (!QDBusConnection::sessionBus().registerService(QLatin1String("org.lemuri.session"))) {
         qWarning() << "unable to register service to dbus";
-        m_registered = false;
-        return;
+        return false;
     }
 
 //    if (!QDBusConnection::sessionBus().registerService("org.le.ksmserver")) {
 //        qWarning() << "unable to register ksmserver interface to dbus";
-//        m_registered = false;
-//        return;
+//        return false;
 //    }
 
     if (!QDBusConnection::sessionBus().registerObject("/org/lemuri/session", this)) {
         qWarning() << "unable to register object to dbus";
-        m_registered = false;
-        return;
+        return false;
     }
 
 //    if (!QDBusConnection::sessionBus().registerService("org.kde.kded")) {
 //        kDebug() << "unable to register ksmserver interface to dbus";
-//        m_registered = false;
-//        return;
+//        return false;
 //    }
+
+    m_registered = true;
+    if (!m_changed.isEmpty() || !m_removed.isEmpty()) {
+        scheduleFlush();
+    }
+    return true;
 }
 
 SessionInterface::~SessionInterface()
@@ -80,3 +104,165 @@ bool SessionInterface::isRegistered() const
 {
     return m_registered;
 }
+
+TraceEventList SessionInterface::GetStartupTrace()
+{
+    return StartupTrace::global()->events();
+}
+
+bool SessionInterface::DumpStartupTrace(const QString &fileName)
+{
+    return StartupTrace::global()->writeChromeTrace(fileName);
+}
+
+UnitResourceMap SessionInterface::GetUnitResources()
+{
+    return ResourceSampler::global()->snapshot();
+}
+
+UnitStatusList SessionInterface::ListUnits()
+{
+    UnitStatusList ret;
+    ret.reserve(m_units.size());
+    foreach (UnitLauncher *launcher, m_units) {
+        ret.append(unitStatus(launcher));
+    }
+    return ret;
+}
+
+void SessionInterface::Logout()
+{
+    emit logoutRequested();
+}
+
+void SessionInterface::setStartupProfile(StartupProfile *profile)
+{
+    m_profile = profile;
+}
+
+UnitResourceMap SessionInterface::GetStartupProfile()
+{
+    return m_profile ? m_profile->toMap() : UnitResourceMap();
+}
+
+void SessionInterface::ResetStartupProfile()
+{
+    if (m_profile) {
+        m_profile->reset();
+    }
+}
+
+EnvironmentMap SessionInterface::GetEnvironment()
+{
+    return SessionEnvironment::global()->toMap();
+}
+
+void SessionInterface::UpdateEnvironment(const EnvironmentMap &changes)
+{
+    SessionEnvironment::global()->update(changes);
+}
+
+void SessionInterface::ActivateService(const QString &name)
+{
+    DBusActivator *activator = DBusActivator::find(name);
+    if (!activator) {
+        sendErrorReply(QDBusError::ServiceUnknown, QLatin1String("No unit activates ") + name);
+        return;
+    }
+
+    // Answered once the unit owns the name
+    setDelayedReply(true);
+    activator->activate(message());
+}
+
+void SessionInterface::addUnit(UnitLauncher *launcher)
+{
+    if (m_units.contains(launcher)) {
+        return;
+    }
+
+    m_units.append(launcher);
+    m_removed.removeOne(launcher->objectName());
+    connect(launcher, &UnitLauncher::stateChanged,
+            this, &SessionInterface::unitChanged);
+
+    m_changed.insert(launcher);
+    scheduleFlush();
+}
+
+void SessionInterface::removeUnit(UnitLauncher *launcher)
+{
+    if (!m_units.removeOne(launcher)) {
+        return;
+    }
+
+    disconnect(launcher, 0, this, 0);
+    m_changed.remove(launcher);
+    m_removed.append(launcher->objectName());
+    scheduleFlush();
+}
+
+void SessionInterface::unitChanged()
+{
+    UnitLauncher *launcher = qobject_cast<UnitLauncher *>(sender());
+    if (launcher) {
+        m_changed.insert(launcher);
+        scheduleFlush();
+    }
+}
+
+void SessionInterface::scheduleFlush()
+{
+    // Not restarted, the first change bounds the latency
+    if (!m_flushTimer.isActive()) {
+        m_flushTimer.start();
+    }
+}
+
+void SessionInterface::flushChanges()
+{
+    if (!m_registered) {
+        // Nobody can listen yet, keep it until the bus is up
+        return;
+    }
+
+    UnitStatusList units;
+    units.reserve(m_changed.size());
+    QDBusConnection bus = QDBusConnection::sessionBus();
+    foreach (UnitLauncher *launcher, m_changed) {
+        units.append(unitStatus(launcher));
+
+        QVariantMap properties;
+        properties.insert(QLatin1String("State"), uint(launcher->state()));
+        properties.insert(QLatin1String("Ready"), launcher->isReady());
+        properties.insert(QLatin1String("Status"), launcher->status());
+        properties.insert(QLatin1String("StartTimestamp"), qlonglong(launcher->startTimestamp()));
+        properties.insert(QLatin1String("ReadyTimestamp"), qlonglong(launcher->readyTimestamp()));
+        properties.insert(QLatin1String("RestartCount"), launcher->restartCount());
+        properties.insert(QLatin1String("NextRestart"), qlonglong(launcher->nextRestart()));
+
+        QDBusMessage message = QDBusMessage::createSignal(launcher->objectName(),
+                                                          QLatin1String("org.freedesktop.DBus.Properties"),
+                                                          QLatin1String("PropertiesChanged"));
+        message << QLatin1String("org.lemuri.session.unit") << properties << QStringList();
+        bus.send(message);
+    }
+
+    emit UnitsChanged(units, m_removed);
+    m_changed.clear();
+    m_removed.clear();
+}
+
+UnitStatus SessionInterface::unitStatus(UnitLauncher *launcher)
+{
+    UnitStatus status;
+    status.name = launcher->name();
+    status.path = QDBusObjectPath(launcher->objectName());
+    status.type = launcher->type();
+    status.state = launcher->state();
+    status.ready = launcher->isReady();
+    status.pid = launcher->pid();
+    status.startTimestamp = launcher->startTimestamp();
+    status.readyTimestamp = launcher->readyTimestamp();
+    return status;
+}
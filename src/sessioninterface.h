@@ -21,7 +21,44 @@
 #define SESSION_INTERFACE_H
 
 #include <QtDBus/QDBusContext>
+#include <QtDBus/QDBusObjectPath>
+#include <QTimer>
+#include <QSet>
 
+#include "startuptrace.h"
+#include "resourcesampler.h"
+#include "sessionenvironment.h"
+
+class QDBusArgument;
+class UnitLauncher;
+class StartupProfile;
+
+struct UnitStatus
+{
+    QString name;
+    QDBusObjectPath path;
+    uint type;
+    uint state;
+    bool ready;
+    qlonglong pid;
+    qlonglong startTimestamp; // monotonic msecs
+    qlonglong readyTimestamp; // monotonic msecs
+};
+typedef QList<UnitStatus> UnitStatusList;
+
+QDBusArgument &operator<<(QDBusArgument &argument, const UnitStatus &status);
+const QDBusArgument &operator>>(const QDBusArgument &argument, UnitStatus &status);
+
+Q_DECLARE_METATYPE(UnitStatus)
+Q_DECLARE_METATYPE(UnitStatusList)
+
+/**
+ * @brief The SessionInterface class
+ * Exports org.lemuri.session, unit state changes are
+ * collected for a short while and then sent as a single
+ * UnitsChanged signal plus one PropertiesChanged per
+ * changed unit, so a login does not flood the bus.
+ */
 class SessionInterface : public QObject, protected QDBusContext
 {
     Q_OBJECT
@@ -30,10 +67,51 @@ public:
     SessionInterface(QObject *parent = 0);
     ~SessionInterface();
 
+    /**
+     * Registers org.lemuri.session, must only be
+     * called once the session bus is up
+     */
+    bool registerService();
     bool isRegistered() const;
 
+    /**
+     * Units listed by ListUnits() and watched for changes
+     */
+    void addUnit(UnitLauncher *launcher);
+    void removeUnit(UnitLauncher *launcher);
+
+    void setStartupProfile(StartupProfile *profile);
+
+public Q_SLOTS:
+    TraceEventList GetStartupTrace();
+    bool DumpStartupTrace(const QString &fileName);
+    UnitResourceMap GetUnitResources();
+    UnitStatusList ListUnits();
+    void Logout();
+    UnitResourceMap GetStartupProfile();
+    void ResetStartupProfile();
+    EnvironmentMap GetEnvironment();
+    void UpdateEnvironment(const EnvironmentMap &changes);
+    void ActivateService(const QString &name);
+
+Q_SIGNALS:
+    void UnitsChanged(const UnitStatusList &units, const QStringList &removed);
+    void logoutRequested();
+
+private Q_SLOTS:
+    void unitChanged();
+    void flushChanges();
+
 private:
+    static UnitStatus unitStatus(UnitLauncher *launcher);
+    void scheduleFlush();
+
     bool m_registered;
+    QList<UnitLauncher *> m_units;
+    QSet<UnitLauncher *> m_changed;
+    QStringList m_removed;
+    QTimer m_flushTimer;
+    StartupProfile *m_profile = 0;
 };
 
 
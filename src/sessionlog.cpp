@@ -0,0 +1,168 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "sessionlog.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QDebug>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+// How long records are batched before being written
+#define SESSION_LOG_FLUSH_DELAY 250
+// Written right away once this much is pending
+#define SESSION_LOG_FLUSH_SIZE 65536
+// Dropped beyond this while a write is stuck
+#define SESSION_LOG_PENDING_MAX (1024 * 1024)
+// Rotated to .old once bigger than this
+#define SESSION_LOG_MAX_SIZE (16 * 1024 * 1024)
+
+SessionLog *SessionLog::global()
+{
+    static SessionLog *instance = new SessionLog(qApp);
+    return instance;
+}
+
+SessionLog::SessionLog(QObject *parent) :
+    QObject(parent)
+{
+    // One thread keeps the writes in order
+    m_pool.setMaxThreadCount(1);
+
+    m_flushTimer.setSingleShot(true);
+    m_flushTimer.setInterval(SESSION_LOG_FLUSH_DELAY);
+    connect(&m_flushTimer, &QTimer::timeout,
+            this, &SessionLog::startWrite);
+    connect(&m_watcher, &QFutureWatcher<void>::finished,
+            this, &SessionLog::startWrite);
+}
+
+SessionLog::~SessionLog()
+{
+    m_watcher.waitForFinished();
+    if (!m_pending.isEmpty()) {
+        write(&m_target, m_pending);
+    }
+    if (m_target.fd > 2) {
+        close(m_target.fd);
+    }
+}
+
+void SessionLog::setFileName(const QString &fileName)
+{
+    m_watcher.waitForFinished();
+    if (m_target.fd > 2) {
+        close(m_target.fd);
+    }
+
+    m_target.fileName = QFile::encodeName(fileName);
+    // Opened by the writer
+    m_target.fd = m_target.fileName.isEmpty() ? 2 : -1;
+    m_target.size = 0;
+}
+
+void SessionLog::append(const QByteArray &unit, UnitOutput::Stream stream, qulonglong timestamp,
+                        const char *data, int size)
+{
+    if (m_pending.size() >= SESSION_LOG_PENDING_MAX) {
+        ++m_dropped;
+        return;
+    }
+
+    if (m_dropped) {
+        char note[96];
+        int noteSize = snprintf(note, sizeof(note), "%llu.%06llu lemuri-session session: dropped %lld log records\n",
+                                timestamp / 1000000, timestamp % 1000000, m_dropped);
+        m_pending.append(note, noteSize);
+        m_dropped = 0;
+    }
+
+    char prefix[32];
+    int prefixSize = snprintf(prefix, sizeof(prefix), "%llu.%06llu ", timestamp / 1000000, timestamp % 1000000);
+    m_pending.append(prefix, prefixSize);
+    m_pending.append(unit);
+    m_pending.append(' ');
+    static const char *streams[] = { "session", "stdout", "stderr" };
+    m_pending.append(streams[stream]);
+    m_pending.append(": ", 2);
+    m_pending.append(data, size);
+    m_pending.append('\n');
+
+    if (m_pending.size() >= SESSION_LOG_FLUSH_SIZE) {
+        startWrite();
+    } else if (!m_flushTimer.isActive()) {
+        m_flushTimer.start();
+    }
+}
+
+void SessionLog::startWrite()
+{
+    if (m_pending.isEmpty() || m_watcher.isRunning()) {
+        // Picked up once the running write finishes
+        return;
+    }
+    m_flushTimer.stop();
+
+    QByteArray data;
+    data.swap(m_pending);
+    m_watcher.setFuture(QtConcurrent::run(&m_pool, &SessionLog::write, &m_target, data));
+}
+
+void SessionLog::write(Target *target, const QByteArray &data)
+{
+    if (target->fd < 0) {
+        target->fd = open(target->fileName.constData(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+        if (target->fd < 0) {
+            qWarning("Unable to open the session log %s: %s", target->fileName.constData(), strerror(errno));
+            return;
+        }
+
+        struct stat st;
+        target->size = fstat(target->fd, &st) == 0 ? st.st_size : 0;
+    }
+
+    const char *begin = data.constData();
+    qint64 left = data.size();
+    while (left > 0) {
+        ssize_t written = ::write(target->fd, begin, left);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        begin += written;
+        left -= written;
+        target->size += written;
+    }
+
+    if (!target->fileName.isEmpty() && target->size > SESSION_LOG_MAX_SIZE) {
+        // Keep one old file, the next write starts a new one
+        rename(target->fileName.constData(), QByteArray(target->fileName + ".old").constData());
+        close(target->fd);
+        target->fd = -1;
+    }
+}
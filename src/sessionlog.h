@@ -0,0 +1,79 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef SESSIONLOG_H
+#define SESSIONLOG_H
+
+#include <QObject>
+#include <QTimer>
+#include <QThreadPool>
+#include <QFutureWatcher>
+
+#include "unitoutput.h"
+
+/**
+ * @brief The SessionLog class
+ * Append only log of what the units print, one line per
+ * record tagged with the time, the unit and the stream.
+ * Records are batched and written by a single pool thread
+ * so a slow disk never stalls the event loop, if it can't
+ * keep up records are dropped and counted.
+ *
+ * Without a file it goes to our stderr, which is where
+ * the unit output used to end up.
+ */
+class SessionLog : public QObject
+{
+    Q_OBJECT
+public:
+    static SessionLog *global();
+    virtual ~SessionLog();
+
+    /**
+     * Appends to \p fileName, it is rotated to
+     * fileName.old once it gets too big
+     */
+    void setFileName(const QString &fileName);
+
+    void append(const QByteArray &unit, UnitOutput::Stream stream, qulonglong timestamp,
+                const char *data, int size);
+
+private Q_SLOTS:
+    void startWrite();
+
+private:
+    explicit SessionLog(QObject *parent = 0);
+
+    struct Target {
+        QByteArray fileName;
+        int fd = 2;
+        qint64 size = 0;
+    };
+
+    static void write(Target *target, const QByteArray &data);
+
+    Target m_target;
+    QByteArray m_pending;
+    qint64 m_dropped = 0;
+    QTimer m_flushTimer;
+    QThreadPool m_pool;
+    QFutureWatcher<void> m_watcher;
+};
+
+#endif // SESSIONLOG_H
@@ -20,27 +20,62 @@
 #include "sessionmanager.h"
 
 #include "sessioninterface.h"
-
-#include <QDirIterator>
+#include "sessionbus.h"
+#include "startuptrace.h"
+#include "unitscheduler.h"
+#include "notifysocket.h"
+#include "unitloader.h"
+#include "dbusnameregistry.h"
+#include "cgroupmanager.h"
+#include "sessionlog.h"
+#include "shutdowntransaction.h"
+#include "startupprofile.h"
+#include "readahead.h"
+#include "sessionenvironment.h"
+#include "launcherclient.h"
+
+#include <QDir>
+#include <QDateTime>
 #include <QFileSystemWatcher>
 #include <QStringBuilder>
 #include <QProcess>
+#include <QFile>
+#include <QFileInfo>
 #include <QTimer>
+#include <QSocketNotifier>
 #include <QDebug>
 
-#define UNIT_TIMEOUT 200
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+
+static int s_signalPipe[2] = { -1, -1 };
 
 SessionManager::SessionManager(int &argc, char **argv) :
     QGuiApplication(argc, argv),
     m_state(0),
     m_sessionInterface(0),
+    m_sessionBus(0),
+    m_scheduler(0),
+    m_notifySocket(0),
+    m_sessionNames(0),
+    m_systemNames(0),
+    m_unitLoader(0),
+    m_unitWatcher(0),
+    m_reloadTimer(0),
     m_windowManagerUnit(0)
 {
     setQuitOnLastWindowClosed(false);
+
+    // Restart jitter must differ between sessions and users
+    qsrand(uint(QDateTime::currentMSecsSinceEpoch()) ^ uint(getpid()));
 }
 
 SessionManager::~SessionManager()
 {
+    delete m_profile;
 }
 
 void SessionManager::setSessionName(const QString &session)
@@ -53,6 +88,16 @@ void SessionManager::setSessionName(const QString &session)
     qDebug() << m_windowManager << settings.fileName();
     settings.setPath(QSettings::IniFormat, QSettings::UserScope, QString("/etc"));
     m_windowManager = settings.value(QLatin1String("X-WindowManager")).toString();
+    m_windowManagerRequiresBus = settings.value(QLatin1String("X-WindowManagerRequiresDBus"), false).toBool();
+    bool ok;
+    int spawnLimit = settings.value(QLatin1String("X-MaxStartingUnits")).toInt(&ok);
+    if (ok && spawnLimit >= 0) {
+        m_spawnLimit = spawnLimit;
+    }
+    double idleWindow = settings.value(QLatin1String("X-AutostartIdleWindow")).toDouble(&ok);
+    if (ok && idleWindow >= 0) {
+        m_idleWindow = int(idleWindow * 1000);
+    }
     qDebug() << m_windowManager << settings.fileName();
 }
 
@@ -61,217 +106,679 @@ void SessionManager::setWindowManager(const QString &windowManager)
     m_windowManager = windowManager;
 }
 
+void SessionManager::setBusAddress(const QString &address)
+{
+    m_busAddress = address;
+}
+
+void SessionManager::setBusListenFd(int fd)
+{
+    m_busListenFd = fd;
+}
+
+void SessionManager::setUnitDirectories(const QStringList &directories)
+{
+    m_unitDirectories = directories;
+}
+
+void SessionManager::setTraceFile(const QString &fileName)
+{
+    m_traceFile = fileName;
+}
+
+void SessionManager::setLogFile(const QString &fileName)
+{
+    SessionLog::global()->setFileName(fileName);
+}
+
+void SessionManager::setLauncherEnabled(bool enabled)
+{
+    m_launcherEnabled = enabled;
+}
+
+void SessionManager::setLauncherModuleDirectory(const QString &moduleDir)
+{
+    m_launcherModuleDir = moduleDir;
+}
+
+void SessionManager::setSpawnLimit(int limit)
+{
+    m_spawnLimit = limit;
+}
+
+void SessionManager::setIdleWindow(int msecs)
+{
+    m_idleWindow = msecs;
+}
+
 void SessionManager::init()
 {
+    StartupTrace::global()->record(StartupTrace::Milestone, QString(), QStringLiteral("SessionStarted"));
+
+    // Before anything is spawned so every unit lands in its slice
+    CGroupManager::global()->init();
+
+    // Preloads the toolkits while everything else starts,
+    // without it units are spawned as usual
+    if (m_launcherEnabled) {
+        const QString moduleDir = m_launcherModuleDir.isEmpty() ?
+                    QStringLiteral(LAUNCHER_MODULE_DIR) : m_launcherModuleDir;
+        LauncherClient::global()->start(applicationDirPath() % QLatin1String("/lemuri-session-launcher"),
+                                        moduleDir);
+    }
+
+    // Pages the units needed last time are read in
+    // while the bus and the Window Manager start
+    m_readahead = new Readahead(m_sessionName, this);
+    m_readahead->prefetch();
+
+    // The bus comes up while units are loaded, everything
+    // that talks to it waits for busReady()
+    m_sessionBus = new SessionBus(this);
+    m_sessionBus->setAddress(m_busAddress);
+    m_sessionBus->setListenFd(m_busListenFd);
+    connect(m_sessionBus, &SessionBus::ready,
+            this, &SessionManager::busReady);
+    connect(m_sessionBus, &SessionBus::failed,
+            this, &SessionManager::busFailed);
+    m_sessionBus->start();
+
     m_sessionInterface = new SessionInterface(this);
-    if (!m_sessionInterface->isRegistered()) {
+    connect(m_sessionInterface, &SessionInterface::logoutRequested,
+            this, &SessionManager::shutdown);
+    watchUnixSignals();
+
+    // Units with ReadyNotify=notify report readiness here,
+    // children get the socket path from the session environment
+    m_notifySocket = new NotifySocket(this);
+    if (m_notifySocket->isValid()) {
+        SessionEnvironment::global()->set("NOTIFY_SOCKET", QFile::encodeName(m_notifySocket->path()));
+        connect(m_notifySocket, &NotifySocket::notification,
+                this, &SessionManager::unitNotification);
+    }
+
+    m_scheduler = new UnitScheduler(this);
+    connect(m_scheduler, &UnitScheduler::milestoneReached,
+            this, &SessionManager::milestoneReached);
+    if (m_spawnLimit >= 0) {
+        m_scheduler->setSpawnLimit(m_spawnLimit);
+    }
+
+    // What previous logins learned orders the spawns,
+    // expensive units off the critical path wait for the shell
+    m_profile = new StartupProfile(m_sessionName);
+    m_profile->load();
+    m_scheduler->setProfile(m_profile, ShellStarted);
+    m_sessionInterface->setStartupProfile(m_profile);
+
+    // Shell units need the Window Manager to place their windows,
+    // services only need a display, autostart applications
+    // expect a panel/tray to be around. Everything else is
+    // ordered by the After=/Requires= keys of the units.
+    m_scheduler->addMilestone(WindowManagerStarted, UnitLauncher::Custom);
+    m_scheduler->addMilestone(ShellStarted, UnitLauncher::Shell, WindowManagerStarted);
+    m_scheduler->addMilestone(ServicesStarted, UnitLauncher::Service, WindowManagerStarted);
+    m_scheduler->addMilestone(AutostartStarted, UnitLauncher::Application, ShellStarted);
+    m_scheduler->setTypeDependency(UnitLauncher::Shell, WindowManagerStarted);
+    m_scheduler->setTypeDependency(UnitLauncher::Service, WindowManagerStarted);
+    m_scheduler->setTypeDependency(UnitLauncher::Application, ShellStarted);
+
+    // Updaters, sync clients and the like can be delayed or
+    // wait for the session to be idle, counted from the shell
+    m_scheduler->setStartClassMilestone(ShellStarted);
+    if (m_idleWindow >= 0) {
+        m_scheduler->setIdleWindow(m_idleWindow);
+    }
+
+    // Unit files are scanned and parsed on the thread pool
+    // while the Window Manager starts
+    m_unitLoader = new UnitLoader(m_sessionName, this);
+    connect(m_unitLoader, &UnitLoader::finished,
+            this, &SessionManager::unitsLoaded);
+    if (m_unitDirectories.isEmpty()) {
+        m_unitDirectories = defaultUnitDirectories();
+    }
+    loadUnits();
+
+    if (!m_windowManager.isEmpty()) {
+        m_windowManagerUnit = new UnitLauncher(m_windowManager, this);
+        m_sessionInterface->addUnit(m_windowManagerUnit);
+        recordReadahead(m_windowManagerUnit);
+        m_scheduler->addUnit(m_windowManagerUnit);
+        if (!m_windowManagerRequiresBus || m_sessionBus->isReady()) {
+            m_windowManagerUnit->Start();
+        }
+    }
+}
+
+void SessionManager::busReady()
+{
+    if (!m_sessionInterface->registerService()) {
         exit(1);
         return;
     }
 
-    if (m_windowManager.isEmpty()) {
-        loadShell();
-    } else {
-        m_windowManagerUnit = new UnitLauncher(m_windowManager, this);
-        connect(m_windowManagerUnit, &UnitLauncher::started,
-                this, &SessionManager::windowManagerStarted);
+    if (m_windowManagerUnit && m_windowManagerRequiresBus &&
+            m_windowManagerUnit->state() == QProcess::NotRunning) {
         m_windowManagerUnit->Start();
     }
+
+    startUnits();
 }
 
-void SessionManager::windowManagerStarted()
+void SessionManager::busFailed()
 {
-    if (m_state & WindowManagerStarted) {
+    qCritical() << "Unable to bring up the session bus";
+    exit(1);
+}
+
+void SessionManager::unitsLoaded(const QList<UnitInfo> &units)
+{
+    if (m_shutdown) {
         return;
     }
 
-    qDebug() << "Window Manager started";
-    m_state |= WindowManagerStarted;
-    loadShell();
+    if (m_unitsLoaded) {
+        reloadUnits(units);
+    } else {
+        StartupTrace::global()->reserve(units.size());
+        createUnits(units);
+        m_unitsLoaded = true;
+        startUnits();
+    }
+
+    watchUnitDirectories();
+
+    if (m_reloadPending) {
+        m_reloadPending = false;
+        loadUnits();
+    }
 }
 
-void SessionManager::loadUnits()
+void SessionManager::shutdown()
 {
-    QStringList paths;
+    if (m_shutdown) {
+        return;
+    }
+    qDebug() << "Shutting down the session";
 
-    QString xdgConfigHome = qgetenv("XDG_CONFIG_HOME");
-    if (xdgConfigHome.isNull()) {
-        xdgConfigHome = QDir::homePath() % QLatin1String("/.config");
+    if (m_reloadTimer) {
+        m_reloadTimer->stop();
     }
-    paths.append(xdgConfigHome);
 
-    QString xdgConfigDirs = qgetenv("XDG_CONFIG_DIRS");
-    if (xdgConfigDirs.isNull()) {
-        xdgConfigDirs = QLatin1String("/etc/xdg/autostart");
+    QList<UnitLauncher *> applications;
+    QList<UnitLauncher *> services;
+    QList<UnitLauncher *> shell;
+    QList<UnitLauncher *> others;
+    foreach (UnitLauncher *launcher, m_units) {
+        // Nothing may come back while we stop the rest
+        launcher->inhibit();
+        switch (launcher->type()) {
+        case UnitLauncher::Application:
+            applications.append(launcher);
+            break;
+        case UnitLauncher::Service:
+            services.append(launcher);
+            break;
+        case UnitLauncher::Shell:
+            shell.append(launcher);
+            break;
+        default:
+            others.append(launcher);
+            break;
+        }
     }
-    foreach (const QString &paths, container) {
 
+    m_shutdown = new ShutdownTransaction(this);
+    m_shutdown->addLevel(applications);
+    m_shutdown->addLevel(services);
+    m_shutdown->addLevel(shell);
+    m_shutdown->addLevel(others);
+    if (m_windowManagerUnit) {
+        m_windowManagerUnit->inhibit();
+        m_shutdown->addLevel(QList<UnitLauncher *>() << m_windowManagerUnit);
     }
-    paths.append(xdgConfigHome);
+    connect(m_shutdown, &ShutdownTransaction::finished,
+            this, &SessionManager::quit);
+    m_shutdown->start();
+}
 
+void SessionManager::watchUnixSignals()
+{
+    if (pipe2(s_signalPipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+        qWarning() << "Unable to watch for termination signals" << strerror(errno);
+        return;
+    }
 
-    QString unitsPath = QLatin1String("/etc/lemuri/") % sessionName % QLatin1String(".d");
+    m_signalNotifier = new QSocketNotifier(s_signalPipe[0], QSocketNotifier::Read, this);
+    connect(m_signalNotifier, &QSocketNotifier::activated,
+            this, &SessionManager::readUnixSignal);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = &SessionManager::unixSignalHandler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGTERM, &action, 0);
+    sigaction(SIGINT, &action, 0);
+    sigaction(SIGHUP, &action, 0);
+}
 
-    QFileSystemWatcher *watcher = new QFileSystemWatcher(paths, this);
+void SessionManager::unixSignalHandler(int signal)
+{
+    int savedErrno = errno;
+    char c = char(signal);
+    ssize_t ret = write(s_signalPipe[1], &c, 1);
+    Q_UNUSED(ret)
+    errno = savedErrno;
+}
 
+void SessionManager::readUnixSignal()
+{
+    char buffer[16];
+    while (read(s_signalPipe[0], buffer, sizeof(buffer)) > 0) {
+    }
+    shutdown();
 }
 
-void SessionManager::loadShell()
+void SessionManager::startUnits()
 {
-    QString sessionPath = UnitLauncher::configPath(m_sessionName);
-    qDebug() << "Load shell units" << sessionPath;
+    if (!m_unitsLoaded || !m_sessionBus->isReady() || m_sessionNames) {
+        return;
+    }
 
-    createUnits(m_shellUnits, UnitLauncher::Session, sessionPath, m_sessionName);
+    // Flush what was waiting for the bus
+    m_sessionNames = new DBusNameRegistry(QDBusConnection::SessionBus, this);
+    m_systemNames = new DBusNameRegistry(QDBusConnection::SystemBus, this);
 
-    if (m_shellUnits.isEmpty()) {
-        m_state |= ShellStarted;
-        loadServices();
-    } else {
-        m_shellTimeout = new QTimer(this);
-        connect(m_shellTimeout, &QTimer::timeout,
-                this, &SessionManager::servicesStarted);
-        m_shellTimeout->setSingleShot(true);
-        m_shellTimeout->start(m_shellUnits.size() * UNIT_TIMEOUT);
+    if (m_windowManagerUnit) {
+        m_windowManagerUnit->registerObject();
+    }
+
+    foreach (UnitLauncher *launcher, m_units) {
+        launcher->registerObject();
+        m_sessionNames->addUnit(launcher);
+        m_systemNames->addUnit(launcher);
     }
+
+    m_sessionNames->seed();
+    m_systemNames->seed();
+    m_scheduler->start();
 }
 
-void SessionManager::shellStarted()
+void SessionManager::milestoneReached(int milestone)
 {
-    if (m_state & ShellStarted) {
-        return;
+    QString name;
+    switch (milestone) {
+    case WindowManagerStarted:
+        name = QStringLiteral("WindowManagerStarted");
+        break;
+    case ShellStarted:
+        name = QStringLiteral("ShellStarted");
+        break;
+    case ServicesStarted:
+        name = QStringLiteral("ServicesStarted");
+        break;
+    case AutostartStarted:
+        name = QStringLiteral("AutostartStarted");
+        break;
+    }
+    qDebug() << "Milestone reached" << name;
+    StartupTrace::global()->record(StartupTrace::Milestone, QString(), name);
+    m_state |= milestone;
+
+    if (milestone == ShellStarted) {
+        // Autostart applications no longer compete with the login
+        CGroupManager::global()->relaxWeights();
+        findCriticalPath();
+    }
+
+    if ((m_state & AutostartStarted) && (m_state & ServicesStarted)) {
+        StartupTrace::global()->setStartupFinished();
+        recordProfile();
+        if (!m_traceFile.isEmpty()) {
+            StartupTrace::global()->writeChromeTrace(m_traceFile);
+        }
+    }
+}
+
+void SessionManager::findCriticalPath()
+{
+    QHash<QString, UnitLauncher *> units;
+    QList<UnitLauncher *> windowManagers;
+    UnitLauncher *gate = 0;
+    foreach (UnitLauncher *launcher, m_units) {
+        units.insert(launcher->name(), launcher);
+        if (launcher->type() == UnitLauncher::Custom) {
+            windowManagers.append(launcher);
+        } else if (launcher->type() == UnitLauncher::Shell && launcher->readyTimestamp() > 0 &&
+                   (!gate || launcher->readyTimestamp() > gate->readyTimestamp())) {
+            gate = launcher;
+        }
+    }
+    if (m_windowManagerUnit) {
+        windowManagers.append(m_windowManagerUnit);
+        if (!gate && m_windowManagerUnit->readyTimestamp() > 0) {
+            gate = m_windowManagerUnit;
+        }
     }
 
-    int missingUnits = 0;
-    QTimer *timer = qobject_cast<QTimer*>(sender());
-    if (!timer) {
-        QHash<QString, UnitLauncher *>::ConstIterator it = m_shellUnits.constBegin();
-        while (it != m_shellUnits.constEnd()) {
-            UnitLauncher *launcher = it.value();
-            if (launcher->state() == QProcess::Starting) {
-                missingUnits += UNIT_TIMEOUT;
+    // Back from the Shell unit that got ready last, each step
+    // follows the dependency that got ready last before the
+    // unit started, so the profile learns what actually gated
+    // this login rather than everything that could have
+    m_criticalUnits.clear();
+    while (gate && !m_criticalUnits.contains(gate->name())) {
+        m_criticalUnits.insert(gate->name());
+
+        QList<UnitLauncher *> dependencies;
+        foreach (const QString &name, gate->after() + gate->requires()) {
+            if (UnitLauncher *dependency = units.value(name)) {
+                dependencies.append(dependency);
+            }
+        }
+        if (gate->type() == UnitLauncher::Shell) {
+            // Through the WindowManagerStarted milestone
+            dependencies.append(windowManagers);
+        }
+
+        UnitLauncher *last = 0;
+        foreach (UnitLauncher *dependency, dependencies) {
+            if (dependency->readyTimestamp() <= 0 || dependency->readyTimestamp() > gate->startTimestamp()) {
+                continue;
+            }
+            if (!last || dependency->readyTimestamp() > last->readyTimestamp()) {
+                last = dependency;
             }
-            ++it;
         }
+        gate = last;
     }
+    qDebug() << "Critical path to the shell" << m_criticalUnits;
+}
 
-    if (missingUnits) {
-        m_shellTimeout->start(missingUnits);
-    } else {
-        m_state |= ShellStarted;
-        loadServices();
+void SessionManager::recordProfile()
+{
+    if (m_profileRecorded || !m_profile) {
+        return;
+    }
+    m_profileRecorded = true;
+
+    foreach (UnitLauncher *launcher, m_units) {
+        // Only what was actually spawned during this login
+        if (launcher->startTimestamp() <= 0 || launcher->readyTimestamp() < launcher->startTimestamp()) {
+            continue;
+        }
+
+        const ResourceUsage usage = launcher->resourceUsage();
+        m_profile->addSample(launcher->name(),
+                             launcher->readyTimestamp() - launcher->startTimestamp(),
+                             usage.cpuTime,
+                             usage.ioRead + usage.ioWrite,
+                             m_criticalUnits.contains(launcher->name()));
+    }
+    m_profile->finishLogin();
+    m_readahead->save();
+}
+
+void SessionManager::unitNotification(qint64 pid, const QHash<QByteArray, QByteArray> &fields)
+{
+    if (m_windowManagerUnit && m_windowManagerUnit->pid() == pid) {
+        m_windowManagerUnit->notify(fields);
+        return;
+    }
+
+    foreach (UnitLauncher *launcher, m_units) {
+        if (launcher->pid() == pid) {
+            launcher->notify(fields);
+            return;
+        }
     }
+    qDebug() << "Notification from unknown process" << pid << fields;
 }
 
-void SessionManager::loadServices()
+QStringList SessionManager::defaultUnitDirectories() const
 {
-    QString servicesPath = UnitLauncher::configPath(UnitLauncher::Service, m_sessionName);
-    qDebug() << "Load services units" << servicesPath;
+    // Session units first, then the XDG autostart
+    // directories in the order they override each other
+    QStringList paths;
+    paths.append(UnitLauncher::configPath(m_sessionName));
 
-    createUnits(m_serviceUnits, UnitLauncher::Service, servicesPath, m_sessionName);
+    QString xdgConfigHome = QFile::decodeName(qgetenv("XDG_CONFIG_HOME"));
+    if (xdgConfigHome.isEmpty()) {
+        xdgConfigHome = QDir::homePath() % QLatin1String("/.config");
+    }
+    paths.append(xdgConfigHome % QLatin1String("/autostart"));
 
-    if (m_serviceUnits.isEmpty()) {
-        m_state |= ShellStarted;
-        loadAutostart();
-    } else {
-        m_servicesTimeout = new QTimer(this);
-        connect(m_servicesTimeout, &QTimer::timeout,
-                this, &SessionManager::servicesStarted);
-        m_servicesTimeout->setSingleShot(true);
-        m_servicesTimeout->start(m_serviceUnits.size() * UNIT_TIMEOUT);
+    QString xdgConfigDirs = QFile::decodeName(qgetenv("XDG_CONFIG_DIRS"));
+    if (xdgConfigDirs.isEmpty()) {
+        xdgConfigDirs = QLatin1String("/etc/xdg");
     }
+    foreach (const QString &path, xdgConfigDirs.split(QLatin1Char(':'), QString::SkipEmptyParts)) {
+        paths.append(path % QLatin1String("/autostart"));
+    }
+    paths.append(QLatin1String("/usr/share/autostart"));
+
+    paths.removeDuplicates();
+    return paths;
 }
 
-void SessionManager::servicesStarted()
+void SessionManager::loadUnits()
 {
-    if (m_state & ServicesStarted) {
+    if (m_shutdown) {
         return;
     }
 
-    int missingUnits = 0;
-    QTimer *timer = qobject_cast<QTimer *>(sender());
-    if (!timer) {
-        QHash<QString, UnitLauncher *>::ConstIterator it = m_shellUnits.constBegin();
-        while (it != m_shellUnits.constEnd()) {
-            UnitLauncher *launcher = it.value();
-            if (launcher->state() == QProcess::Starting) {
-                missingUnits += UNIT_TIMEOUT;
+    if (m_unitLoader->isRunning()) {
+        m_reloadPending = true;
+        return;
+    }
+
+    m_unitLoader->load(m_unitDirectories);
+}
+
+void SessionManager::watchUnitDirectories()
+{
+    if (!m_unitWatcher) {
+        // Package upgrades touch many files in a row,
+        // reload once things settle down
+        m_reloadTimer = new QTimer(this);
+        m_reloadTimer->setSingleShot(true);
+        m_reloadTimer->setInterval(500);
+        connect(m_reloadTimer, &QTimer::timeout,
+                this, &SessionManager::loadUnits);
+
+        m_unitWatcher = new QFileSystemWatcher(this);
+        connect(m_unitWatcher, SIGNAL(directoryChanged(QString)),
+                m_reloadTimer, SLOT(start()));
+    }
+
+    // Directories that don't exist yet are noticed
+    // through the closest parent that does
+    QStringList paths;
+    foreach (const QString &directory, m_unitDirectories) {
+        QFileInfo info(directory);
+        while (!info.isDir() && !info.isRoot()) {
+            info.setFile(info.path());
+        }
+        if (!info.isRoot()) {
+            paths.append(info.absoluteFilePath());
+        }
+    }
+
+    const QStringList watched = m_unitWatcher->directories();
+    paths.removeDuplicates();
+    foreach (const QString &path, watched) {
+        paths.removeAll(path);
+    }
+    if (!paths.isEmpty()) {
+        m_unitWatcher->addPaths(paths);
+    }
+}
+
+void SessionManager::reloadUnits(const QList<UnitInfo> &units)
+{
+    QHash<QString, UnitInfo> current;
+    QList<UnitInfo> ordered;
+    foreach (const UnitInfo &info, units) {
+        // The first directory providing a file name wins
+        if (info.isValid() && !current.contains(info.fileName)) {
+            current.insert(info.fileName, info);
+            ordered.append(info);
+        }
+    }
+
+    int removed = 0;
+    foreach (const QString &name, m_units.keys()) {
+        if (!current.contains(name)) {
+            removeUnit(name);
+            ++removed;
+        }
+    }
+    foreach (const QString &name, m_replacements.keys()) {
+        if (!current.contains(name)) {
+            m_replacements.remove(name);
+        }
+    }
+
+    int added = 0;
+    int restarted = 0;
+    QList<UnitLauncher *> launchers;
+    foreach (const UnitInfo &info, ordered) {
+        QHash<QString, UnitInfo>::Iterator it = m_unitInfos.find(info.fileName);
+        if (it == m_unitInfos.end()) {
+            if (m_stoppingUnits.contains(info.fileName)) {
+                // Started once the old process is gone
+                m_replacements.insert(info.fileName, info);
+            } else {
+                launchers.append(addUnit(info));
             }
-            ++it;
+            ++added;
+        } else if (needsRestart(it.value(), info)) {
+            removeUnit(info.fileName);
+            if (m_stoppingUnits.contains(info.fileName)) {
+                m_replacements.insert(info.fileName, info);
+            } else {
+                launchers.append(addUnit(info));
+            }
+            ++restarted;
+        } else {
+            // Nothing the running unit depends on changed
+            m_units.value(info.fileName)->updatePolicy(info);
+            it.value() = info;
         }
     }
+    // In one go, units of the batch may depend on each other
+    m_scheduler->addUnits(launchers);
 
-    if (missingUnits) {
-        m_servicesTimeout->start(missingUnits);
-    } else {
-        m_state |= ServicesStarted;
-        loadAutostart();
+    if (added || removed || restarted) {
+        qDebug() << "Units reloaded," << added << "added" << removed
+                 << "removed" << restarted << "restarted";
     }
 }
 
-void SessionManager::loadAutostart()
+bool SessionManager::needsRestart(const UnitInfo &before, const UnitInfo &after)
 {
-    createUnits(QLatin1String("/etc/xdg/autostart"), m_sessionName);
-    createUnits(QLatin1String("/usr/share/autostart"), m_sessionName);
+    return before.argv != after.argv ||
+            before.dbusExec != after.dbusExec ||
+            before.dbusName != after.dbusName ||
+            before.readyNotify != after.readyNotify ||
+            before.type != after.type ||
+            before.after != after.after ||
+            before.requires != after.requires ||
+            before.dbusSessionRequires != after.dbusSessionRequires ||
+            before.dbusSystemRequires != after.dbusSystemRequires;
 }
 
-void SessionManager::autostartStarted()
+UnitLauncher *SessionManager::addUnit(const UnitInfo &info)
 {
+    UnitLauncher *launcher = new UnitLauncher(info, m_sessionName, this);
+    m_units.insert(info.fileName, launcher);
+    m_unitInfos.insert(info.fileName, info);
+
+    // Before startUnits() everything is done in one go there
+    if (m_sessionNames) {
+        launcher->registerObject();
+        m_sessionNames->addUnit(launcher);
+        m_systemNames->addUnit(launcher);
+    }
+    m_sessionInterface->addUnit(launcher);
+    recordReadahead(launcher);
+    return launcher;
+}
+
+void SessionManager::recordReadahead(UnitLauncher *launcher)
+{
+    if (m_profileRecorded) {
+        return;
+    }
 
+    // By the time it's ready it mapped what it needs to start
+    connect(launcher, &UnitLauncher::ready, this, [this, launcher]() {
+        if (!m_profileRecorded) {
+            m_readahead->recordProcess(launcher->pid());
+        }
+    });
 }
 
-void SessionManager::createUnits(const QString &path, const QString &sessionName)
+void SessionManager::removeUnit(const QString &name)
 {
-    QDirIterator it(path, QDir::Files);
-    while (it.hasNext()) {
-        qDebug() << it.next();
-        if (!m_units.contains(it.fileName())) {
-            UnitLauncher *launcher = new UnitLauncher(it.filePath(),
-                                                      sessionName,
-                                                      this);
-            if (!launcher->isValid()) {
-                delete launcher;
-                continue;
-            }
+    UnitLauncher *launcher = m_units.take(name);
+    m_unitInfos.remove(name);
+    if (!launcher) {
+        return;
+    }
 
-            connect(launcher, &UnitLauncher::started,
-                    this, &SessionManager::unitStarted);
-            switch (launcher->type()) {
-            case UnitLauncher::Shell:
-                connect(this, &SessionManager::startShellUnits,
-                        launcher, &UnitLauncher::Start);
-                break;
-            case UnitLauncher::Service:
-                connect(this, &SessionManager::startServiceUnits,
-                        launcher, &UnitLauncher::Start);
-                break;
-            case UnitLauncher::Application:
-                connect(this, &SessionManager::startApplicationUnits,
-                        launcher, &UnitLauncher::Start);
-                break;
-            default:
-                qCritical() << "Unit type not recognized!";
-                break;
+    m_scheduler->removeUnit(launcher);
+    m_sessionInterface->removeUnit(launcher);
+    if (m_sessionNames) {
+        m_sessionNames->removeUnit(launcher);
+        m_systemNames->removeUnit(launcher);
+        launcher->unregisterObject();
+    }
+
+    if (launcher->state() == QProcess::NotRunning) {
+        launcher->deleteLater();
+    } else {
+        // Keep it around until the process is reaped, a
+        // replacement must not race it for its D-Bus name
+        m_stoppingUnits.insert(name);
+        connect(launcher, &UnitLauncher::stateChanged, launcher, [this, launcher, name]() {
+            if (launcher->state() == QProcess::NotRunning) {
+                disconnect(launcher, &UnitLauncher::stateChanged, launcher, 0);
+                launcher->deleteLater();
+                unitStopped(name);
             }
-            m_units.insert(it.fileName(), launcher);
-        }
+        });
+        launcher->Stop();
     }
 }
 
-void SessionManager::unitStarted()
+void SessionManager::unitStopped(const QString &name)
 {
-    UnitLauncher *launcher = qobject_cast<UnitLauncher*>(sender());
-    switch (launcher->type()) {
-    case UnitLauncher::Shell:
-        shellStarted();
-        break;
-    case UnitLauncher::Service:
-        servicesStarted();
-        break;
-    case UnitLauncher::Application:
-        autostartStarted();
-        break;
-    default:
-        qCritical() << "Custon unit started" << launcher->objectName();
-        break;
+    m_stoppingUnits.remove(name);
+    QHash<QString, UnitInfo>::Iterator it = m_replacements.find(name);
+    if (it == m_replacements.end()) {
+        return;
+    }
+
+    const UnitInfo info = it.value();
+    m_replacements.erase(it);
+    if (!m_shutdown && !m_units.contains(name)) {
+        qDebug() << "Starting the replacement of" << name;
+        m_scheduler->addUnit(addUnit(info));
+    }
+}
+
+void SessionManager::createUnits(const QList<UnitInfo> &units)
+{
+    QList<UnitLauncher *> launchers;
+    foreach (const UnitInfo &info, units) {
+        // The first directory providing a file name wins
+        if (!info.isValid() || m_units.contains(info.fileName)) {
+            continue;
+        }
+
+        launchers.append(addUnit(info));
     }
+    m_scheduler->addUnits(launchers);
 }
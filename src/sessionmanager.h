@@ -22,17 +22,52 @@
 
 #include <QGuiApplication>
 #include <QSettings>
+#include <QSet>
 
 #include "unitlauncher.h"
 
 class SessionInterface;
+class SessionBus;
+class UnitScheduler;
+class NotifySocket;
+class DBusNameRegistry;
+class UnitLoader;
+class ShutdownTransaction;
+class StartupProfile;
+class Readahead;
+class QFileSystemWatcher;
+class QSocketNotifier;
+class QTimer;
 class SessionManager : public QGuiApplication
 {
+    Q_OBJECT
 public:
+    /**
+     * Milestones reached while the session starts, these
+     * are derived from the unit graph and don't gate
+     * anything by themselves, units of a given type
+     * wait on them through UnitScheduler edges.
+     */
     enum Phase {
+        /**
+         * The Window Manager is ready, we need it to properly place
+         * the Desktop Shell Windows on the Display Server.
+         */
         WindowManagerStarted = 0x01,
+        /**
+         * All Shell units are ready.
+         */
         ShellStarted         = 0x02,
-        ServicesStarted      = 0x04
+        /**
+         * All Session specific services (networking, sound,
+         * bluetooth) are ready, these aren't explicity
+         * needed to have a session running.
+         */
+        ServicesStarted      = 0x04,
+        /**
+         * All XDG autostart desktop files have been started.
+         */
+        AutostartStarted     = 0x08
     };
 
     SessionManager(int &argc, char **argv);
@@ -40,66 +75,127 @@ public:
 
     void setSessionName(const QString &session);
     void setWindowManager(const QString &windowManager);
-    void init();
+    void setBusAddress(const QString &address);
+    void setBusListenFd(int fd);
 
-Q_SIGNALS:
-    void startShellUnits();
-    void startServiceUnits();
-    void startApplicationUnits();
+    /**
+     * Overrides the session .d and XDG autostart
+     * directories, in priority order
+     */
+    void setUnitDirectories(const QStringList &directories);
 
-private Q_SLOTS:
-    void windowManagerStarted();
+    /**
+     * Writes the Chrome trace of the startup to \p fileName
+     * once all units were started
+     */
+    void setTraceFile(const QString &fileName);
 
-    void loadUnits();
+    /**
+     * Unit output goes to \p fileName instead of our stderr
+     */
+    void setLogFile(const QString &fileName);
 
     /**
-     * @brief loadShell
-     * This method is called after the Window Manager
-     * has started, because we need it to properly place
-     * the Desktop Shell Windows on the Display Server,
-     * on Wayland we will probably start this after the
-     * QML view has properly loaded.
+     * Units with Launcher=true are forked by the launcher
+     * helper, its modules are loaded from \p moduleDir
      */
-    void loadShell();
-    void shellStarted();
+    void setLauncherEnabled(bool enabled);
+    void setLauncherModuleDirectory(const QString &moduleDir);
 
     /**
-     * @brief loadServices
-     * This method is called after the shell is
-     * up and running, it loads all Session
-     * specific services (networking, sound, bluetooth).
-     * These aren't explicity needed to have a session
-     * running.
+     * At most \p limit units of a phase are starting at once,
+     * 0 starts them all together, the default follows the CPUs
      */
-    void loadServices();
-    void servicesStarted();
+    void setSpawnLimit(int limit);
 
     /**
-     * @brief loadAutostart
-     * This method is called after the services
-     * are loaded, this starts all XDG autostart
-     * desktop files, just to complain with XDG
+     * Units with StartClass=idle need \p msecs without
+     * load or user input before they are started
      */
-    void loadAutostart();
-    void autostartStarted();
+    void setIdleWindow(int msecs);
+    void init();
 
-    void createUnits(const QString &path, const QString &sessionName);
-    void unitStarted();
+public Q_SLOTS:
+    /**
+     * Stops the units, autostart applications first, then
+     * services, the shell and finally the Window Manager,
+     * and quits once they are gone
+     */
+    void shutdown();
+
+private Q_SLOTS:
+    void milestoneReached(int milestone);
+    void unitsLoaded(const QList<UnitInfo> &units);
+    void busReady();
+    void busFailed();
+    void unitNotification(qint64 pid, const QHash<QByteArray, QByteArray> &fields);
+    void readUnixSignal();
+
+    /**
+     * (Re)scans the unit directories, only files that
+     * changed since the last load are parsed again
+     */
+    void loadUnits();
+
+private:
+    void findCriticalPath();
+    void recordProfile();
+    void watchUnixSignals();
+    static void unixSignalHandler(int signal);
+    QStringList defaultUnitDirectories() const;
+    void watchUnitDirectories();
+    void createUnits(const QList<UnitInfo> &units);
+
+    /**
+     * Applies the difference to the running session, units
+     * are only restarted when what they execute or depend
+     * on changed
+     */
+    void reloadUnits(const QList<UnitInfo> &units);
+    static bool needsRestart(const UnitInfo &before, const UnitInfo &after);
+    UnitLauncher *addUnit(const UnitInfo &info);
+    void recordReadahead(UnitLauncher *launcher);
+    void removeUnit(const QString &name);
+    void unitStopped(const QString &name);
+    void startUnits();
 
     int m_state;
     SessionInterface *m_sessionInterface;
+    SessionBus *m_sessionBus;
+    QString m_busAddress;
+    QString m_traceFile;
+    QStringList m_unitDirectories;
+    int m_busListenFd = -1;
+    bool m_launcherEnabled = true;
+    int m_spawnLimit = -1;
+    int m_idleWindow = -1;
+    QString m_launcherModuleDir;
+    bool m_windowManagerRequiresBus = false;
+    bool m_unitsLoaded = false;
+    bool m_reloadPending = false;
+    UnitScheduler *m_scheduler;
+    NotifySocket *m_notifySocket;
+    DBusNameRegistry *m_sessionNames;
+    DBusNameRegistry *m_systemNames;
+    UnitLoader *m_unitLoader;
+    QFileSystemWatcher *m_unitWatcher;
+    QTimer *m_reloadTimer;
+    ShutdownTransaction *m_shutdown = 0;
+    StartupProfile *m_profile = 0;
+    Readahead *m_readahead = 0;
+    QSet<QString> m_criticalUnits;
+    bool m_profileRecorded = false;
+    QSocketNotifier *m_signalNotifier = 0;
     bool m_launchX11;
     QString m_sessionName;
     QString m_windowManager;
     UnitLauncher *m_windowManagerUnit;
     QSettings m_setting;
     QHash<QString, UnitLauncher *> m_units;
-
-    QHash<QString, UnitLauncher *> m_shellUnits;
-    QTimer *m_shellTimeout = 0;
-    QHash<QString, UnitLauncher *> m_serviceUnits;
-    QTimer *m_servicesTimeout = 0;
-    QHash<QString, UnitLauncher *> m_autostartUnits;
+    QHash<QString, UnitInfo> m_unitInfos;
+    // Removed units still stopping and what replaces them
+    QSet<QString> m_stoppingUnits;
+    QHash<QString, UnitInfo> m_replacements;
 };
 
 #endif // SESSIONMANAGER_H
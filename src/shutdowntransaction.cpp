@@ -0,0 +1,258 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "shutdowntransaction.h"
+
+#include "unitlauncher.h"
+#include "startuptrace.h"
+#include "timerqueue.h"
+#include "cgroupmanager.h"
+
+#include <QDebug>
+
+// A unit gets this long to exit after SIGTERM
+#define SHUTDOWN_UNIT_TIMEOUT 5000
+// Everything left is SIGKILLed after this
+#define SHUTDOWN_TIMEOUT 15000
+
+ShutdownTransaction::ShutdownTransaction(QObject *parent) :
+    QObject(parent)
+{
+}
+
+ShutdownTransaction::~ShutdownTransaction()
+{
+    TimerQueue::global()->cancel(m_deadline);
+    foreach (Unit *unit, m_units) {
+        TimerQueue::global()->cancel(unit->deadline);
+    }
+    qDeleteAll(m_units);
+}
+
+void ShutdownTransaction::addLevel(const QList<UnitLauncher *> &units)
+{
+    // Units might go away while we wait for others
+    QList<QPointer<UnitLauncher> > level;
+    foreach (UnitLauncher *launcher, units) {
+        level.append(launcher);
+    }
+    m_levels.append(level);
+}
+
+void ShutdownTransaction::start()
+{
+    if (m_started) {
+        return;
+    }
+
+    m_started = TimerQueue::now();
+    StartupTrace::global()->record(StartupTrace::Milestone, QString(), QStringLiteral("ShutdownStarted"));
+    m_deadline = TimerQueue::global()->start(SHUTDOWN_TIMEOUT, this, [this]() {
+        expire();
+    });
+    startLevel();
+}
+
+void ShutdownTransaction::startLevel()
+{
+    while (++m_level < m_levels.size()) {
+        QHash<QString, Unit *> names;
+        foreach (UnitLauncher *launcher, m_levels.at(m_level)) {
+            if (!launcher || launcher->state() == QProcess::NotRunning || m_units.contains(launcher)) {
+                continue;
+            }
+
+            Unit *unit = new Unit;
+            unit->launcher = launcher;
+            unit->name = launcher->name();
+            m_units.insert(launcher, unit);
+            names.insert(launcher->name(), unit);
+            ++m_pending;
+
+            connect(launcher, &UnitLauncher::stateChanged,
+                    this, &ShutdownTransaction::unitStateChanged);
+            connect(launcher, &QObject::destroyed,
+                    this, &ShutdownTransaction::unitDestroyed);
+        }
+
+        if (names.isEmpty()) {
+            continue;
+        }
+
+        // Reverse dependency order, only within the level
+        foreach (Unit *unit, names) {
+            foreach (const QString &name, unit->launcher->after() + unit->launcher->requires()) {
+                Unit *dependency = names.value(name);
+                if (dependency && dependency != unit && !unit->dependencies.contains(dependency)) {
+                    unit->dependencies.append(dependency);
+                    ++dependency->dependents;
+                }
+            }
+        }
+
+        foreach (Unit *unit, names) {
+            if (unit->dependents == 0) {
+                stopUnit(unit);
+            }
+        }
+
+        if (m_stopping == 0) {
+            // Nothing but cycles
+            foreach (Unit *unit, names) {
+                stopUnit(unit);
+            }
+        }
+        return;
+    }
+
+    finish();
+}
+
+void ShutdownTransaction::stopUnit(Unit *unit)
+{
+    if (unit->stopRequested || unit->stopped) {
+        return;
+    }
+
+    unit->stopRequested = TimerQueue::now();
+    unit->deadline = TimerQueue::global()->start(SHUTDOWN_UNIT_TIMEOUT, this, [this, unit]() {
+        unit->deadline = 0;
+        killUnit(unit);
+    });
+    ++m_stopping;
+
+    StartupTrace::global()->record(StartupTrace::StopRequested, unit->name);
+    unit->launcher->Stop();
+}
+
+void ShutdownTransaction::killUnit(Unit *unit)
+{
+    if (unit->stopped) {
+        return;
+    }
+
+    qWarning() << unit->name << "did not stop within" << SHUTDOWN_UNIT_TIMEOUT << "ms, killing it";
+    StartupTrace::global()->record(StartupTrace::Killed, unit->name);
+    unit->killed = true;
+    unit->launcher->kill();
+}
+
+void ShutdownTransaction::unitStateChanged()
+{
+    UnitLauncher *launcher = qobject_cast<UnitLauncher *>(sender());
+    Unit *unit = m_units.value(launcher);
+    if (unit && launcher->state() == QProcess::NotRunning) {
+        unitStopped(unit);
+    }
+}
+
+void ShutdownTransaction::unitDestroyed(QObject *object)
+{
+    // Only used as a key, it's gone already
+    Unit *unit = m_units.value(static_cast<UnitLauncher *>(object));
+    if (unit) {
+        unit->launcher = 0;
+        unitStopped(unit);
+    }
+}
+
+void ShutdownTransaction::unitStopped(Unit *unit)
+{
+    if (unit->stopped || m_finished) {
+        return;
+    }
+    unit->stopped = true;
+    --m_pending;
+
+    if (unit->stopRequested) {
+        --m_stopping;
+        TimerQueue::global()->cancel(unit->deadline);
+        unit->deadline = 0;
+
+        const qint64 latency = TimerQueue::now() - unit->stopRequested;
+        qDebug() << "Stopped" << unit->name << "in" << latency << "ms"
+                 << (unit->killed ? "after SIGKILL" : "after SIGTERM");
+        StartupTrace::global()->recordDuration(StartupTrace::Stopped, unit->name, latency);
+    }
+
+    foreach (Unit *dependency, unit->dependencies) {
+        if (--dependency->dependents == 0) {
+            stopUnit(dependency);
+        }
+    }
+
+    if (m_pending == 0) {
+        startLevel();
+    } else if (m_stopping == 0) {
+        // What is left waits on a cycle
+        foreach (Unit *other, m_units) {
+            if (!other->stopped) {
+                stopUnit(other);
+            }
+        }
+    }
+}
+
+void ShutdownTransaction::expire()
+{
+    m_deadline = 0;
+    qWarning() << "Shutdown took longer than" << SHUTDOWN_TIMEOUT << "ms, killing what is left";
+
+    // Levels not reached yet too
+    for (int level = qMax(m_level, 0); level < m_levels.size(); ++level) {
+        foreach (UnitLauncher *launcher, m_levels.at(level)) {
+            Unit *unit = m_units.value(launcher);
+            if (!launcher || (unit && unit->stopped)) {
+                continue;
+            }
+            StartupTrace::global()->record(StartupTrace::Killed, launcher->name());
+            launcher->kill();
+        }
+    }
+    finish();
+}
+
+void ShutdownTransaction::finish()
+{
+    if (m_finished) {
+        return;
+    }
+    m_finished = true;
+    TimerQueue::global()->cancel(m_deadline);
+
+    // Daemons that outlived their unit
+    foreach (const QList<QPointer<UnitLauncher> > &level, m_levels) {
+        foreach (UnitLauncher *launcher, level) {
+            if (!launcher) {
+                continue;
+            }
+
+            const QString cgroup = launcher->cgroup();
+            if (!cgroup.isEmpty() && CGroupManager::global()->isPopulated(cgroup)) {
+                CGroupManager::global()->kill(cgroup);
+            }
+        }
+    }
+
+    const qint64 elapsed = TimerQueue::now() - m_started;
+    qDebug() << "Session shutdown took" << elapsed << "ms";
+    StartupTrace::global()->record(StartupTrace::Milestone, QString(),
+                                   QStringLiteral("ShutdownFinished"));
+    emit finished();
+}
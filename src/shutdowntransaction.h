@@ -0,0 +1,92 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef SHUTDOWNTRANSACTION_H
+#define SHUTDOWNTRANSACTION_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QVector>
+#include <QPointer>
+
+class UnitLauncher;
+
+/**
+ * @brief The ShutdownTransaction class
+ * Stops the session units level by level, everything in a
+ * level gets SIGTERM at once. Within a level a unit is only
+ * stopped after the units of that level depending on it
+ * (After= or Requires=) exited.
+ *
+ * A unit that doesn't exit within its deadline is SIGKILLed,
+ * once the global deadline expires everything left is. Each
+ * stop latency is logged and recorded in the StartupTrace.
+ */
+class ShutdownTransaction : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ShutdownTransaction(QObject *parent = 0);
+    virtual ~ShutdownTransaction();
+
+    /**
+     * Levels are stopped in the order they were added
+     */
+    void addLevel(const QList<UnitLauncher *> &units);
+
+    void start();
+
+Q_SIGNALS:
+    void finished();
+
+private Q_SLOTS:
+    void unitStateChanged();
+    void unitDestroyed(QObject *object);
+
+private:
+    struct Unit {
+        UnitLauncher *launcher = 0;
+        QString name;
+        int dependents = 0;        // same level units still running
+        QVector<Unit *> dependencies;
+        qint64 stopRequested = 0;  // monotonic msecs
+        quint64 deadline = 0;
+        bool stopped = false;
+        bool killed = false;
+    };
+
+    void startLevel();
+    void stopUnit(Unit *unit);
+    void killUnit(Unit *unit);
+    void unitStopped(Unit *unit);
+    void expire();
+    void finish();
+
+    QList<QList<QPointer<UnitLauncher> > > m_levels;
+    int m_level = -1;
+    QHash<UnitLauncher *, Unit *> m_units;
+    int m_pending = 0;
+    int m_stopping = 0;
+    qint64 m_started = 0;
+    quint64 m_deadline = 0;
+    bool m_finished = false;
+};
+
+#endif // SHUTDOWNTRANSACTION_H
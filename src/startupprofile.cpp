@@ -0,0 +1,210 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "startupprofile.h"
+
+#include <QDataStream>
+#include <QSaveFile>
+#include <QStringBuilder>
+#include <QFileInfo>
+#include <QFile>
+#include <QDir>
+#include <QDebug>
+
+#define PROFILE_MAGIC 0x4c535046 // LSPF
+#define PROFILE_VERSION 1
+// Weight of the newest login in the moving averages
+#define PROFILE_WEIGHT 0.3f
+// Units not started for this many logins are dropped
+#define PROFILE_MAX_AGE 20
+// Below this a unit is not considered critical anymore
+#define PROFILE_CRITICAL 0.2f
+// Starting a unit above any of these is expensive
+#define PROFILE_EXPENSIVE_CPU 200.0f    // msecs
+#define PROFILE_EXPENSIVE_IO 8192.0f    // KiB
+
+StartupProfile::StartupProfile(const QString &sessionName)
+{
+    QString stateHome = QFile::decodeName(qgetenv("XDG_STATE_HOME"));
+    if (stateHome.isEmpty()) {
+        stateHome = QDir::homePath() % QLatin1String("/.local/state");
+    }
+    m_fileName = stateHome % QLatin1String("/lemuri-session/") % sessionName % QLatin1String(".profile");
+}
+
+QString StartupProfile::fileName() const
+{
+    return m_fileName;
+}
+
+bool StartupProfile::load()
+{
+    m_entries.clear();
+    m_login = 0;
+
+    QFile file(m_fileName);
+    if (!file.open(QFile::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+
+    quint32 magic;
+    quint32 version;
+    quint32 count;
+    stream >> magic >> version >> m_login >> count;
+    if (magic != PROFILE_MAGIC || version != PROFILE_VERSION) {
+        qDebug() << "Ignoring incompatible startup profile" << m_fileName;
+        m_login = 0;
+        return false;
+    }
+
+    m_entries.reserve(count);
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        QString unit;
+        Entry entry;
+        stream >> unit >> entry.readyMsecs >> entry.cpuMsecs >> entry.ioKiB
+               >> entry.critical >> entry.samples >> entry.lastLogin;
+        m_entries.insert(unit, entry);
+    }
+
+    if (stream.status() != QDataStream::Ok) {
+        qWarning() << "Corrupted startup profile" << m_fileName;
+        m_entries.clear();
+        m_login = 0;
+        return false;
+    }
+
+    return true;
+}
+
+bool StartupProfile::save()
+{
+    QDir().mkpath(QFileInfo(m_fileName).absolutePath());
+    QSaveFile file(m_fileName);
+    if (!file.open(QFile::WriteOnly)) {
+        qWarning() << "Unable to write the startup profile" << m_fileName << file.errorString();
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    stream << quint32(PROFILE_MAGIC) << quint32(PROFILE_VERSION) << m_login << quint32(m_entries.size());
+
+    QHash<QString, Entry>::ConstIterator it = m_entries.constBegin();
+    while (it != m_entries.constEnd()) {
+        const Entry &entry = it.value();
+        stream << it.key() << entry.readyMsecs << entry.cpuMsecs << entry.ioKiB
+               << entry.critical << entry.samples << entry.lastLogin;
+        ++it;
+    }
+    return file.commit();
+}
+
+void StartupProfile::reset()
+{
+    m_entries.clear();
+    m_login = 0;
+    QFile::remove(m_fileName);
+}
+
+void StartupProfile::addSample(const QString &unit, qint64 readyMsecs, qint64 cpuUsecs, qint64 ioBytes, bool critical)
+{
+    Entry &entry = m_entries[unit];
+    const float ready = float(readyMsecs);
+    const float cpu = float(cpuUsecs) / 1000;
+    const float io = float(ioBytes) / 1024;
+    const float isCritical = critical ? 1 : 0;
+
+    if (entry.samples == 0) {
+        entry.readyMsecs = ready;
+        entry.cpuMsecs = cpu;
+        entry.ioKiB = io;
+        entry.critical = isCritical;
+    } else {
+        entry.readyMsecs += PROFILE_WEIGHT * (ready - entry.readyMsecs);
+        entry.cpuMsecs += PROFILE_WEIGHT * (cpu - entry.cpuMsecs);
+        entry.ioKiB += PROFILE_WEIGHT * (io - entry.ioKiB);
+        entry.critical += PROFILE_WEIGHT * (isCritical - entry.critical);
+    }
+    ++entry.samples;
+    entry.lastLogin = m_login + 1;
+}
+
+void StartupProfile::finishLogin()
+{
+    ++m_login;
+
+    QHash<QString, Entry>::Iterator it = m_entries.begin();
+    while (it != m_entries.end()) {
+        if (m_login - it.value().lastLogin >= PROFILE_MAX_AGE) {
+            it = m_entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    save();
+}
+
+qreal StartupProfile::priority(const QString &unit) const
+{
+    QHash<QString, Entry>::ConstIterator it = m_entries.constFind(unit);
+    if (it == m_entries.constEnd()) {
+        // Unknown, between the critical and the other units
+        return 0.5;
+    }
+
+    // The ready time only breaks ties
+    return it.value().critical + qMin(it.value().readyMsecs, 60000.0f) / 1000000;
+}
+
+bool StartupProfile::isDeferrable(const QString &unit) const
+{
+    QHash<QString, Entry>::ConstIterator it = m_entries.constFind(unit);
+    if (it == m_entries.constEnd() || it.value().samples < 2) {
+        return false;
+    }
+
+    const Entry &entry = it.value();
+    return entry.critical < PROFILE_CRITICAL &&
+            (entry.cpuMsecs > PROFILE_EXPENSIVE_CPU || entry.ioKiB > PROFILE_EXPENSIVE_IO);
+}
+
+UnitResourceMap StartupProfile::toMap() const
+{
+    UnitResourceMap ret;
+    QHash<QString, Entry>::ConstIterator it = m_entries.constBegin();
+    while (it != m_entries.constEnd()) {
+        const Entry &entry = it.value();
+        QVariantMap unit;
+        unit.insert(QLatin1String("ReadyTime"), double(entry.readyMsecs));
+        unit.insert(QLatin1String("CpuTime"), double(entry.cpuMsecs));
+        unit.insert(QLatin1String("IO"), double(entry.ioKiB));
+        unit.insert(QLatin1String("Critical"), double(entry.critical));
+        unit.insert(QLatin1String("Samples"), entry.samples);
+        unit.insert(QLatin1String("LastLogin"), entry.lastLogin);
+        unit.insert(QLatin1String("Deferred"), isDeferrable(it.key()));
+        ret.insert(it.key(), unit);
+        ++it;
+    }
+    return ret;
+}
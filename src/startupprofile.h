@@ -0,0 +1,94 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef STARTUPPROFILE_H
+#define STARTUPPROFILE_H
+
+#include <QString>
+#include <QHash>
+
+#include "resourcesampler.h"
+
+/**
+ * @brief The StartupProfile class
+ * What previous logins of a session learned about each unit:
+ * how long it took to get ready, the CPU time and I/O it used
+ * while starting and whether it was on the critical path to
+ * the shell. Values are moving averages so the profile follows
+ * changes, units not seen for a while are forgotten.
+ *
+ * Kept in $XDG_STATE_HOME/lemuri-session/<session>.profile.
+ */
+class StartupProfile
+{
+public:
+    explicit StartupProfile(const QString &sessionName);
+
+    QString fileName() const;
+
+    bool load();
+    bool save();
+
+    /**
+     * Forgets everything and removes the file
+     */
+    void reset();
+
+    /**
+     * Adds what a unit did in this login, finishLogin()
+     * ages the units that weren't seen and saves
+     */
+    void addSample(const QString &unit, qint64 readyMsecs, qint64 cpuUsecs, qint64 ioBytes, bool critical);
+    void finishLogin();
+
+    /**
+     * Higher starts first, critical path units before
+     * the others and slow ones before fast ones
+     */
+    qreal priority(const QString &unit) const;
+
+    /**
+     * Off the critical path and expensive to start,
+     * better started once the shell is up
+     */
+    bool isDeferrable(const QString &unit) const;
+
+    /**
+     * Everything known keyed by unit name, ReadyTime (msecs),
+     * CpuTime (msecs), IO (KiB), Critical (0 to 1), Samples
+     * and LastLogin
+     */
+    UnitResourceMap toMap() const;
+
+private:
+    struct Entry {
+        float readyMsecs = 0;
+        float cpuMsecs = 0;
+        float ioKiB = 0;
+        float critical = 0;
+        quint32 samples = 0;
+        quint32 lastLogin = 0;
+    };
+
+    QString m_fileName;
+    QHash<QString, Entry> m_entries;
+    quint32 m_login = 0;
+};
+
+#endif // STARTUPPROFILE_H
@@ -0,0 +1,348 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "startuptrace.h"
+
+#include <QDBusArgument>
+#include <QDBusMetaType>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QDebug>
+
+#include <algorithm>
+
+#include <string.h>
+#include <time.h>
+
+#define TRACE_RING_SIZE 8192
+// Released, spawned, executed, ready and a few dependencies
+#define TRACE_EVENTS_PER_UNIT 12
+
+QDBusArgument &operator<<(QDBusArgument &argument, const TraceEvent &event)
+{
+    argument.beginStructure();
+    argument << event.timestamp << event.unit << event.event << event.detail;
+    argument.endStructure();
+    return argument;
+}
+
+const QDBusArgument &operator>>(const QDBusArgument &argument, TraceEvent &event)
+{
+    argument.beginStructure();
+    argument >> event.timestamp >> event.unit >> event.event >> event.detail;
+    argument.endStructure();
+    return argument;
+}
+
+StartupTrace *StartupTrace::global()
+{
+    static StartupTrace *instance = new StartupTrace;
+    return instance;
+}
+
+StartupTrace::StartupTrace()
+{
+    m_ring.resize(TRACE_RING_SIZE);
+    // Index 0 is the empty string
+    intern(QString());
+
+    qDBusRegisterMetaType<TraceEvent>();
+    qDBusRegisterMetaType<TraceEventList>();
+}
+
+qint64 StartupTrace::now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return qint64(ts.tv_sec) * Q_INT64_C(1000000000) + ts.tv_nsec;
+}
+
+void StartupTrace::record(Kind kind, const QString &unit, const QString &detail)
+{
+    record(now(), kind, unit, detail);
+}
+
+void StartupTrace::record(qint64 timestamp, Kind kind, const QString &unit, const QString &detail)
+{
+    QMutexLocker locker(&m_mutex);
+    append(timestamp, kind, unit, DetailString, intern(detail), 0);
+}
+
+void StartupTrace::record(Kind kind, const QString &unit, qint64 value)
+{
+    const qint64 timestamp = now();
+    QMutexLocker locker(&m_mutex);
+    append(timestamp, kind, unit, DetailNumber, 0, value);
+}
+
+void StartupTrace::recordDuration(Kind kind, const QString &unit, qint64 msecs)
+{
+    const qint64 timestamp = now();
+    QMutexLocker locker(&m_mutex);
+    append(timestamp, kind, unit, DetailDuration, 0, msecs);
+}
+
+void StartupTrace::recordError(Kind kind, const QString &unit, int error)
+{
+    const qint64 timestamp = now();
+    QMutexLocker locker(&m_mutex);
+    append(timestamp, kind, unit, DetailError, 0, error);
+}
+
+void StartupTrace::setStartupFinished()
+{
+    QMutexLocker locker(&m_mutex);
+    m_startupFinished = true;
+}
+
+void StartupTrace::reserve(int units)
+{
+    QMutexLocker locker(&m_mutex);
+    const int size = units * TRACE_EVENTS_PER_UNIT;
+    if (size <= m_ring.size()) {
+        return;
+    }
+
+    // Oldest first at the start so recording just continues
+    if (m_wrapped) {
+        m_ring = m_ring.mid(m_next) + m_ring.mid(0, m_next);
+        m_next = m_ring.size();
+        m_wrapped = false;
+    }
+    m_ring.resize(size);
+}
+
+void StartupTrace::append(qint64 timestamp, Kind kind, const QString &unit,
+                          DetailType detailType, quint32 detail, qint64 value)
+{
+    if (m_startupFinished && (kind == Discovered || kind == Parsed)) {
+        return;
+    }
+
+    Event event;
+    event.timestamp = timestamp;
+    event.value = value;
+    event.unit = intern(unit);
+    event.detail = detail;
+    event.kind = kind;
+    event.detailType = detailType;
+
+    if (kind == Milestone) {
+        m_milestones.append(event);
+        return;
+    }
+
+    m_ring[m_next] = event;
+    if (++m_next == m_ring.size()) {
+        m_next = 0;
+        m_wrapped = true;
+    }
+}
+
+TraceEventList StartupTrace::events() const
+{
+    TraceEventList ret;
+    const QVector<Event> events = snapshot();
+
+    QMutexLocker locker(&m_mutex);
+    foreach (const Event &event, events) {
+        TraceEvent traceEvent;
+        traceEvent.timestamp = event.timestamp / 1000;
+        traceEvent.unit = m_strings.at(event.unit);
+        traceEvent.event = kindName(static_cast<Kind>(event.kind));
+        switch (event.detailType) {
+        case DetailString:
+            traceEvent.detail = m_strings.at(event.detail);
+            break;
+        case DetailNumber:
+            traceEvent.detail = QString::number(event.value);
+            break;
+        case DetailDuration:
+            traceEvent.detail = QString::number(event.value) + QLatin1String("ms");
+            break;
+        case DetailError:
+            traceEvent.detail = QString::fromLocal8Bit(strerror(int(event.value)));
+            break;
+        }
+        ret.append(traceEvent);
+    }
+    return ret;
+}
+
+QByteArray StartupTrace::toChromeTrace() const
+{
+    const TraceEventList events = this->events();
+    if (events.isEmpty()) {
+        return QByteArrayLiteral("{\"traceEvents\":[]}");
+    }
+
+    const qulonglong origin = events.first().timestamp;
+    QHash<QString, int> threads;
+    QHash<QString, qulonglong> spawnRequested;
+    QHash<QString, qulonglong> stopRequested;
+    QJsonArray traceEvents;
+
+    foreach (const TraceEvent &event, events) {
+        // One row per unit, row 0 holds the session milestones
+        int tid = 0;
+        if (!event.unit.isEmpty()) {
+            tid = threads.value(event.unit);
+            if (!tid) {
+                tid = threads.size() + 1;
+                threads.insert(event.unit, tid);
+
+                QJsonObject metadata;
+                metadata.insert(QStringLiteral("ph"), QStringLiteral("M"));
+                metadata.insert(QStringLiteral("name"), QStringLiteral("thread_name"));
+                metadata.insert(QStringLiteral("pid"), 1);
+                metadata.insert(QStringLiteral("tid"), tid);
+                metadata.insert(QStringLiteral("args"), QJsonObject{{QStringLiteral("name"), event.unit}});
+                traceEvents.append(metadata);
+            }
+        }
+
+        const double ts = double(event.timestamp - origin);
+        QJsonObject object;
+        object.insert(QStringLiteral("name"), event.detail.isEmpty() ? event.event : QString(event.event + QLatin1String(": ") + event.detail));
+        object.insert(QStringLiteral("cat"), event.unit.isEmpty() ? QStringLiteral("session") : QStringLiteral("unit"));
+        object.insert(QStringLiteral("ph"), QStringLiteral("i"));
+        object.insert(QStringLiteral("s"), tid ? QStringLiteral("t") : QStringLiteral("g"));
+        object.insert(QStringLiteral("ts"), ts);
+        object.insert(QStringLiteral("pid"), 1);
+        object.insert(QStringLiteral("tid"), tid);
+        traceEvents.append(object);
+
+        // Spans from spawn request to ready show the critical path
+        if (event.event == kindName(SpawnRequested)) {
+            spawnRequested.insert(event.unit, event.timestamp);
+        } else if (event.event == kindName(Ready) && spawnRequested.contains(event.unit)) {
+            const qulonglong start = spawnRequested.take(event.unit);
+            QJsonObject span;
+            span.insert(QStringLiteral("name"), QStringLiteral("starting"));
+            span.insert(QStringLiteral("cat"), QStringLiteral("unit"));
+            span.insert(QStringLiteral("ph"), QStringLiteral("X"));
+            span.insert(QStringLiteral("ts"), double(start - origin));
+            span.insert(QStringLiteral("dur"), double(event.timestamp - start));
+            span.insert(QStringLiteral("pid"), 1);
+            span.insert(QStringLiteral("tid"), tid);
+            traceEvents.append(span);
+        } else if (event.event == kindName(StopRequested)) {
+            stopRequested.insert(event.unit, event.timestamp);
+        } else if (event.event == kindName(Stopped) && stopRequested.contains(event.unit)) {
+            const qulonglong start = stopRequested.take(event.unit);
+            QJsonObject span;
+            span.insert(QStringLiteral("name"), QStringLiteral("stopping"));
+            span.insert(QStringLiteral("cat"), QStringLiteral("unit"));
+            span.insert(QStringLiteral("ph"), QStringLiteral("X"));
+            span.insert(QStringLiteral("ts"), double(start - origin));
+            span.insert(QStringLiteral("dur"), double(event.timestamp - start));
+            span.insert(QStringLiteral("pid"), 1);
+            span.insert(QStringLiteral("tid"), tid);
+            traceEvents.append(span);
+        }
+    }
+
+    QJsonObject root;
+    root.insert(QStringLiteral("traceEvents"), traceEvents);
+    root.insert(QStringLiteral("displayTimeUnit"), QStringLiteral("ms"));
+    return QJsonDocument(root).toJson(QJsonDocument::Compact);
+}
+
+bool StartupTrace::writeChromeTrace(const QString &fileName) const
+{
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Unable to write trace" << fileName << file.errorString();
+        return false;
+    }
+
+    file.write(toChromeTrace());
+    return file.commit();
+}
+
+QString StartupTrace::kindName(Kind kind)
+{
+    switch (kind) {
+    case Discovered:
+        return QStringLiteral("discovered");
+    case Parsed:
+        return QStringLiteral("parsed");
+    case DependencySatisfied:
+        return QStringLiteral("dependency-satisfied");
+    case Released:
+        return QStringLiteral("released");
+    case SpawnRequested:
+        return QStringLiteral("spawn-requested");
+    case Executed:
+        return QStringLiteral("executed");
+    case Ready:
+        return QStringLiteral("ready");
+    case Crashed:
+        return QStringLiteral("crashed");
+    case Respawned:
+        return QStringLiteral("respawned");
+    case Failed:
+        return QStringLiteral("failed");
+    case Exited:
+        return QStringLiteral("exited");
+    case Milestone:
+        return QStringLiteral("milestone");
+    case StopRequested:
+        return QStringLiteral("stop-requested");
+    case Stopped:
+        return QStringLiteral("stopped");
+    case Killed:
+        return QStringLiteral("killed");
+    }
+    return QString();
+}
+
+quint32 StartupTrace::intern(const QString &string)
+{
+    QHash<QString, quint32>::ConstIterator it = m_index.constFind(string);
+    if (it != m_index.constEnd()) {
+        return it.value();
+    }
+
+    quint32 index = m_strings.size();
+    m_strings.append(string);
+    m_index.insert(string, index);
+    return index;
+}
+
+QVector<StartupTrace::Event> StartupTrace::snapshot() const
+{
+    QMutexLocker locker(&m_mutex);
+    QVector<Event> ring;
+    if (!m_wrapped) {
+        ring = m_ring.mid(0, m_next);
+    } else {
+        ring = m_ring.mid(m_next) + m_ring.mid(0, m_next);
+    }
+
+    QVector<Event> ret(ring.size() + m_milestones.size());
+    std::merge(ring.constBegin(), ring.constEnd(),
+               m_milestones.constBegin(), m_milestones.constEnd(), ret.begin(),
+               [](const Event &a, const Event &b) {
+        return a.timestamp < b.timestamp;
+    });
+    return ret;
+}
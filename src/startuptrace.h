@@ -0,0 +1,153 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef STARTUPTRACE_H
+#define STARTUPTRACE_H
+
+#include <QString>
+#include <QVector>
+#include <QHash>
+#include <QMutex>
+#include <QMetaType>
+
+class QDBusArgument;
+
+struct TraceEvent
+{
+    qulonglong timestamp; // usecs, CLOCK_MONOTONIC
+    QString unit;
+    QString event;
+    QString detail;
+};
+typedef QList<TraceEvent> TraceEventList;
+
+QDBusArgument &operator<<(QDBusArgument &argument, const TraceEvent &event);
+const QDBusArgument &operator>>(const QDBusArgument &argument, TraceEvent &event);
+
+Q_DECLARE_METATYPE(TraceEvent)
+Q_DECLARE_METATYPE(TraceEventList)
+
+/**
+ * @brief The StartupTrace class
+ * Fixed size in memory ring of timestamped startup events,
+ * unit names and fixed details are interned and numbers are
+ * stored inline so recording an event is a mutex and a few
+ * integer stores, it can be used from any thread.
+ */
+class StartupTrace
+{
+public:
+    enum Kind {
+        Discovered,
+        Parsed,
+        DependencySatisfied,
+        Released,
+        SpawnRequested,
+        Executed,
+        Ready,
+        Crashed,
+        Respawned,
+        Failed,
+        Exited,
+        Milestone,
+        StopRequested,
+        Stopped,
+        Killed
+    };
+
+    static StartupTrace *global();
+
+    /**
+     * Monotonic clock in nsecs
+     */
+    static qint64 now();
+
+    /**
+     * The detail is interned, it must come from a bounded
+     * set (unit, service or milestone names, fixed texts)
+     */
+    void record(Kind kind, const QString &unit, const QString &detail = QString());
+    void record(qint64 timestamp, Kind kind, const QString &unit, const QString &detail = QString());
+
+    /**
+     * Pids, counters and durations are kept in the event
+     */
+    void record(Kind kind, const QString &unit, qint64 value);
+    void recordDuration(Kind kind, const QString &unit, qint64 msecs);
+    void recordError(Kind kind, const QString &unit, int error);
+
+    /**
+     * Once the startup milestones are reached discovery and
+     * parsing of unit files (hot reloads) is no longer recorded
+     * so it can't push the login out of the ring
+     */
+    void setStartupFinished();
+
+    /**
+     * Grows the ring so the startup of that many units
+     * fits, milestones are kept aside and never evicted
+     */
+    void reserve(int units);
+
+    TraceEventList events() const;
+
+    /**
+     * Chrome trace-event JSON, loadable in chrome://tracing
+     * or any compatible trace viewer
+     */
+    QByteArray toChromeTrace() const;
+    bool writeChromeTrace(const QString &fileName) const;
+
+    static QString kindName(Kind kind);
+
+private:
+    StartupTrace();
+
+    enum DetailType {
+        DetailString,
+        DetailNumber,
+        DetailDuration,
+        DetailError
+    };
+
+    struct Event {
+        qint64 timestamp;
+        qint64 value;
+        quint32 unit;
+        quint32 detail;
+        quint16 kind;
+        quint16 detailType;
+    };
+
+    void append(qint64 timestamp, Kind kind, const QString &unit,
+                DetailType detailType, quint32 detail, qint64 value);
+    quint32 intern(const QString &string);
+    QVector<Event> snapshot() const;
+
+    mutable QMutex m_mutex;
+    QVector<Event> m_ring;
+    QVector<Event> m_milestones;
+    int m_next = 0;
+    bool m_wrapped = false;
+    bool m_startupFinished = false;
+    QVector<QString> m_strings;
+    QHash<QString, quint32> m_index;
+};
+
+#endif // STARTUPTRACE_H
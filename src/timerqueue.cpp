@@ -0,0 +1,115 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "timerqueue.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+
+TimerQueue *TimerQueue::global()
+{
+    static TimerQueue *instance = new TimerQueue(qApp);
+    return instance;
+}
+
+TimerQueue::TimerQueue(QObject *parent) :
+    QObject(parent)
+{
+    m_timer.setSingleShot(true);
+    connect(&m_timer, &QTimer::timeout,
+            this, &TimerQueue::timeout);
+}
+
+qint64 TimerQueue::now()
+{
+    QElapsedTimer timer;
+    timer.start();
+    return timer.msecsSinceReference();
+}
+
+quint64 TimerQueue::start(qint64 msecs, QObject *context, const std::function<void()> &callback)
+{
+    return startAt(now() + qMax(Q_INT64_C(0), msecs), context, callback);
+}
+
+quint64 TimerQueue::startAt(qint64 deadline, QObject *context, const std::function<void()> &callback)
+{
+    Entry entry;
+    entry.id = m_nextId++;
+    entry.context = context;
+    entry.callback = callback;
+
+    m_entries.insert(deadline, entry);
+    m_deadlines.insert(entry.id, deadline);
+
+    // Only a new earliest deadline moves the timer
+    if (m_entries.constBegin().value().id == entry.id) {
+        rearm();
+    }
+    return entry.id;
+}
+
+void TimerQueue::cancel(quint64 id)
+{
+    QHash<quint64, qint64>::Iterator it = m_deadlines.find(id);
+    if (it == m_deadlines.end()) {
+        return;
+    }
+
+    QMultiMap<qint64, Entry>::Iterator entry = m_entries.find(it.value());
+    while (entry != m_entries.end() && entry.key() == it.value()) {
+        if (entry.value().id == id) {
+            m_entries.erase(entry);
+            break;
+        }
+        ++entry;
+    }
+    m_deadlines.erase(it);
+}
+
+qint64 TimerQueue::deadline(quint64 id) const
+{
+    return m_deadlines.value(id);
+}
+
+void TimerQueue::timeout()
+{
+    const qint64 current = now();
+    while (!m_entries.isEmpty() && m_entries.firstKey() <= current) {
+        Entry entry = m_entries.take(m_entries.firstKey());
+        m_deadlines.remove(entry.id);
+
+        // Callbacks may schedule or cancel entries
+        if (entry.context) {
+            entry.callback();
+        }
+    }
+    rearm();
+}
+
+void TimerQueue::rearm()
+{
+    if (m_entries.isEmpty()) {
+        m_timer.stop();
+        return;
+    }
+
+    const qint64 delay = m_entries.firstKey() - now();
+    m_timer.start(int(qBound(Q_INT64_C(0), delay, Q_INT64_C(86400000))));
+}
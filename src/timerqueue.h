@@ -0,0 +1,81 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef TIMERQUEUE_H
+#define TIMERQUEUE_H
+
+#include <QObject>
+#include <QMap>
+#include <QHash>
+#include <QPointer>
+#include <QTimer>
+
+#include <functional>
+
+/**
+ * @brief The TimerQueue class
+ * Deadlines ordered by time and served by a single QTimer,
+ * so hundreds of pending restarts or delayed starts don't
+ * mean hundreds of timers. Callbacks are dropped when their
+ * context object is deleted.
+ */
+class TimerQueue : public QObject
+{
+    Q_OBJECT
+public:
+    static TimerQueue *global();
+
+    /**
+     * Monotonic clock in msecs, the same as
+     * QElapsedTimer::msecsSinceReference()
+     */
+    static qint64 now();
+
+    /**
+     * Calls \p callback in \p msecs, returns an id for cancel()
+     */
+    quint64 start(qint64 msecs, QObject *context, const std::function<void()> &callback);
+    quint64 startAt(qint64 deadline, QObject *context, const std::function<void()> &callback);
+    void cancel(quint64 id);
+
+    /**
+     * Deadline of \p id or 0 if it isn't pending
+     */
+    qint64 deadline(quint64 id) const;
+
+private Q_SLOTS:
+    void timeout();
+
+private:
+    explicit TimerQueue(QObject *parent = 0);
+    void rearm();
+
+    struct Entry {
+        quint64 id;
+        QPointer<QObject> context;
+        std::function<void()> callback;
+    };
+
+    QMultiMap<qint64, Entry> m_entries;
+    QHash<quint64, qint64> m_deadlines;
+    QTimer m_timer;
+    quint64 m_nextId = 1;
+};
+
+#endif // TIMERQUEUE_H
@@ -0,0 +1,542 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "unitcache.h"
+
+#include "startuptrace.h"
+
+#include <QSaveFile>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QStringBuilder>
+#include <QDir>
+#include <QFileInfo>
+#include <QDebug>
+
+#include <sys/stat.h>
+#include <string.h>
+
+namespace {
+
+const char CacheMagic[8] = { 'L', 'M', 'U', 'N', 'I', 'T', 'S', '\0' };
+const quint32 CacheVersion = 7;
+
+// On disk layout, all in host byte order:
+// header | directories | entries | list items | strings | string data
+struct CacheHeader {
+    char magic[8];
+    quint32 version;
+    quint32 session;
+    quint32 directoryCount;
+    quint32 entryCount;
+    quint32 listCount;
+    quint32 stringCount;
+    quint64 dataSize;
+};
+
+struct CacheDirectory {
+    qint64 mtime;
+    quint32 path;
+    quint32 padding;
+};
+
+struct CacheList {
+    quint32 first;
+    quint32 count;
+};
+
+struct CacheEntry {
+    quint64 inode;
+    qint64 mtime;
+    qint64 size;
+    qint64 memoryMax;
+    qint64 memoryHigh;
+    quint32 directory;
+    quint32 fileName;
+    quint32 exec;
+    quint32 dbusExec;
+    quint32 dbusName;
+    quint8 type;
+    quint8 readyNotify;
+    quint8 showInSession;
+    quint8 enabled;
+    quint32 idleTimeout;
+    quint32 restartSec;
+    quint32 startLimitBurst;
+    quint32 startLimitInterval;
+    quint32 startDelay;
+    quint8 restart;
+    quint8 launcher;
+    quint8 startClass;
+    quint8 padding;
+    CacheList argv;
+    CacheList dbusSessionRequires;
+    CacheList dbusSystemRequires;
+    CacheList after;
+    CacheList requires;
+    CacheList environment;
+};
+
+struct CacheString {
+    quint32 offset;
+    quint32 size;
+};
+
+class CacheWriter
+{
+public:
+    quint32 string(const QString &value) {
+        QHash<QString, quint32>::ConstIterator it = m_index.constFind(value);
+        if (it != m_index.constEnd()) {
+            return it.value();
+        }
+
+        QByteArray utf8 = value.toUtf8();
+        CacheString entry;
+        entry.offset = m_data.size();
+        entry.size = utf8.size();
+        m_data.append(utf8);
+
+        quint32 index = m_strings.size();
+        m_strings.append(entry);
+        m_index.insert(value, index);
+        return index;
+    }
+
+    CacheList list(const QStringList &values) {
+        CacheList ret;
+        ret.first = m_listItems.size();
+        ret.count = values.size();
+        foreach (const QString &value, values) {
+            m_listItems.append(string(value));
+        }
+        return ret;
+    }
+
+    QHash<QString, quint32> m_index;
+    QVector<CacheString> m_strings;
+    QVector<quint32> m_listItems;
+    QByteArray m_data;
+};
+
+}
+
+UnitCache::UnitCache(const QString &sessionName) :
+    m_session(sessionName)
+{
+    QString cacheHome = QFile::decodeName(qgetenv("XDG_CACHE_HOME"));
+    if (cacheHome.isEmpty()) {
+        cacheHome = QDir::homePath() % QLatin1String("/.cache");
+    }
+    m_file.setFileName(cacheHome % QLatin1String("/lemuri-session/") % sessionName % QLatin1String(".units"));
+
+    if (!map()) {
+        m_directories.clear();
+        m_strings.clear();
+    }
+}
+
+UnitCache::~UnitCache()
+{
+    if (m_data) {
+        m_file.unmap(const_cast<uchar *>(m_data));
+    }
+}
+
+QList<UnitInfo> UnitCache::units(const QStringList &directories)
+{
+    QVector<Scan> scans;
+    foreach (const QString &path, directories) {
+        Scan scan = scanDirectory(path);
+        for (int i = 0; i < scan.entries.size(); ++i) {
+            Entry &entry = scan.entries[i];
+            if (entry.stale) {
+                entry.info = UnitInfo::parse(entry.info.filePath, m_session);
+            }
+        }
+        scans.append(scan);
+    }
+
+    return merge(scans);
+}
+
+UnitCache::Scan UnitCache::scanDirectory(const QString &path) const
+{
+    Scan scan;
+    scan.path = path;
+
+    // What the last load() returned has precedence over the
+    // mapped file, which is only as new as the previous session
+    QHash<QString, Loaded>::ConstIterator loaded = m_loaded.constFind(path);
+    const bool hasLoaded = loaded != m_loaded.constEnd();
+
+    Stamp directoryStamp;
+    if (!fileStamp(path, &directoryStamp)) {
+        scan.dirty = hasLoaded ? loaded.value().exists : m_directories.contains(path);
+        return scan;
+    }
+    scan.exists = true;
+    scan.mtime = directoryStamp.mtime;
+
+    QHash<QString, Directory>::ConstIterator cached = m_directories.constFind(path);
+    QStringList fileNames;
+    if (hasLoaded && loaded.value().exists && loaded.value().mtime == directoryStamp.mtime) {
+        fileNames = loaded.value().fileNames;
+    } else if (!hasLoaded && cached != m_directories.constEnd() &&
+               cached.value().mtime == directoryStamp.mtime) {
+        // Nothing was added, removed or renamed here
+        fileNames = cached.value().fileNames;
+    } else {
+        scan.dirty = true;
+        fileNames = QDir(path).entryList(QDir::Files, QDir::Name);
+    }
+
+    StartupTrace *trace = StartupTrace::global();
+    foreach (const QString &fileName, fileNames) {
+        trace->record(StartupTrace::Discovered, fileName, path);
+        Entry entry;
+        const QString filePath = path % QLatin1Char('/') % fileName;
+        if (!fileStamp(filePath, &entry.stamp)) {
+            scan.dirty = true;
+            continue;
+        }
+
+        bool found = false;
+        if (hasLoaded) {
+            QHash<QString, Entry>::ConstIterator it = loaded.value().entries.constFind(fileName);
+            if (it != loaded.value().entries.constEnd() && it.value().stamp == entry.stamp) {
+                entry.info = it.value().info;
+                found = true;
+            }
+        } else if (cached != m_directories.constEnd()) {
+            int index = cached.value().entries.value(fileName, -1);
+            if (index != -1) {
+                const CacheEntry *record = static_cast<const CacheEntry *>(m_entries) + index;
+                Stamp cachedStamp;
+                cachedStamp.inode = record->inode;
+                cachedStamp.mtime = record->mtime;
+                cachedStamp.size = record->size;
+                if (cachedStamp == entry.stamp) {
+                    entry.info = entryInfo(index);
+                    trace->record(StartupTrace::Parsed, fileName, QStringLiteral("cache"));
+                    found = true;
+                }
+            }
+        }
+
+        if (!found) {
+            entry.stale = true;
+            entry.info.fileName = fileName;
+            scan.dirty = true;
+        }
+        entry.info.filePath = filePath;
+
+        scan.entries.append(entry);
+    }
+
+    return scan;
+}
+
+QList<UnitInfo> UnitCache::merge(const QVector<Scan> &scans, bool writeInBackground)
+{
+    QList<UnitInfo> ret;
+    int found = 0;
+    bool dirty = m_loaded.isEmpty() && !m_data;
+    foreach (const Scan &scan, scans) {
+        dirty |= scan.dirty;
+        if (scan.exists) {
+            ++found;
+        }
+
+        foreach (const Entry &entry, scan.entries) {
+            ret.append(entry.info);
+        }
+    }
+
+    if (m_loaded.isEmpty() && found != m_directories.size()) {
+        dirty = true;
+    }
+
+    m_loaded.clear();
+    foreach (const Scan &scan, scans) {
+        Loaded &loaded = m_loaded[scan.path];
+        loaded.exists = scan.exists;
+        loaded.mtime = scan.mtime;
+        foreach (const Entry &entry, scan.entries) {
+            loaded.fileNames.append(entry.info.fileName);
+            loaded.entries.insert(entry.info.fileName, entry);
+        }
+    }
+
+    if (dirty) {
+        if (writeInBackground) {
+            QtConcurrent::run(&UnitCache::write, m_file.fileName(), m_session, scans);
+        } else {
+            write(m_file.fileName(), m_session, scans);
+        }
+    }
+
+    return ret;
+}
+
+QString UnitCache::fileName() const
+{
+    return m_file.fileName();
+}
+
+QString UnitCache::session() const
+{
+    return m_session;
+}
+
+bool UnitCache::fileStamp(const QString &path, Stamp *stamp)
+{
+    struct stat st;
+    if (stat(QFile::encodeName(path).constData(), &st) != 0) {
+        return false;
+    }
+
+    stamp->inode = st.st_ino;
+    stamp->mtime = qint64(st.st_mtim.tv_sec) * Q_INT64_C(1000000000) + st.st_mtim.tv_nsec;
+    stamp->size = st.st_size;
+    return true;
+}
+
+bool UnitCache::map()
+{
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    m_size = m_file.size();
+    if (m_size < qint64(sizeof(CacheHeader))) {
+        return false;
+    }
+
+    m_data = m_file.map(0, m_size);
+    m_file.close();
+    if (!m_data) {
+        return false;
+    }
+
+    const CacheHeader *header = reinterpret_cast<const CacheHeader *>(m_data);
+    if (memcmp(header->magic, CacheMagic, sizeof(CacheMagic)) != 0 ||
+            header->version != CacheVersion) {
+        qDebug() << "Ignoring unit cache with a different version" << m_file.fileName();
+        return false;
+    }
+
+    const quint64 directoriesOffset = sizeof(CacheHeader);
+    const quint64 entriesOffset = directoriesOffset + quint64(header->directoryCount) * sizeof(CacheDirectory);
+    const quint64 listOffset = entriesOffset + quint64(header->entryCount) * sizeof(CacheEntry);
+    const quint64 stringsOffset = listOffset + quint64(header->listCount) * sizeof(quint32);
+    const quint64 dataOffset = stringsOffset + quint64(header->stringCount) * sizeof(CacheString);
+    if (dataOffset + header->dataSize != quint64(m_size)) {
+        qWarning() << "Unit cache is truncated" << m_file.fileName();
+        return false;
+    }
+
+    const CacheString *strings = reinterpret_cast<const CacheString *>(m_data + stringsOffset);
+    const char *data = reinterpret_cast<const char *>(m_data + dataOffset);
+    m_strings.reserve(header->stringCount);
+    for (quint32 i = 0; i < header->stringCount; ++i) {
+        if (quint64(strings[i].offset) + strings[i].size > header->dataSize) {
+            return false;
+        }
+        m_strings.append(QString::fromUtf8(data + strings[i].offset, strings[i].size));
+    }
+
+    if (header->session >= header->stringCount || m_strings.at(header->session) != m_session) {
+        return false;
+    }
+
+    m_listItems = reinterpret_cast<const quint32 *>(m_data + listOffset);
+    m_listCount = header->listCount;
+    for (quint32 i = 0; i < m_listCount; ++i) {
+        if (m_listItems[i] >= header->stringCount) {
+            return false;
+        }
+    }
+
+    const CacheDirectory *directories = reinterpret_cast<const CacheDirectory *>(m_data + directoriesOffset);
+    QVector<QString> directoryPaths;
+    for (quint32 i = 0; i < header->directoryCount; ++i) {
+        if (directories[i].path >= header->stringCount) {
+            return false;
+        }
+        const QString &path = m_strings.at(directories[i].path);
+        m_directories[path].mtime = directories[i].mtime;
+        directoryPaths.append(path);
+    }
+
+    const CacheEntry *entries = reinterpret_cast<const CacheEntry *>(m_data + entriesOffset);
+    for (quint32 i = 0; i < header->entryCount; ++i) {
+        const CacheEntry &entry = entries[i];
+        const CacheList *lists[] = { &entry.argv, &entry.dbusSessionRequires,
+                                     &entry.dbusSystemRequires, &entry.after, &entry.requires,
+                                     &entry.environment };
+        for (const CacheList *list : lists) {
+            if (quint64(list->first) + list->count > m_listCount) {
+                return false;
+            }
+        }
+        if (entry.directory >= header->directoryCount ||
+                entry.fileName >= header->stringCount ||
+                entry.exec >= header->stringCount ||
+                entry.dbusExec >= header->stringCount ||
+                entry.dbusName >= header->stringCount) {
+            return false;
+        }
+
+        Directory &directory = m_directories[directoryPaths.at(entry.directory)];
+        const QString &fileName = m_strings.at(entry.fileName);
+        directory.fileNames.append(fileName);
+        directory.entries.insert(fileName, i);
+    }
+    m_entries = entries;
+
+    return true;
+}
+
+UnitInfo UnitCache::entryInfo(int index) const
+{
+    const CacheEntry &entry = static_cast<const CacheEntry *>(m_entries)[index];
+
+    UnitInfo info;
+    info.fileName = m_strings.at(entry.fileName);
+    info.exec = m_strings.at(entry.exec);
+    info.argv = list(entry.argv.first, entry.argv.count);
+    info.dbusExec = m_strings.at(entry.dbusExec);
+    info.dbusName = m_strings.at(entry.dbusName);
+    info.dbusSessionRequires = list(entry.dbusSessionRequires.first, entry.dbusSessionRequires.count);
+    info.dbusSystemRequires = list(entry.dbusSystemRequires.first, entry.dbusSystemRequires.count);
+    info.after = list(entry.after.first, entry.after.count);
+    info.requires = list(entry.requires.first, entry.requires.count);
+    info.environment = list(entry.environment.first, entry.environment.count);
+    info.type = entry.type;
+    info.readyNotify = entry.readyNotify;
+    info.showInSession = entry.showInSession;
+    info.enabled = entry.enabled;
+    info.launcher = entry.launcher;
+    info.idleTimeout = entry.idleTimeout;
+    info.restart = entry.restart;
+    info.memoryMax = entry.memoryMax;
+    info.memoryHigh = entry.memoryHigh;
+    info.restartSec = entry.restartSec;
+    info.startLimitBurst = entry.startLimitBurst;
+    info.startLimitInterval = entry.startLimitInterval;
+    info.startClass = entry.startClass;
+    info.startDelay = entry.startDelay;
+    return info;
+}
+
+QStringList UnitCache::list(quint32 first, quint32 count) const
+{
+    QStringList ret;
+    ret.reserve(count);
+    for (quint32 i = first; i < first + count; ++i) {
+        ret.append(m_strings.at(m_listItems[i]));
+    }
+    return ret;
+}
+
+void UnitCache::write(const QString &fileName, const QString &session, const QVector<Scan> &scans)
+{
+    CacheWriter writer;
+
+    CacheHeader header;
+    memcpy(header.magic, CacheMagic, sizeof(CacheMagic));
+    header.version = CacheVersion;
+    header.session = writer.string(session);
+
+    QVector<CacheDirectory> cacheDirectories;
+    QVector<CacheEntry> cacheEntries;
+    foreach (const Scan &scan, scans) {
+        if (!scan.exists) {
+            continue;
+        }
+
+        CacheDirectory directory;
+        directory.mtime = scan.mtime;
+        directory.path = writer.string(scan.path);
+        directory.padding = 0;
+
+        foreach (const Entry &entry, scan.entries) {
+            CacheEntry record;
+            memset(&record, 0, sizeof(record));
+            record.inode = entry.stamp.inode;
+            record.mtime = entry.stamp.mtime;
+            record.size = entry.stamp.size;
+            record.directory = cacheDirectories.size();
+            record.fileName = writer.string(entry.info.fileName);
+            record.exec = writer.string(entry.info.exec);
+            record.dbusExec = writer.string(entry.info.dbusExec);
+            record.dbusName = writer.string(entry.info.dbusName);
+            record.type = entry.info.type;
+            record.readyNotify = entry.info.readyNotify;
+            record.showInSession = entry.info.showInSession;
+            record.enabled = entry.info.enabled;
+            record.launcher = entry.info.launcher;
+            record.idleTimeout = entry.info.idleTimeout;
+            record.restart = entry.info.restart;
+            record.memoryMax = entry.info.memoryMax;
+            record.memoryHigh = entry.info.memoryHigh;
+            record.restartSec = entry.info.restartSec;
+            record.startLimitBurst = entry.info.startLimitBurst;
+            record.startLimitInterval = entry.info.startLimitInterval;
+            record.startClass = entry.info.startClass;
+            record.startDelay = entry.info.startDelay;
+            record.argv = writer.list(entry.info.argv);
+            record.dbusSessionRequires = writer.list(entry.info.dbusSessionRequires);
+            record.dbusSystemRequires = writer.list(entry.info.dbusSystemRequires);
+            record.after = writer.list(entry.info.after);
+            record.requires = writer.list(entry.info.requires);
+            record.environment = writer.list(entry.info.environment);
+            cacheEntries.append(record);
+        }
+
+        cacheDirectories.append(directory);
+    }
+
+    header.directoryCount = cacheDirectories.size();
+    header.entryCount = cacheEntries.size();
+    header.listCount = writer.m_listItems.size();
+    header.stringCount = writer.m_strings.size();
+    header.dataSize = writer.m_data.size();
+
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Unable to write unit cache" << file.fileName() << file.errorString();
+        return;
+    }
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(cacheDirectories.constData()),
+               cacheDirectories.size() * sizeof(CacheDirectory));
+    file.write(reinterpret_cast<const char *>(cacheEntries.constData()),
+               cacheEntries.size() * sizeof(CacheEntry));
+    file.write(reinterpret_cast<const char *>(writer.m_listItems.constData()),
+               writer.m_listItems.size() * sizeof(quint32));
+    file.write(reinterpret_cast<const char *>(writer.m_strings.constData()),
+               writer.m_strings.size() * sizeof(CacheString));
+    file.write(writer.m_data);
+    if (!file.commit()) {
+        qWarning() << "Unable to write unit cache" << file.fileName() << file.errorString();
+    }
+}
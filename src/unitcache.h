@@ -0,0 +1,129 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef UNITCACHE_H
+#define UNITCACHE_H
+
+#include <QFile>
+#include <QHash>
+#include <QVector>
+
+#include "unitinfo.h"
+
+/**
+ * @brief The UnitCache class
+ * A compiled, mmap()ed copy of the parsed unit files
+ * of a session, keyed by the directories mtime and
+ * by each file inode, mtime and size.
+ *
+ * On a warm start loading the units is just a stat()
+ * per directory and file, only files that changed
+ * since the cache was written are parsed again.
+ */
+class UnitCache
+{
+public:
+    explicit UnitCache(const QString &sessionName);
+    ~UnitCache();
+
+    struct Stamp {
+        quint64 inode = 0;
+        qint64 mtime = 0;
+        qint64 size = 0;
+
+        bool operator==(const Stamp &other) const {
+            return inode == other.inode && mtime == other.mtime && size == other.size;
+        }
+    };
+
+    struct Entry {
+        Stamp stamp;
+        UnitInfo info;
+        bool stale = false;
+    };
+
+    struct Scan {
+        QString path;
+        bool exists = false;
+        bool dirty = false;
+        qint64 mtime = 0;
+        QVector<Entry> entries;
+    };
+
+    /**
+     * Returns every unit found in \p directories, in directory order,
+     * including the ones not valid for this session so the caller
+     * can apply the override rules. The cache file is rewritten
+     * when anything changed.
+     */
+    QList<UnitInfo> units(const QStringList &directories);
+
+    /**
+     * Lists \p path and fills every entry whose file didn't change
+     * from the last merge() or the mapped cache, the ones that need
+     * parsing are marked stale. This only reads so it can run on
+     * any thread, as long as no merge() runs at the same time.
+     */
+    Scan scanDirectory(const QString &path) const;
+
+    /**
+     * Flattens the scans, in order, once the stale entries were
+     * parsed and writes the cache file back if anything changed.
+     * The result is kept in memory so reloading only parses
+     * the files that changed since.
+     */
+    QList<UnitInfo> merge(const QVector<Scan> &scans, bool writeInBackground = false);
+
+    QString fileName() const;
+    QString session() const;
+
+    static bool fileStamp(const QString &path, Stamp *stamp);
+
+private:
+    struct Directory {
+        qint64 mtime = 0;
+        QStringList fileNames;
+        QHash<QString, int> entries;
+    };
+
+    struct Loaded {
+        bool exists = false;
+        qint64 mtime = 0;
+        QStringList fileNames;
+        QHash<QString, Entry> entries;
+    };
+
+    bool map();
+    UnitInfo entryInfo(int index) const;
+    QStringList list(quint32 first, quint32 count) const;
+    static void write(const QString &fileName, const QString &session, const QVector<Scan> &scans);
+
+    QString m_session;
+    QFile m_file;
+    const uchar *m_data = 0;
+    qint64 m_size = 0;
+    const void *m_entries = 0;
+    const quint32 *m_listItems = 0;
+    quint32 m_listCount = 0;
+    QVector<QString> m_strings;
+    QHash<QString, Directory> m_directories;
+    QHash<QString, Loaded> m_loaded;
+};
+
+#endif // UNITCACHE_H
@@ -0,0 +1,224 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "unitinfo.h"
+
+#include "unitlauncher.h"
+#include "startuptrace.h"
+#include "cgroupmanager.h"
+
+#include <QSettings>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QDebug>
+
+// Delay of StartClass=delayed units without StartDelaySec
+#define DEFAULT_START_DELAY 10000
+
+UnitInfo UnitInfo::parse(const QString &filePath, const QString &session)
+{
+    UnitInfo info;
+    QFileInfo fileInfo(filePath);
+    info.fileName = fileInfo.fileName();
+    info.filePath = filePath;
+
+    QSettings settings(filePath, QSettings::IniFormat);
+    settings.beginGroup(QLatin1String("Desktop Entry"));
+
+    QString dbusSessionRequires = settings.value(QLatin1String("DBusSessionRequires")).toString().trimmed();
+    if (!dbusSessionRequires.isEmpty()) {
+        info.dbusSessionRequires = dbusSessionRequires.split(QLatin1String(" "), QString::SkipEmptyParts);
+    }
+
+    QString dbusSystemRequires = settings.value(QLatin1String("DBusSystemRequires")).toString().trimmed();
+    if (!dbusSystemRequires.isEmpty()) {
+        info.dbusSystemRequires = dbusSystemRequires.split(QLatin1String(" "), QString::SkipEmptyParts);
+    }
+
+    QString onlyShowIn = settings.value(QLatin1String("OnlyShowIn")).toString().trimmed();
+    if (!onlyShowIn.isEmpty()) {
+        info.showInSession = onlyShowIn.split(QLatin1String(";"), QString::SkipEmptyParts)
+                .contains(session, Qt::CaseInsensitive);
+    }
+
+    QRegularExpression listSeparator(QLatin1String("[\\s;]+"));
+    info.after = settings.value(QLatin1String("After")).toString().split(listSeparator, QString::SkipEmptyParts);
+    info.requires = settings.value(QLatin1String("Requires")).toString().split(listSeparator, QString::SkipEmptyParts);
+
+    // QSettings splits values on commas, join them back
+    const QString environment = settings.value(QLatin1String("Environment")).toStringList().join(QLatin1Char(','));
+    foreach (const QString &variable, environment.split(QRegularExpression(QLatin1String("\\s+")), QString::SkipEmptyParts)) {
+        if (variable.indexOf(QLatin1Char('=')) > 0) {
+            info.environment.append(variable);
+        } else {
+            qWarning() << filePath << "ignoring invalid Environment entry" << variable;
+        }
+    }
+
+    info.exec = settings.value(QLatin1String("Exec")).toString().trimmed();
+    info.argv = splitExec(info.exec);
+    info.dbusExec = settings.value(QLatin1String("DBusExec")).toString().trimmed();
+    info.dbusName = settings.value(QLatin1String("DBusName")).toString().trimmed();
+
+    QString readyNotify = settings.value(QLatin1String("ReadyNotify")).toString().trimmed();
+    if (readyNotify.compare(QLatin1String("notify"), Qt::CaseInsensitive) == 0) {
+        info.readyNotify = UnitLauncher::ReadyOnNotify;
+    } else if (readyNotify.compare(QLatin1String("dbus"), Qt::CaseInsensitive) == 0 ||
+               (readyNotify.isEmpty() && !info.dbusName.isEmpty())) {
+        info.readyNotify = UnitLauncher::ReadyOnDBusName;
+    } else {
+        info.readyNotify = UnitLauncher::ReadyOnExec;
+    }
+
+    if (info.readyNotify == UnitLauncher::ReadyOnDBusName && info.dbusName.isEmpty()) {
+        qWarning() << filePath << "ReadyNotify=dbus without DBusName, using exec";
+        info.readyNotify = UnitLauncher::ReadyOnExec;
+    }
+
+    if (!info.dbusExec.isEmpty() && info.dbusName.isEmpty()) {
+        qWarning() << filePath << "DBusExec without DBusName, it will be started at login";
+    }
+    info.idleTimeout = qMax(0, settings.value(QLatin1String("IdleTimeout")).toInt());
+
+    info.memoryMax = CGroupManager::parseSize(settings.value(QLatin1String("MemoryMax")).toString());
+    info.memoryHigh = CGroupManager::parseSize(settings.value(QLatin1String("MemoryHigh")).toString());
+
+    QString restart = settings.value(QLatin1String("Restart")).toString().trimmed();
+    if (restart == QLatin1String("no")) {
+        info.restart = UnitLauncher::RestartNo;
+    } else if (restart == QLatin1String("on-failure")) {
+        info.restart = UnitLauncher::RestartOnFailure;
+    } else if (restart == QLatin1String("always")) {
+        info.restart = UnitLauncher::RestartAlways;
+    } else {
+        if (!restart.isEmpty() && restart != QLatin1String("on-crash")) {
+            qWarning() << filePath << "unknown Restart value" << restart;
+        }
+        info.restart = UnitLauncher::RestartOnCrash;
+    }
+
+    bool ok;
+    double restartSec = settings.value(QLatin1String("RestartSec")).toDouble(&ok);
+    if (ok && restartSec >= 0) {
+        info.restartSec = int(restartSec * 1000);
+    }
+    int startLimitBurst = settings.value(QLatin1String("StartLimitBurst")).toInt(&ok);
+    if (ok && startLimitBurst >= 0) {
+        info.startLimitBurst = startLimitBurst;
+    }
+    double startLimitInterval = settings.value(QLatin1String("StartLimitIntervalSec")).toDouble(&ok);
+    if (ok && startLimitInterval >= 0) {
+        info.startLimitInterval = int(startLimitInterval * 1000);
+    }
+
+    info.enabled = settings.value(QLatin1String("Enabled")).toBool();
+    info.launcher = settings.value(QLatin1String("Launcher")).toBool();
+
+    // Our own keys win over the vendor ones
+    double startDelay = settings.value(QLatin1String("StartDelaySec")).toDouble(&ok);
+    const bool hasStartDelay = ok && startDelay > 0;
+    const QString startClass = settings.value(QLatin1String("StartClass")).toString().trimmed();
+    const QString gnomePhase = settings.value(QLatin1String("X-GNOME-Autostart-Phase")).toString().trimmed();
+    const int gnomeDelay = settings.value(QLatin1String("X-GNOME-Autostart-Delay")).toInt();
+    const int kdePhase = settings.value(QLatin1String("X-KDE-autostart-phase"), 1).toInt();
+    if (startClass == QLatin1String("delayed")) {
+        info.startClass = UnitLauncher::StartDelayed;
+        info.startDelay = hasStartDelay ? int(startDelay * 1000) : DEFAULT_START_DELAY;
+    } else if (startClass == QLatin1String("idle")) {
+        info.startClass = UnitLauncher::StartOnIdle;
+    } else if (!startClass.isEmpty()) {
+        if (startClass != QLatin1String("immediate")) {
+            qWarning() << filePath << "unknown StartClass value" << startClass;
+        }
+    } else if (!gnomePhase.isEmpty() && gnomePhase != QLatin1String("Applications")) {
+        // Earlier phases are part of the desktop itself
+    } else if (hasStartDelay || gnomeDelay > 0) {
+        info.startClass = UnitLauncher::StartDelayed;
+        info.startDelay = hasStartDelay ? int(startDelay * 1000) : gnomeDelay * 1000;
+    } else if (kdePhase >= 2) {
+        // Started by KDE once everything else is up
+        info.startClass = UnitLauncher::StartOnIdle;
+    }
+
+    QString type = settings.value(QLatin1String("Type")).toString().trimmed();
+    if (type == QLatin1String("Application")) {
+        info.type = UnitLauncher::Application;
+    } else if (type == QLatin1String("Service")) {
+        info.type = UnitLauncher::Service;
+    } else if (type == QLatin1String("Shell")) {
+        info.type = UnitLauncher::Shell;
+    } else {
+        info.type = UnitLauncher::Unknown;
+    }
+
+    StartupTrace::global()->record(StartupTrace::Parsed, info.fileName, filePath);
+
+    return info;
+}
+
+QStringList UnitInfo::splitExec(const QString &exec)
+{
+    QStringList ret;
+    QString current;
+    bool quoted = false;
+    bool hasArg = false;
+
+    for (int i = 0; i < exec.size(); ++i) {
+        const QChar c = exec.at(i);
+        if (quoted) {
+            if (c == QLatin1Char('\\') && i + 1 < exec.size()) {
+                current.append(exec.at(++i));
+            } else if (c == QLatin1Char('"')) {
+                quoted = false;
+            } else {
+                current.append(c);
+            }
+        } else if (c == QLatin1Char('"')) {
+            quoted = true;
+            hasArg = true;
+        } else if (c.isSpace()) {
+            if (hasArg) {
+                ret.append(current);
+                current.clear();
+                hasArg = false;
+            }
+        } else if (c == QLatin1Char('%') && i + 1 < exec.size()) {
+            // Field codes make no sense for units, only keep %%
+            const QChar code = exec.at(++i);
+            if (code == QLatin1Char('%')) {
+                current.append(code);
+                hasArg = true;
+            }
+        } else {
+            current.append(c);
+            hasArg = true;
+        }
+    }
+
+    if (hasArg) {
+        ret.append(current);
+    }
+
+    return ret;
+}
+
+bool UnitInfo::isValid() const
+{
+    return showInSession && type != UnitLauncher::Unknown;
+}
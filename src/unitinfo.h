@@ -0,0 +1,76 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef UNITINFO_H
+#define UNITINFO_H
+
+#include <QString>
+#include <QStringList>
+
+/**
+ * @brief The UnitInfo class
+ * Plain description of a unit file, everything a
+ * UnitLauncher needs already split and resolved for
+ * the session so it can be stored in the UnitCache.
+ */
+class UnitInfo
+{
+public:
+    /**
+     * Parses the Desktop Entry group of \p filePath,
+     * OnlyShowIn is resolved against \p session
+     */
+    static UnitInfo parse(const QString &filePath, const QString &session);
+
+    /**
+     * Splits an Exec value into argv following the
+     * Desktop Entry quoting rules, field codes are dropped
+     */
+    static QStringList splitExec(const QString &exec);
+
+    bool isValid() const;
+
+    QString fileName;
+    QString filePath;
+    QString exec;
+    QStringList argv;
+    QString dbusExec;
+    QString dbusName;
+    QStringList dbusSessionRequires;
+    QStringList dbusSystemRequires;
+    QStringList after;
+    QStringList requires;
+    QStringList environment; // NAME=VALUE
+    int type = 0;            // UnitLauncher::Type
+    int readyNotify = 0;     // UnitLauncher::ReadyNotify
+    int idleTimeout = 0;     // secs, DBusExec units only
+    int restart = 2;         // UnitLauncher::RestartPolicy, on-crash
+    int restartSec = 100;    // msecs, doubled on every restart
+    int startLimitBurst = 5;
+    int startLimitInterval = 10000; // msecs
+    int startClass = 0;      // UnitLauncher::StartClass
+    int startDelay = 0;      // msecs after the shell is up
+    qint64 memoryMax = -1;   // bytes, -1 when unset
+    qint64 memoryHigh = -1;
+    bool showInSession = true;
+    bool enabled = false;
+    bool launcher = false;   // forked by lemuri-session-launcher
+};
+
+#endif // UNITINFO_H
@@ -19,74 +19,69 @@
 
 #include "unitlauncher.h"
 
-#include "unitadaptor.h"
+#include "unitobjecttree.h"
+#include "unitprocess.h"
+#include "childsupervisor.h"
+#include "startuptrace.h"
+#include "dbusactivator.h"
+#include "restartscheduler.h"
+#include "timerqueue.h"
+#include "cgroupmanager.h"
+#include "unitoutput.h"
+#include "sessionenvironment.h"
 
-#include <QProcess>
 #include <QDBusConnection>
-#include <QDBusServiceWatcher>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QStringBuilder>
 #include <QRegularExpression>
+#include <QTimer>
+#include <QFile>
 
-UnitLauncher::UnitLauncher(const QString &filename, const QString &session, QObject *parent) :
-    QObject(parent),
-    m_settings(filename, QSettings::IniFormat),
-    m_session(session)
-{
-    m_settings.beginGroup(QLatin1String("Desktop Entry"));
-
-    QString dbusSessionRequires = m_settings.value(QLatin1String("DBusSessionRequires")).toString().trimmed();
-    if (!dbusSessionRequires.isEmpty()) {
-        m_dbusSessionRequires = dbusSessionRequires.split(QLatin1String(" "));
-    }
-
-    QString dbusSystemRequires = m_settings.value(QLatin1String("DBusSystemRequires")).toString().trimmed();
-    if (!dbusSystemRequires.isEmpty()) {
-        m_dbusSystemRequires = dbusSystemRequires.split(QLatin1String(" "));
-    }
-
-    QString onlyShowIn = m_settings.value(QLatin1String("OnlyShowIn")).toString().trimmed();
-    if (!onlyShowIn.isEmpty()) {
-        m_onlyShowIn = onlyShowIn.split(QLatin1String(";"));
-    }
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
 
-    m_exec = m_settings.value(QLatin1String("Exec")).toString().trimmed();
-    m_dbusExec = m_settings.value(QLatin1String("DBusExec")).toString().trimmed();
-    m_enabled = m_settings.value(QLatin1String("Enabled")).toBool();
+// Backoff never grows past this
+#define RESTART_MAX_DELAY 60000
 
-    QString type = m_settings.value(QLatin1String("Type")).toString().trimmed();
-    if (type == QLatin1String("Application")) {
-        m_type = Application;
-    } else if (type == QLatin1String("Service")) {
-        m_type = Service;
-    } else if (type == QLatin1String("Shell")) {
-        m_type = Shell;
-    } else {
-        m_type = Unknown;
-    }
+// A unit not ready by then fails, so it can't hold
+// its dependents and milestone back for the session
+#define READY_TIMEOUT 10000
 
-    if (m_dbusExec.isEmpty()) {
-        m_process = new QProcess(this);
-        setupProcess(m_process);
-    }
+UnitLauncher::UnitLauncher(const UnitInfo &info, const QString &session, QObject *parent) :
+    QObject(parent),
+    m_session(session),
+    m_name(info.fileName),
+    m_dbusSessionRequires(info.dbusSessionRequires),
+    m_dbusSystemRequires(info.dbusSystemRequires),
+    m_after(info.after),
+    m_requires(info.requires),
+    m_exec(info.exec),
+    m_argv(info.argv),
+    m_dbusExec(info.dbusExec),
+    m_dbusName(info.dbusName),
+    m_readyNotify(static_cast<ReadyNotify>(info.readyNotify)),
+    m_type(static_cast<Type>(info.type)),
+    m_valid(info.isValid()),
+    m_enabled(info.enabled),
+    m_idleTimeout(info.idleTimeout),
+    m_memoryMax(info.memoryMax),
+    m_memoryHigh(info.memoryHigh)
+{
+    updatePolicy(info);
 
-    QDBusServiceWatcher *sessionWatcher = new QDBusServiceWatcher(this);
-    sessionWatcher->setConnection(QDBusConnection::sessionBus());
-    sessionWatcher->setWatchMode(QDBusServiceWatcher::WatchForOwnerChange);
-    connect(sessionWatcher, &QDBusServiceWatcher::serviceOwnerChanged,
-            this, &UnitLauncher::sessionServiceOwnerChanged);
-    foreach (const QString &service, m_dbusSessionRequires) {
-        sessionWatcher->addWatchedService(service);
+    if (!m_dbusExec.isEmpty()) {
+        // DBusExec is what gets spawned, on demand when there is a DBusName
+        m_argv = UnitInfo::splitExec(m_dbusExec);
     }
 
-    QDBusServiceWatcher *systemWatcher = new QDBusServiceWatcher(this);
-    systemWatcher->setConnection(QDBusConnection::systemBus());
-    systemWatcher->setWatchMode(QDBusServiceWatcher::WatchForOwnerChange);
-    connect(systemWatcher, &QDBusServiceWatcher::serviceOwnerChanged,
-            this, &UnitLauncher::systemServiceOwnerChanged);
-    foreach (const QString &service, m_dbusSystemRequires) {
-        systemWatcher->addWatchedService(service);
-    }
+    m_dbusSessionRequires.removeDuplicates();
+    m_dbusSystemRequires.removeDuplicates();
+    // Everything is missing until the DBusNameRegistry says otherwise
+    m_missingDependencies = m_dbusSessionRequires.size() + m_dbusSystemRequires.size();
 
-    QFileInfo fileInfo(filename);
+    QFileInfo fileInfo(info.filePath);
     QString unit = fileInfo.baseName().replace(QRegularExpression("\\W"), QLatin1String("_"));
     switch (m_type) {
     case Service:
@@ -102,31 +97,49 @@ UnitLauncher::UnitLauncher(const QString &filename, const QString &session, QObj
         setObjectName("/org/lemuri/unknown_units/" % unit);
         break;
     }
-    m_name = fileInfo.fileName();
 
-    registerObject();
+    m_output = new UnitOutput(m_name, this);
+    ResourceSampler::global()->addUnit(this);
 }
 
 UnitLauncher::UnitLauncher(const QString &program, QObject *parent) :
     QObject(parent),
-    m_process(new QProcess),
     m_name(program),
     m_type(Custom),
-    m_exec(program)
+    m_exec(program),
+    m_argv(UnitInfo::splitExec(program)),
+    m_valid(!m_argv.isEmpty())
 {
     QString unit = program;
     unit = unit.replace(QRegularExpression("\\W"), QLatin1String("_"));
     setObjectName("/org/lemuri/custom_units/" % unit);
 
-    setupProcess(m_process);
-
-    registerObject();
+    m_output = new UnitOutput(m_name, this);
+    ResourceSampler::global()->addUnit(this);
 }
 
 UnitLauncher::~UnitLauncher()
 {
+    TimerQueue::global()->cancel(m_readyTimer);
+    RestartScheduler::global()->cancel(this);
+    ResourceSampler::global()->removeUnit(this);
+    UnitObjectTree::global()->removeUnit(this);
+
     if (m_process) {
-        m_process->terminate();
+        if (m_process->state() != QProcess::NotRunning) {
+            ChildSupervisor::global()->unwatch(m_process->pid());
+        }
+        delete m_process;
+    }
+
+    if (!m_cgroup.isEmpty()) {
+        // Daemons the unit forked off go with it
+        CGroupManager *cgroups = CGroupManager::global();
+        if (cgroups->isPopulated(m_cgroup)) {
+            cgroups->kill(m_cgroup);
+        }
+        close(m_cgroupFd);
+        cgroups->removeGroup(m_cgroup);
     }
 }
 
@@ -149,17 +162,171 @@ QProcess::ProcessState UnitLauncher::state() const
     }
 }
 
-bool UnitLauncher::isValid() const
+bool UnitLauncher::isReady() const
 {
-    if (!m_onlyShowIn.isEmpty() && !m_onlyShowIn.contains(m_session, Qt::CaseInsensitive)) {
-        return false;
+    return m_ready || m_activatable;
+}
+
+QString UnitLauncher::status() const
+{
+    return m_status;
+}
+
+qint64 UnitLauncher::startTimestamp() const
+{
+    return m_startTimestamp;
+}
+
+qint64 UnitLauncher::readyTimestamp() const
+{
+    return m_readyTimestamp;
+}
+
+uint UnitLauncher::restartCount() const
+{
+    return m_restarts.size();
+}
+
+qint64 UnitLauncher::nextRestart() const
+{
+    return m_nextRestart;
+}
+
+void UnitLauncher::updatePolicy(const UnitInfo &info)
+{
+    m_restartPolicy = static_cast<RestartPolicy>(info.restart);
+    m_restartSec = info.restartSec;
+    m_startLimitBurst = info.startLimitBurst;
+    m_startLimitInterval = info.startLimitInterval;
+    m_idleTimeout = info.idleTimeout;
+    m_launcher = info.launcher;
+    m_startClass = static_cast<StartClass>(info.startClass);
+    m_startDelay = info.startDelay;
+
+    QList<QByteArray> environment;
+    foreach (const QString &variable, info.environment) {
+        environment.append(variable.toLocal8Bit());
+    }
+    if (environment != m_environment) {
+        // Merged again on the next start
+        m_environment = environment;
+        m_environmentBlock.clear();
     }
 
-    if (m_type == Unknown) {
-        return false;
+    if (m_memoryMax != info.memoryMax || m_memoryHigh != info.memoryHigh) {
+        m_memoryMax = info.memoryMax;
+        m_memoryHigh = info.memoryHigh;
+        if (!m_cgroup.isEmpty()) {
+            CGroupManager::global()->setMemoryLimits(m_cgroup, m_memoryMax, m_memoryHigh);
+        }
     }
+    if (m_idleTimer) {
+        m_idleTimer->setInterval(m_idleTimeout * 1000);
+    }
+}
 
-    return true;
+qulonglong UnitLauncher::cpuTime() const
+{
+    return m_usage.cpuTime;
+}
+
+qulonglong UnitLauncher::memoryRss() const
+{
+    return m_usage.rss;
+}
+
+qulonglong UnitLauncher::memoryPss() const
+{
+    return m_usage.pss;
+}
+
+qulonglong UnitLauncher::ioRead() const
+{
+    return m_usage.ioRead;
+}
+
+qulonglong UnitLauncher::ioWrite() const
+{
+    return m_usage.ioWrite;
+}
+
+uint UnitLauncher::threads() const
+{
+    return m_usage.threads;
+}
+
+qint64 UnitLauncher::uptime() const
+{
+    if (state() == QProcess::NotRunning || !m_startTimestamp) {
+        return 0;
+    }
+    return TimerQueue::now() - m_startTimestamp;
+}
+
+ResourceUsage UnitLauncher::resourceUsage() const
+{
+    return m_usage;
+}
+
+void UnitLauncher::setResourceUsage(const ResourceUsage &usage)
+{
+    m_usage = usage;
+}
+
+QString UnitLauncher::cgroup() const
+{
+    return m_cgroup;
+}
+
+UnitOutput *UnitLauncher::output() const
+{
+    return m_output;
+}
+
+qint64 UnitLauncher::pid() const
+{
+    if (m_process) {
+        return m_process->pid();
+    }
+    return 0;
+}
+
+void UnitLauncher::notify(const QHash<QByteArray, QByteArray> &fields)
+{
+    QHash<QByteArray, QByteArray>::ConstIterator it = fields.constFind(QByteArrayLiteral("STATUS"));
+    if (it != fields.constEnd()) {
+        m_status = QString::fromUtf8(it.value());
+        emit stateChanged();
+    }
+
+    if (m_readyNotify == ReadyOnNotify && fields.value(QByteArrayLiteral("READY")) == "1") {
+        setReady();
+    }
+}
+
+bool UnitLauncher::isValid() const
+{
+    return m_valid;
+}
+
+UnitLauncher::StartClass UnitLauncher::startClass() const
+{
+    return m_startClass;
+}
+
+int UnitLauncher::startDelay() const
+{
+    return m_startDelay;
+}
+
+QStringList UnitLauncher::after() const
+{
+    return m_after;
+}
+
+QStringList UnitLauncher::requires() const
+{
+    return m_requires;
 }
 
 QString UnitLauncher::configPath(const QString &sessionName)
@@ -169,113 +336,468 @@ QString UnitLauncher::configPath(const QString &sessionName)
 
 void UnitLauncher::Stop()
 {
-    if (m_process) {
-        if (m_process->state() == QProcess::Running ||
-                m_process->state() == QProcess::Starting) {
-            m_process->terminate();
-        }
-    } else {
-        // TODO DBus launch
+    TimerQueue::global()->cancel(m_readyTimer);
+    m_readyTimer = 0;
+
+    if (m_nextRestart) {
+        RestartScheduler::global()->cancel(this);
+        m_nextRestart = 0;
+        emit stateChanged();
+    }
+
+    if (m_process && m_process->state() != QProcess::NotRunning) {
+        m_stopping = true;
+        m_process->terminate();
+    }
+
+    // Also whatever escaped the main process
+    if (!m_cgroup.isEmpty()) {
+        CGroupManager::global()->signal(m_cgroup, SIGTERM);
     }
 }
 
 void UnitLauncher::Start()
 {
-    if (m_dbusSessionRequires.size() != m_dbusSessionRequiresRunning.size() ||
-            m_dbusSystemRequires.size() != m_dbusSystemRequiresRunning.size()) {
-        // Not ready yet
-        qDebug() << "not ready" << objectName();
-        qDebug() << m_dbusSessionRequires << m_dbusSessionRequiresRunning;
-        qDebug() << m_dbusSystemRequires << m_dbusSystemRequiresRunning;
+    if (m_inhibited) {
         return;
     }
 
-    if (m_process) {
-//        m_process->setProcessEnvironment(*Environment::global());
-        qDebug() << "starting" << objectName();
-        m_process->start();
-    } else {
-        // TODO DBus launch
+    StartupTrace::global()->record(StartupTrace::SpawnRequested, m_name);
+
+    if (!m_readyTimer && !isReady()) {
+        m_readyTimer = TimerQueue::global()->start(READY_TIMEOUT, this, [this]() {
+            m_readyTimer = 0;
+            readyTimedOut();
+        });
+    }
+
+    if (m_nextRestart) {
+        // Started by hand before the backoff expired
+        RestartScheduler::global()->cancel(this);
+        m_nextRestart = 0;
+    }
+
+    if (m_missingDependencies) {
+        // Not ready yet, we get started once the last name shows up
+        qDebug() << "not ready" << objectName() << m_missingDependencies << "missing D-Bus names";
+        m_startPending = true;
+        return;
+    }
+    m_startPending = false;
+
+    if (state() != QProcess::NotRunning) {
+        return;
+    }
+
+    if (isActivatable() && !(m_activator && m_activator->isArmed())) {
+        // Only the name is made activatable at login, the
+        // process is spawned by the first message sent to it,
+        // if that's not possible it's started like any unit
+        if (armActivation()) {
+            return;
+        }
+    }
+    m_stopping = false;
+
+    if (!m_process) {
+        m_process = new UnitProcess(m_argv);
+
+        CGroupManager *cgroups = CGroupManager::global();
+        if (cgroups->isEnabled()) {
+            m_cgroup = cgroups->createGroup(m_type, m_name, m_memoryMax, m_memoryHigh);
+            m_cgroupFd = cgroups->openGroup(m_cgroup);
+            m_process->setCGroup(m_cgroupFd);
+        }
     }
+
+    int stdoutFd = -1;
+    int stderrFd = -1;
+    if (!m_output->open(&stdoutFd, &stderrFd)) {
+        // Better inheriting ours than not starting
+        stdoutFd = stderrFd = -1;
+    }
+    m_process->setOutput(stdoutFd, stderrFd);
+    m_process->setLauncher(m_launcher);
+
+    qDebug() << "starting" << objectName();
+    setState(QProcess::Starting);
+    m_process->start(environment(), this, [this](int error) {
+        spawned(error);
+    });
 }
 
-void UnitLauncher::registerObject()
+void UnitLauncher::spawned(int error)
 {
-    if (!isValid()) {
+    m_output->closeChildEnds();
+    if (error) {
+        qWarning() << objectName() << "failed to start" << m_exec << strerror(error);
+        StartupTrace::global()->recordError(StartupTrace::Failed, m_name, error);
+        if (m_activator) {
+            m_activator->discard(QLatin1String("org.freedesktop.DBus.Error.Spawn.ExecFailed"),
+                                 QString::fromLocal8Bit(strerror(error)));
+        }
+        setState(QProcess::NotRunning);
+        emit failed();
         return;
     }
 
-    (void) new UnitAdaptor(this);
-    QDBusConnection::sessionBus().registerService(QLatin1String("org.foo.session.unit"));
+    ChildSupervisor::global()->watch(m_process->pid(), this);
+    StartupTrace::global()->record(StartupTrace::Executed, m_name, qint64(m_process->pid()));
+    setState(QProcess::Running);
+    processStarted();
+
+    if (m_stopping) {
+        // Stopped while the launcher helper was forking it
+        m_process->terminate();
+    }
+}
+
+char *const *UnitLauncher::environment()
+{
+    SessionEnvironment *sessionEnvironment = SessionEnvironment::global();
+    if (m_environment.isEmpty()) {
+        // The shared block, only serialized when it changed
+        m_environmentBlock = sessionEnvironment->block();
+    } else if (!m_environmentBlock || m_environmentGeneration != sessionEnvironment->generation()) {
+        m_environmentBlock = sessionEnvironment->overlay(m_environment);
+        m_environmentGeneration = sessionEnvironment->generation();
+    }
+    // Kept until the next start, the block must outlive the spawn
+    return m_environmentBlock->envp();
+}
+
+bool UnitLauncher::isActivatable() const
+{
+    return !m_dbusExec.isEmpty() && !m_dbusName.isEmpty();
+}
+
+bool UnitLauncher::armActivation()
+{
+    if (!m_activator) {
+        m_activator = new DBusActivator(m_dbusName, this);
+        connect(m_activator, &DBusActivator::activationRequested,
+                this, &UnitLauncher::activate);
+    }
+
+    if (!m_activator->arm()) {
+        qWarning() << objectName() << m_dbusName << "not activatable, starting it right away";
+        return false;
+    }
 
-    if (!QDBusConnection::sessionBus().registerObject(objectName(), this)) {
-        qWarning() << "unable to register object to dbus" << objectName();
+    // Dependents only need the name to be there, the process
+    // spawned by activation still reports its own readiness
+    TimerQueue::global()->cancel(m_readyTimer);
+    m_readyTimer = 0;
+    m_activatable = true;
+    m_status = QLatin1String("activatable");
+    StartupTrace::global()->record(StartupTrace::Ready, m_name, m_status);
+    emit stateChanged();
+    emit ready();
+    return true;
+}
+
+void UnitLauncher::activate()
+{
+    if (m_dbusNameRegistered) {
+        // It claimed the name while the bus was activating
+        m_activator->flush();
+        return;
+    }
+    Start();
+}
+
+void UnitLauncher::checkIdle()
+{
+    // Units don't tell us when they are busy, a unit
+    // that didn't use any CPU for a whole period is idle
+    QFile stat(QLatin1String("/proc/") % QString::number(pid()) % QLatin1String("/stat"));
+    if (!stat.open(QFile::ReadOnly)) {
         return;
     }
+    const QByteArray data = stat.readAll();
+    const QList<QByteArray> fields = data.mid(data.lastIndexOf(')') + 2).split(' ');
+    if (fields.size() < 13) {
+        return;
+    }
+
+    const qint64 ticks = fields.at(11).toLongLong() + fields.at(12).toLongLong();
+    if (ticks == m_idleTicks) {
+        qDebug() << objectName() << "idle for" << m_idleTimeout << "seconds, stopping";
+        Stop();
+    } else {
+        m_idleTicks = ticks;
+    }
+}
+
+void UnitLauncher::registerObject()
+{
+    if (!isValid()) {
+        return;
+    }
+
+    UnitObjectTree::global()->addUnit(this);
 
     // show info about this unit
     qDebug() << objectName();
     qDebug() << "DBusExec" << m_dbusExec;
-    qDebug() << "OnlyShowIn" << m_onlyShowIn;
-    qDebug() << "Exec" << m_exec;
+    qDebug() << "Exec" << m_argv;
     qDebug() << "DBusSessionRequires" << m_dbusSessionRequires;
     qDebug() << "DBusSystemRequires" << m_dbusSystemRequires;
     qDebug() << "Enabled" << m_enabled;
     qDebug();
 }
 
-void UnitLauncher::setupProcess(QProcess *process)
+void UnitLauncher::unregisterObject()
+{
+    UnitObjectTree::global()->removeUnit(this);
+}
+
+void UnitLauncher::processExited(int status)
 {
-    m_process->setProgram(m_exec);
-    m_process->setProcessChannelMode(QProcess::ForwardedChannels);
-    connect(m_process, &QProcess::started,
-            this, &UnitLauncher::started);
-    connect(m_process, &QProcess::stateChanged,
-            this, &UnitLauncher::processStateChanged);
-    connect(m_process, SIGNAL(finished(int,QProcess::ExitStatus)),
-            this, SLOT(finished(int,QProcess::ExitStatus)));
+    int exitCode;
+    QProcess::ExitStatus exitStatus = UnitProcess::exitStatus(status, &exitCode);
+    m_process->setExited();
+    setState(QProcess::NotRunning);
+    finished(exitCode, exitStatus);
 }
 
-void UnitLauncher::processStateChanged(QProcess::ProcessState state)
+void UnitLauncher::setState(QProcess::ProcessState state)
 {
     qDebug() << objectName() << state;
+    if (state == QProcess::Starting) {
+        QElapsedTimer timer;
+        timer.start();
+        m_startTimestamp = timer.msecsSinceReference();
+        m_readyTimestamp = 0;
+        if (m_activatable) {
+            m_activatable = false;
+            m_status.clear();
+        }
+    } else if (state == QProcess::NotRunning) {
+        // Whatever made it exit is reported by finished()
+        TimerQueue::global()->cancel(m_readyTimer);
+        m_readyTimer = 0;
+        m_ready = false;
+        RestartScheduler::global()->release(this);
+        if (m_idleTimer) {
+            m_idleTimer->stop();
+        }
+    }
     emit stateChanged();
 }
 
+void UnitLauncher::processStarted()
+{
+    emit started();
+
+    if (m_readyNotify == ReadyOnExec) {
+        setReady();
+    } else if (m_readyNotify == ReadyOnDBusName && m_dbusNameRegistered) {
+        // The name might have been claimed before exec returned
+        setReady();
+    }
+}
+
+void UnitLauncher::setReady()
+{
+    if (m_activator && m_activator->isArmed() && m_idleTimeout > 0 && state() != QProcess::NotRunning) {
+        if (!m_idleTimer) {
+            m_idleTimer = new QTimer(this);
+            m_idleTimer->setInterval(m_idleTimeout * 1000);
+            connect(m_idleTimer, &QTimer::timeout,
+                    this, &UnitLauncher::checkIdle);
+        }
+        if (!m_idleTimer->isActive()) {
+            m_idleTicks = -1;
+            m_idleTimer->start();
+        }
+    }
+
+    if (m_ready || state() == QProcess::NotRunning) {
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    m_readyTimestamp = timer.msecsSinceReference();
+    m_ready = true;
+    TimerQueue::global()->cancel(m_readyTimer);
+    m_readyTimer = 0;
+    RestartScheduler::global()->release(this);
+    StartupTrace::global()->record(StartupTrace::Ready, m_name);
+    qDebug() << objectName() << "ready after" << (m_readyTimestamp - m_startTimestamp) << "ms";
+    emit stateChanged();
+    emit ready();
+}
+
 void UnitLauncher::finished(int exitCode, QProcess::ExitStatus exitStatus)
 {
     qDebug() << objectName() << exitCode << exitStatus;
-    if (exitStatus == QProcess::CrashExit && ++m_crashCount < 5) {
-        qDebug() << objectName() << "Has crashed respawing..." << m_crashCount;
-        Start();
+    StartupTrace *trace = StartupTrace::global();
+    const bool crashed = exitStatus == QProcess::CrashExit;
+    const bool failure = crashed || exitCode != 0;
+    trace->record(crashed && !m_stopping ? StartupTrace::Crashed : StartupTrace::Exited,
+                  m_name, qint64(exitCode));
+
+    const bool activated = m_activator && m_activator->isArmed();
+    bool reported = false;
+    if (m_stopping) {
+        m_stopping = false;
+    } else if (!activated && !m_inhibited) {
+        // Activatable units are started again by the next caller
+        if (m_restartPolicy == RestartAlways ||
+                (m_restartPolicy == RestartOnFailure && failure) ||
+                (m_restartPolicy == RestartOnCrash && crashed)) {
+            scheduleRestart();
+            reported = true;
+        } else if (failure) {
+            trace->record(StartupTrace::Failed, m_name);
+            emit failed();
+            reported = true;
+        }
+    }
+
+    if (!reported && !m_readyTimestamp && !activated && !m_inhibited) {
+        // Gone before it got ready, whoever waits on it moves on
+        trace->record(StartupTrace::Failed, m_name, QStringLiteral("exited before ready"));
+        emit failed();
+    }
+
+    if (activated && state() == QProcess::NotRunning && !m_inhibited) {
+        // The bus fails the calls it held for this activation,
+        // then wait for the next caller
+        m_activator->discard(QLatin1String("org.freedesktop.DBus.Error.Spawn.ChildExited"),
+                             QLatin1String("The service exited before claiming its name"));
+        if (!m_activatable) {
+            armActivation();
+        }
     }
 }
 
-void UnitLauncher::sessionServiceOwnerChanged(const QString &service, const QString &oldOwner, const QString &newOwner)
+void UnitLauncher::scheduleRestart()
 {
-    Q_UNUSED(oldOwner)
+    // Only the restarts within the last interval count,
+    // so a unit that flapped earlier can recover later
+    const qint64 now = TimerQueue::now();
+    while (!m_restarts.isEmpty() && m_restarts.first() <= now - m_startLimitInterval) {
+        m_restarts.removeFirst();
+    }
 
-    if (newOwner.isEmpty()) {
-        m_dbusSessionRequiresRunning.removeOne(service);
-        if (m_shutdownOnMissingDeps) {
-            Stop();
-        }
-    } else if (!m_dbusSessionRequiresRunning.contains(service)) {
-        m_dbusSessionRequiresRunning.append(service);
+    if (m_restarts.size() >= m_startLimitBurst) {
+        qWarning() << objectName() << "restarted" << m_restarts.size() << "times in"
+                   << m_startLimitInterval << "ms, giving up";
+        StartupTrace::global()->record(StartupTrace::Failed, m_name, QStringLiteral("start limit hit"));
+        m_nextRestart = 0;
+        emit stateChanged();
+        emit failed();
+        return;
+    }
+
+    // Exponential backoff with +-25% jitter so units
+    // that crashed together don't restart together
+    qint64 delay = qint64(m_restartSec) << qMin(m_restarts.size(), 16);
+    delay = qMin(delay, qint64(RESTART_MAX_DELAY));
+    delay += delay * (qrand() % 51 - 25) / 100;
+    m_restarts.append(now);
+
+    qDebug() << objectName() << "restarting in" << delay << "ms, attempt" << m_restarts.size();
+    StartupTrace::global()->record(StartupTrace::Respawned, m_name, qint64(m_restarts.size()));
+    m_nextRestart = RestartScheduler::global()->schedule(this, delay);
+    emit stateChanged();
+}
+
+void UnitLauncher::restart()
+{
+    m_nextRestart = 0;
+    Start();
+    if (state() == QProcess::NotRunning) {
+        // Waiting for dependencies or failed to exec
+        RestartScheduler::global()->release(this);
+    }
+}
+
+void UnitLauncher::readyTimedOut()
+{
+    if (isReady()) {
+        return;
+    }
+
+    // The process is left alone, it may still get ready later
+    qWarning() << objectName() << "not ready after" << READY_TIMEOUT << "ms, giving up on it";
+    StartupTrace::global()->record(StartupTrace::Failed, m_name, QStringLiteral("ready timeout"));
+    m_startPending = false;
+    emit failed();
+}
+
+void UnitLauncher::inhibit()
+{
+    m_inhibited = true;
+    m_startPending = false;
+    TimerQueue::global()->cancel(m_readyTimer);
+    m_readyTimer = 0;
+
+    if (m_nextRestart) {
+        RestartScheduler::global()->cancel(this);
+        m_nextRestart = 0;
+        emit stateChanged();
+    }
+
+    if (m_activator) {
+        m_activator->discard(QLatin1String("org.freedesktop.DBus.Error.Spawn.Failed"),
+                             QLatin1String("The session is shutting down"));
+        m_activator->release();
+        m_activatable = false;
     }
 }
 
-void UnitLauncher::systemServiceOwnerChanged(const QString &service, const QString &oldOwner, const QString &newOwner)
+void UnitLauncher::kill()
 {
-    Q_UNUSED(oldOwner)
+    if (m_process && m_process->state() != QProcess::NotRunning) {
+        m_stopping = true;
+        m_process->kill();
+    }
 
-    if (newOwner.isEmpty()) {
-        m_dbusSystemRequiresRunning.removeOne(service);
+    if (!m_cgroup.isEmpty() && CGroupManager::global()->isPopulated(m_cgroup)) {
+        CGroupManager::global()->kill(m_cgroup);
+    }
+}
+
+QStringList UnitLauncher::dbusRequires(QDBusConnection::BusType bus) const
+{
+    return bus == QDBusConnection::SystemBus ? m_dbusSystemRequires : m_dbusSessionRequires;
+}
+
+QString UnitLauncher::dbusName() const
+{
+    return m_dbusName;
+}
+
+void UnitLauncher::serviceOwnerChanged(QDBusConnection::BusType bus, const QString &service, bool registered)
+{
+    if (bus == QDBusConnection::SessionBus && service == m_dbusName) {
+        m_dbusNameRegistered = registered;
+        if (registered && m_activator) {
+            // The bus delivers what it held to the unit now
+            m_activator->flush();
+        }
+        if (registered && m_readyNotify == ReadyOnDBusName) {
+            setReady();
+        }
+    }
+
+    if (!dbusRequires(bus).contains(service)) {
+        return;
+    }
+
+    if (registered) {
+        StartupTrace::global()->record(StartupTrace::DependencySatisfied, m_name, service);
+        if (--m_missingDependencies == 0 && m_startPending) {
+            Start();
+        }
+    } else {
+        ++m_missingDependencies;
         if (m_shutdownOnMissingDeps) {
             Stop();
         }
-    } else if (!m_dbusSystemRequiresRunning.contains(service)) {
-        m_dbusSystemRequiresRunning.append(service);
-        Start();
     }
 }
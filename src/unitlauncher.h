@@ -21,14 +21,24 @@
 #define UNITLAUNCHER_H
 
 #include <QObject>
-#include <QSettings>
 #include <QStringList>
+#include <QVector>
 #include <QProcess>
+#include <QDBusConnection>
+#include <QSharedPointer>
 
+#include "unitinfo.h"
+#include "resourcesampler.h"
+
+class UnitProcess;
+class UnitOutput;
+class DBusActivator;
+class EnvironmentBlock;
+class QTimer;
 class UnitLauncher : public QObject
 {
     Q_OBJECT
-    Q_CLASSINFO("D-Bus Interface", "org.foo.session.unit")
+    Q_CLASSINFO("D-Bus Interface", "org.lemuri.session.unit")
 public:
     enum Type {
         Unknown,
@@ -39,7 +49,26 @@ public:
         Application
     };
 
-    explicit UnitLauncher(const QString &filename, const QString &session, QObject *parent);
+    enum ReadyNotify {
+        ReadyOnExec,
+        ReadyOnDBusName,
+        ReadyOnNotify
+    };
+
+    enum RestartPolicy {
+        RestartNo,
+        RestartOnFailure,
+        RestartOnCrash,
+        RestartAlways
+    };
+
+    enum StartClass {
+        StartImmediate,
+        StartDelayed,
+        StartOnIdle
+    };
+
+    explicit UnitLauncher(const UnitInfo &info, const QString &session, QObject *parent);
     explicit UnitLauncher(const QString &program, QObject *parent);
     virtual ~UnitLauncher();
 
@@ -51,8 +80,144 @@ public:
     Q_PROPERTY(uint State READ state NOTIFY stateChanged)
     QProcess::ProcessState state() const;
 
+    Q_PROPERTY(bool Ready READ isReady NOTIFY stateChanged)
+    bool isReady() const;
+
+    Q_PROPERTY(QString Status READ status NOTIFY stateChanged)
+    QString status() const;
+
+    /**
+     * Monotonic timestamps in msecs, 0 when it didn't happen yet
+     */
+    Q_PROPERTY(qlonglong StartTimestamp READ startTimestamp)
+    qint64 startTimestamp() const;
+    Q_PROPERTY(qlonglong ReadyTimestamp READ readyTimestamp)
+    qint64 readyTimestamp() const;
+
+    /**
+     * Restarts within the StartLimitIntervalSec window
+     */
+    Q_PROPERTY(uint RestartCount READ restartCount NOTIFY stateChanged)
+    uint restartCount() const;
+
+    /**
+     * Monotonic msecs of the pending restart, 0 if there is none
+     */
+    Q_PROPERTY(qlonglong NextRestart READ nextRestart NOTIFY stateChanged)
+    qint64 nextRestart() const;
+
+    /**
+     * Resources of the unit process tree, refreshed
+     * by the ResourceSampler
+     */
+    Q_PROPERTY(qulonglong CpuTime READ cpuTime)
+    qulonglong cpuTime() const;
+    Q_PROPERTY(qulonglong MemoryRSS READ memoryRss)
+    qulonglong memoryRss() const;
+    Q_PROPERTY(qulonglong MemoryPSS READ memoryPss)
+    qulonglong memoryPss() const;
+    Q_PROPERTY(qulonglong IORead READ ioRead)
+    qulonglong ioRead() const;
+    Q_PROPERTY(qulonglong IOWrite READ ioWrite)
+    qulonglong ioWrite() const;
+    Q_PROPERTY(uint Threads READ threads)
+    uint threads() const;
+    Q_PROPERTY(qlonglong Uptime READ uptime)
+    qint64 uptime() const;
+
+    ResourceUsage resourceUsage() const;
+    void setResourceUsage(const ResourceUsage &usage);
+
+    qint64 pid() const;
+
+    /**
+     * What the unit printed to stdout and stderr
+     */
+    UnitOutput *output() const;
+
+    /**
+     * The cgroup of the unit, empty when cgroups are not used
+     */
+    QString cgroup() const;
+
     bool isValid() const;
 
+    /**
+     * Units that must be ready before this one is started,
+     * if they fail this unit is started anyway.
+     */
+    QStringList after() const;
+
+    /**
+     * Units that must be ready before this one is started,
+     * if they fail this unit is not started at all.
+     */
+    QStringList requires() const;
+
+    /**
+     * Delayed units are started startDelay() msecs after the
+     * shell is up, on-idle ones once the session is quiet
+     */
+    StartClass startClass() const;
+    int startDelay() const;
+
+    QStringList dbusRequires(QDBusConnection::BusType bus) const;
+    QString dbusName() const;
+
+    /**
+     * Units with both DBusExec and DBusName are only spawned
+     * once something sends a message to their name
+     */
+    bool isActivatable() const;
+
+    /**
+     * Called by the DBusNameRegistry of \p bus when \p service
+     * the unit requires (or its DBusName) appears or vanishes
+     */
+    void serviceOwnerChanged(QDBusConnection::BusType bus, const QString &service, bool registered);
+
+    /**
+     * Exports the unit on the session bus through the
+     * UnitObjectTree, called once the bus is up
+     */
+    void registerObject();
+    void unregisterObject();
+
+    /**
+     * Called by the ChildSupervisor with the wait()
+     * status once the unit process was reaped
+     */
+    void processExited(int status);
+
+    /**
+     * Handles a sd_notify() style message sent by
+     * the unit process
+     */
+    void notify(const QHash<QByteArray, QByteArray> &fields);
+
+    /**
+     * Picks up the Restart, IdleTimeout, Memory, Environment, Launcher
+     * and start class keys of a reloaded unit file, they don't need a restart
+     */
+    void updatePolicy(const UnitInfo &info);
+
+    /**
+     * Called by the RestartScheduler once the backoff
+     * expired and a restart slot is free
+     */
+    void restart();
+
+    /**
+     * Used on logout, the unit isn't started, restarted
+     * or activated anymore and its D-Bus name is released
+     */
+    void inhibit();
+
+    /**
+     * SIGKILLs the process and whatever is left in its cgroup
+     */
+    void kill();
+
     static QString configPath(const QString &sessionName);
 
 public Q_SLOTS:
@@ -61,33 +226,75 @@ public Q_SLOTS:
 
 Q_SIGNALS:
     void started();
+    void ready();
+    void failed();
     void stateChanged();
 
 private slots:
-    void registerObject();
-    void setupProcess(QProcess *process);
-    void processStateChanged(QProcess::ProcessState state);
+    void setState(QProcess::ProcessState state);
+    void processStarted();
+    void setReady();
     void finished(int exitCode, QProcess::ExitStatus exitStatus);
-
-    void sessionServiceOwnerChanged(const QString &service, const QString &oldOwner, const QString &newOwner);
-    void systemServiceOwnerChanged(const QString &service, const QString &oldOwner, const QString &newOwner);
+    void activate();
+    void checkIdle();
 
 private:
-    QSettings m_settings;
+    void spawned(int error);
+    bool armActivation();
+    void readyTimedOut();
+    void scheduleRestart();
+    char *const *environment();
+
     QString m_session;
     QString m_name;
     QStringList m_dbusSessionRequires;
-    QStringList m_dbusSessionRequiresRunning;
     QStringList m_dbusSystemRequires;
-    QStringList m_dbusSystemRequiresRunning;
-    QStringList m_onlyShowIn;
+    QStringList m_after;
+    QStringList m_requires;
     QString m_exec;
+    QStringList m_argv;
     QString m_dbusExec;
-    QProcess *m_process = 0;
-    int m_crashCount = 0;
+    QString m_dbusName;
+    QString m_status;
+    ReadyNotify m_readyNotify = ReadyOnExec;
+    bool m_ready = false;
+    // Name claimed for activation, no process spawned yet
+    bool m_activatable = false;
+    bool m_dbusNameRegistered = false;
+    bool m_startPending = false;
+    bool m_stopping = false;
+    bool m_inhibited = false;
+    int m_missingDependencies = 0;
+    qint64 m_startTimestamp = 0;
+    qint64 m_readyTimestamp = 0;
+    UnitProcess *m_process = 0;
+    DBusActivator *m_activator = 0;
+    UnitOutput *m_output = 0;
+    QTimer *m_idleTimer = 0;
+    qint64 m_idleTicks = -1;
+    QVector<qint64> m_restarts;
+    qint64 m_nextRestart = 0;
+    quint64 m_readyTimer = 0;
+    RestartPolicy m_restartPolicy = RestartOnCrash;
+    int m_restartSec = 100;
+    int m_startLimitBurst = 5;
+    int m_startLimitInterval = 10000;
     Type m_type = Unknown;
-    bool m_enabled;
-    bool m_shutdownOnMissingDeps;
+    bool m_valid = false;
+    bool m_enabled = false;
+    bool m_shutdownOnMissingDeps = false;
+    bool m_launcher = false;
+    StartClass m_startClass = StartImmediate;
+    int m_startDelay = 0;
+    int m_idleTimeout = 0;
+    qint64 m_memoryMax = -1;
+    qint64 m_memoryHigh = -1;
+    QString m_cgroup;
+    QList<QByteArray> m_environment;
+    QSharedPointer<const EnvironmentBlock> m_environmentBlock;
+    quint64 m_environmentGeneration = 0;
+    ResourceUsage m_usage;
+    int m_cgroupFd = -1;
 };
 
 #endif // UNITLAUNCHER_H
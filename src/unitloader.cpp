@@ -0,0 +1,122 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "unitloader.h"
+
+#include <QtConcurrent/QtConcurrentMap>
+#include <QDebug>
+
+namespace {
+
+struct ScanDirectory
+{
+    typedef UnitCache::Scan result_type;
+
+    explicit ScanDirectory(const UnitCache *cache) : cache(cache) {}
+
+    UnitCache::Scan operator()(const QString &path) const {
+        return cache->scanDirectory(path);
+    }
+
+    const UnitCache *cache;
+};
+
+struct ParseUnit
+{
+    typedef UnitInfo result_type;
+
+    explicit ParseUnit(const QString &session) : session(session) {}
+
+    UnitInfo operator()(const QString &filePath) const {
+        return UnitInfo::parse(filePath, session);
+    }
+
+    QString session;
+};
+
+}
+
+UnitLoader::UnitLoader(const QString &sessionName, QObject *parent) :
+    QObject(parent),
+    m_cache(sessionName)
+{
+    connect(&m_scanWatcher, &QFutureWatcher<UnitCache::Scan>::finished,
+            this, &UnitLoader::scanFinished);
+    connect(&m_parseWatcher, &QFutureWatcher<UnitInfo>::finished,
+            this, &UnitLoader::parseFinished);
+}
+
+UnitLoader::~UnitLoader()
+{
+    m_scanWatcher.waitForFinished();
+    m_parseWatcher.waitForFinished();
+}
+
+void UnitLoader::load(const QStringList &directories)
+{
+    if (isRunning()) {
+        qWarning() << "Unit loading already in progress";
+        return;
+    }
+
+    m_scans.clear();
+    m_stale.clear();
+    m_scanWatcher.setFuture(QtConcurrent::mapped(directories, ScanDirectory(&m_cache)));
+}
+
+bool UnitLoader::isRunning() const
+{
+    return m_scanWatcher.isRunning() || m_parseWatcher.isRunning();
+}
+
+void UnitLoader::scanFinished()
+{
+    m_scans = m_scanWatcher.future().results().toVector();
+
+    QStringList stalePaths;
+    for (int i = 0; i < m_scans.size(); ++i) {
+        const QVector<UnitCache::Entry> &entries = m_scans.at(i).entries;
+        for (int j = 0; j < entries.size(); ++j) {
+            if (entries.at(j).stale) {
+                m_stale.append(qMakePair(i, j));
+                stalePaths.append(entries.at(j).info.filePath);
+            }
+        }
+    }
+
+    if (stalePaths.isEmpty()) {
+        parseFinished();
+    } else {
+        qDebug() << "Parsing" << stalePaths.size() << "changed unit files";
+        m_parseWatcher.setFuture(QtConcurrent::mapped(stalePaths, ParseUnit(m_cache.session())));
+    }
+}
+
+void UnitLoader::parseFinished()
+{
+    if (!m_stale.isEmpty()) {
+        const QList<UnitInfo> parsed = m_parseWatcher.future().results();
+        for (int i = 0; i < m_stale.size() && i < parsed.size(); ++i) {
+            const QPair<int, int> &position = m_stale.at(i);
+            m_scans[position.first].entries[position.second].info = parsed.at(i);
+        }
+    }
+
+    emit finished(m_cache.merge(m_scans, true));
+}
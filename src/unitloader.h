@@ -0,0 +1,64 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef UNITLOADER_H
+#define UNITLOADER_H
+
+#include <QObject>
+#include <QFutureWatcher>
+
+#include "unitcache.h"
+
+/**
+ * @brief The UnitLoader class
+ * Discovers and parses the unit files of a session on the
+ * global thread pool: all directories are scanned in parallel,
+ * then every file the UnitCache couldn't provide is parsed in
+ * parallel, finally the results are merged in directory order
+ * on the calling thread so overriding stays deterministic.
+ *
+ * Only plain UnitInfo records cross threads, the QObjects
+ * are created by whoever handles finished().
+ */
+class UnitLoader : public QObject
+{
+    Q_OBJECT
+public:
+    explicit UnitLoader(const QString &sessionName, QObject *parent = 0);
+    virtual ~UnitLoader();
+
+    void load(const QStringList &directories);
+    bool isRunning() const;
+
+Q_SIGNALS:
+    void finished(const QList<UnitInfo> &units);
+
+private Q_SLOTS:
+    void scanFinished();
+    void parseFinished();
+
+private:
+    UnitCache m_cache;
+    QVector<UnitCache::Scan> m_scans;
+    QVector<QPair<int, int> > m_stale;
+    QFutureWatcher<UnitCache::Scan> m_scanWatcher;
+    QFutureWatcher<UnitInfo> m_parseWatcher;
+};
+
+#endif // UNITLOADER_H
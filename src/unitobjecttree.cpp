@@ -0,0 +1,355 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "unitobjecttree.h"
+
+#include "unitlauncher.h"
+#include "unitoutput.h"
+
+#include <QCoreApplication>
+#include <QDBusConnection>
+#include <QDBusMetaType>
+#include <QDBusServiceWatcher>
+#include <QDBusVariant>
+#include <QMetaProperty>
+#include <QRegularExpression>
+#include <QStringBuilder>
+#include <QFile>
+#include <QDebug>
+
+#include <limits.h>
+
+#define TREE_ROOT "/org/lemuri"
+#define UNIT_INTERFACE "org.lemuri.session.unit"
+#define PROPERTIES_INTERFACE "org.freedesktop.DBus.Properties"
+#define OBJECT_MANAGER_INTERFACE "org.freedesktop.DBus.ObjectManager"
+#define INTROSPECTABLE_INTERFACE "org.freedesktop.DBus.Introspectable"
+
+static const char *s_unitRoots[] = {
+    TREE_ROOT "/custom_units",
+    TREE_ROOT "/shell_units",
+    TREE_ROOT "/service_units",
+    TREE_ROOT "/application_units",
+    TREE_ROOT "/unknown_units"
+};
+
+static const char s_objectManagerXml[] =
+        "  <interface name=\"" OBJECT_MANAGER_INTERFACE "\">\n"
+        "    <method name=\"GetManagedObjects\">\n"
+        "      <arg type=\"a{oa{sa{sv}}}\" name=\"objects\" direction=\"out\"/>\n"
+        "    </method>\n"
+        "    <signal name=\"InterfacesAdded\">\n"
+        "      <arg type=\"o\" name=\"object\"/>\n"
+        "      <arg type=\"a{sa{sv}}\" name=\"interfaces\"/>\n"
+        "    </signal>\n"
+        "    <signal name=\"InterfacesRemoved\">\n"
+        "      <arg type=\"o\" name=\"object\"/>\n"
+        "      <arg type=\"as\" name=\"interfaces\"/>\n"
+        "    </signal>\n"
+        "  </interface>\n";
+
+UnitObjectTree *UnitObjectTree::global()
+{
+    static UnitObjectTree *instance = new UnitObjectTree(qApp);
+    return instance;
+}
+
+UnitObjectTree::UnitObjectTree(QObject *parent) :
+    QDBusVirtualObject(parent)
+{
+    qDBusRegisterMetaType<UnitResourceMap>();
+    qDBusRegisterMetaType<ManagedObjectMap>();
+
+    // The interface description the adaptor used to be
+    // generated from, without the doc elements
+    QFile file(QLatin1String(":/org.lemuri.session.unit.xml"));
+    if (file.open(QFile::ReadOnly)) {
+        QString xml = QString::fromUtf8(file.readAll());
+        int begin = xml.indexOf(QLatin1String("<interface"));
+        int end = xml.lastIndexOf(QLatin1String("</interface>"));
+        if (begin != -1 && end > begin) {
+            xml = xml.mid(begin, end - begin) % QLatin1String("</interface>\n");
+            xml.remove(QRegularExpression(QLatin1String("\\s*<doc:doc>.*?</doc:doc>"),
+                                          QRegularExpression::DotMatchesEverythingOption));
+            m_unitInterfaceXml = QLatin1String("  ") % xml;
+        }
+    }
+
+    if (m_unitInterfaceXml.isEmpty()) {
+        qWarning() << "Unit interface description not found";
+    }
+
+    m_clientWatcher = new QDBusServiceWatcher(this);
+    m_clientWatcher->setWatchMode(QDBusServiceWatcher::WatchForUnregistration);
+    connect(m_clientWatcher, &QDBusServiceWatcher::serviceUnregistered,
+            this, &UnitObjectTree::clientGone);
+}
+
+bool UnitObjectTree::registerTree()
+{
+    QDBusConnection bus = QDBusConnection::sessionBus();
+    if (!bus.registerVirtualObject(QLatin1String(TREE_ROOT), this, QDBusConnection::SingleNode)) {
+        qWarning() << "unable to register the object manager" << TREE_ROOT;
+        return false;
+    }
+
+    for (const char *root : s_unitRoots) {
+        if (!bus.registerVirtualObject(QLatin1String(root), this, QDBusConnection::SubPath)) {
+            qWarning() << "unable to register the unit tree" << root;
+        }
+    }
+    return true;
+}
+
+void UnitObjectTree::addUnit(UnitLauncher *launcher)
+{
+    if (!m_registered) {
+        m_registered = registerTree();
+        m_clientWatcher->setConnection(QDBusConnection::sessionBus());
+    }
+
+    m_units.insert(launcher->objectName(), launcher);
+
+    UnitResourceMap interfaces;
+    interfaces.insert(QLatin1String(UNIT_INTERFACE), properties(launcher));
+
+    QDBusMessage signal = QDBusMessage::createSignal(QLatin1String(TREE_ROOT),
+                                                     QLatin1String(OBJECT_MANAGER_INTERFACE),
+                                                     QLatin1String("InterfacesAdded"));
+    signal << QVariant::fromValue(QDBusObjectPath(launcher->objectName()))
+           << QVariant::fromValue(interfaces);
+    QDBusConnection::sessionBus().send(signal);
+}
+
+void UnitObjectTree::removeUnit(UnitLauncher *launcher)
+{
+    QHash<QString, UnitLauncher *>::Iterator it = m_units.find(launcher->objectName());
+    if (it == m_units.end() || it.value() != launcher) {
+        return;
+    }
+    m_units.erase(it);
+
+    Followers followers = m_followers.take(launcher);
+    disconnect(followers.connection);
+    foreach (const QString &client, followers.clients) {
+        unfollow(0, client);
+    }
+
+    QDBusMessage signal = QDBusMessage::createSignal(QLatin1String(TREE_ROOT),
+                                                     QLatin1String(OBJECT_MANAGER_INTERFACE),
+                                                     QLatin1String("InterfacesRemoved"));
+    signal << QVariant::fromValue(QDBusObjectPath(launcher->objectName()))
+           << QStringList(QLatin1String(UNIT_INTERFACE));
+    QDBusConnection::sessionBus().send(signal);
+}
+
+QString UnitObjectTree::introspect(const QString &path) const
+{
+    if (path == QLatin1String(TREE_ROOT)) {
+        // The child nodes are real registrations, added by QtDBus
+        return QLatin1String(s_objectManagerXml);
+    }
+
+    if (m_units.contains(path)) {
+        return m_unitInterfaceXml;
+    }
+
+    // One of the roots, list the units below it
+    QString ret;
+    const QString prefix = path % QLatin1Char('/');
+    QHash<QString, UnitLauncher *>::ConstIterator it = m_units.constBegin();
+    while (it != m_units.constEnd()) {
+        if (it.key().startsWith(prefix)) {
+            ret.append(QLatin1String("  <node name=\"") % it.key().mid(prefix.size()) % QLatin1String("\"/>\n"));
+        }
+        ++it;
+    }
+    return ret;
+}
+
+bool UnitObjectTree::handleMessage(const QDBusMessage &message, const QDBusConnection &connection)
+{
+    if (message.type() != QDBusMessage::MethodCallMessage) {
+        return false;
+    }
+
+    QDBusMessage reply;
+    const QString path = message.path();
+    if (message.interface() == QLatin1String(INTROSPECTABLE_INTERFACE)) {
+        reply = introspectReply(message);
+    } else if (path == QLatin1String(TREE_ROOT)) {
+        if (message.member() == QLatin1String("GetManagedObjects")) {
+            reply = managedObjects(message);
+        }
+    } else if (UnitLauncher *launcher = m_units.value(path)) {
+        reply = unitCall(launcher, message);
+    } else {
+        reply = message.createErrorReply(QDBusError::UnknownObject,
+                                         QLatin1String("No such unit ") % path);
+    }
+
+    if (reply.type() == QDBusMessage::InvalidMessage) {
+        reply = message.createErrorReply(QDBusError::UnknownMethod,
+                                         QLatin1String("No such method ") % message.member());
+    }
+
+    if (!message.isReplyRequired()) {
+        return true;
+    }
+    return connection.send(reply);
+}
+
+QDBusMessage UnitObjectTree::managedObjects(const QDBusMessage &message) const
+{
+    ManagedObjectMap objects;
+    QHash<QString, UnitLauncher *>::ConstIterator it = m_units.constBegin();
+    while (it != m_units.constEnd()) {
+        UnitResourceMap interfaces;
+        interfaces.insert(QLatin1String(UNIT_INTERFACE), properties(it.value()));
+        objects.insert(QDBusObjectPath(it.key()), interfaces);
+        ++it;
+    }
+    return message.createReply(QVariant::fromValue(objects));
+}
+
+QDBusMessage UnitObjectTree::unitCall(UnitLauncher *launcher, const QDBusMessage &message)
+{
+    const QString member = message.member();
+    const QVariantList args = message.arguments();
+
+    if (message.interface() == QLatin1String(PROPERTIES_INTERFACE)) {
+        const QString interface = args.value(0).toString();
+        if (!interface.isEmpty() && interface != QLatin1String(UNIT_INTERFACE)) {
+            return message.createErrorReply(QDBusError::UnknownInterface,
+                                            QLatin1String("No such interface ") % interface);
+        }
+
+        if (member == QLatin1String("GetAll")) {
+            return message.createReply(properties(launcher));
+        } else if (member == QLatin1String("Get")) {
+            const QString name = args.value(1).toString();
+            const QVariantMap all = properties(launcher);
+            if (!all.contains(name)) {
+                return message.createErrorReply(QDBusError::InvalidArgs,
+                                                QLatin1String("No such property ") % name);
+            }
+            return message.createReply(QVariant::fromValue(QDBusVariant(all.value(name))));
+        } else if (member == QLatin1String("Set")) {
+            return message.createErrorReply(QDBusError::PropertyReadOnly,
+                                            QLatin1String("Unit properties are read-only"));
+        }
+    } else if (message.interface().isEmpty() || message.interface() == QLatin1String(UNIT_INTERFACE)) {
+        if (member == QLatin1String("Start")) {
+            launcher->Start();
+            return message.createReply();
+        } else if (member == QLatin1String("Stop")) {
+            launcher->Stop();
+            return message.createReply();
+        } else if (member == QLatin1String("Tail")) {
+            const int count = int(qMin(args.value(0).toUInt(), uint(INT_MAX)));
+            return message.createReply(QVariant::fromValue(launcher->output()->tail(count)));
+        } else if (member == QLatin1String("Follow")) {
+            follow(launcher, message.service());
+            return message.createReply();
+        } else if (member == QLatin1String("Unfollow")) {
+            unfollow(launcher, message.service());
+            return message.createReply();
+        }
+    }
+    return QDBusMessage();
+}
+
+QDBusMessage UnitObjectTree::introspectReply(const QDBusMessage &message) const
+{
+    if (message.member() != QLatin1String("Introspect")) {
+        return QDBusMessage();
+    }
+
+    QString xml = QLatin1String("<!DOCTYPE node PUBLIC \"-//freedesktop//DTD D-BUS Object Introspection 1.0//EN\"\n"
+                                "\"http://www.freedesktop.org/standards/dbus/1.0/introspect.dtd\">\n"
+                                "<node>\n");
+    xml.append(introspect(message.path()));
+    xml.append(QLatin1String("</node>\n"));
+    return message.createReply(xml);
+}
+
+void UnitObjectTree::follow(UnitLauncher *launcher, const QString &client)
+{
+    Followers &followers = m_followers[launcher];
+    if (followers.clients.isEmpty()) {
+        const QString path = launcher->objectName();
+        followers.connection = connect(launcher->output(), &UnitOutput::lines,
+                                       this, [path](const LogRecordList &records) {
+            QDBusMessage signal = QDBusMessage::createSignal(path,
+                                                             QLatin1String(UNIT_INTERFACE),
+                                                             QLatin1String("Output"));
+            signal << QVariant::fromValue(records);
+            QDBusConnection::sessionBus().send(signal);
+        });
+    }
+    followers.clients.insert(client);
+
+    if (!m_clientWatcher->watchedServices().contains(client)) {
+        m_clientWatcher->addWatchedService(client);
+    }
+}
+
+void UnitObjectTree::unfollow(UnitLauncher *launcher, const QString &client)
+{
+    if (launcher) {
+        QHash<UnitLauncher *, Followers>::Iterator it = m_followers.find(launcher);
+        if (it == m_followers.end()) {
+            return;
+        }
+
+        it.value().clients.remove(client);
+        if (it.value().clients.isEmpty()) {
+            disconnect(it.value().connection);
+            m_followers.erase(it);
+        }
+    }
+
+    // Stop watching clients that don't follow anything
+    foreach (const Followers &followers, m_followers) {
+        if (followers.clients.contains(client)) {
+            return;
+        }
+    }
+    m_clientWatcher->removeWatchedService(client);
+}
+
+void UnitObjectTree::clientGone(const QString &client)
+{
+    foreach (UnitLauncher *launcher, m_followers.keys()) {
+        unfollow(launcher, client);
+    }
+    m_clientWatcher->removeWatchedService(client);
+}
+
+QVariantMap UnitObjectTree::properties(UnitLauncher *launcher)
+{
+    // The Q_PROPERTYs of UnitLauncher are the D-Bus ones
+    QVariantMap ret;
+    const QMetaObject *metaObject = &UnitLauncher::staticMetaObject;
+    for (int i = metaObject->propertyOffset(); i < metaObject->propertyCount(); ++i) {
+        const QMetaProperty property = metaObject->property(i);
+        ret.insert(QLatin1String(property.name()), property.read(launcher));
+    }
+    return ret;
+}
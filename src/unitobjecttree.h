@@ -0,0 +1,94 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef UNITOBJECTTREE_H
+#define UNITOBJECTTREE_H
+
+#include <QDBusVirtualObject>
+#include <QDBusObjectPath>
+#include <QDBusMessage>
+#include <QHash>
+#include <QMap>
+#include <QSet>
+
+#include "resourcesampler.h"
+
+class UnitLauncher;
+class QDBusServiceWatcher;
+
+typedef QMap<QDBusObjectPath, UnitResourceMap> ManagedObjectMap;
+Q_DECLARE_METATYPE(ManagedObjectMap)
+
+/**
+ * @brief The UnitObjectTree class
+ * Serves every unit object path from a single handler, the
+ * org.lemuri.session.unit calls and property reads are
+ * dispatched on a path lookup so exporting a unit costs
+ * one hash entry instead of an adaptor and an object
+ * registration.
+ *
+ * /org/lemuri implements org.freedesktop.DBus.ObjectManager,
+ * GetManagedObjects returns all units with their properties
+ * and InterfacesAdded/InterfacesRemoved track the tree.
+ *
+ * Output signals of a unit are only sent while some client
+ * called Follow on it and is still connected.
+ */
+class UnitObjectTree : public QDBusVirtualObject
+{
+    Q_OBJECT
+public:
+    static UnitObjectTree *global();
+
+    /**
+     * Exports \p launcher at its objectName(), the tree
+     * is registered on the session bus by the first call
+     */
+    void addUnit(UnitLauncher *launcher);
+    void removeUnit(UnitLauncher *launcher);
+
+    QString introspect(const QString &path) const Q_DECL_OVERRIDE;
+    bool handleMessage(const QDBusMessage &message, const QDBusConnection &connection) Q_DECL_OVERRIDE;
+
+private:
+    explicit UnitObjectTree(QObject *parent = 0);
+    bool registerTree();
+
+    QDBusMessage managedObjects(const QDBusMessage &message) const;
+    QDBusMessage unitCall(UnitLauncher *launcher, const QDBusMessage &message);
+    QDBusMessage introspectReply(const QDBusMessage &message) const;
+    static QVariantMap properties(UnitLauncher *launcher);
+
+    void follow(UnitLauncher *launcher, const QString &client);
+    void unfollow(UnitLauncher *launcher, const QString &client);
+    void clientGone(const QString &client);
+
+    struct Followers {
+        QSet<QString> clients;
+        QMetaObject::Connection connection;
+    };
+
+    QHash<QString, UnitLauncher *> m_units;
+    QHash<UnitLauncher *, Followers> m_followers;
+    QDBusServiceWatcher *m_clientWatcher = 0;
+    QString m_unitInterfaceXml;
+    bool m_registered = false;
+};
+
+#endif // UNITOBJECTTREE_H
@@ -0,0 +1,353 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "unitoutput.h"
+
+#include "sessionlog.h"
+
+#include <QSocketNotifier>
+#include <QDBusArgument>
+#include <QDBusMetaType>
+#include <QMetaMethod>
+#include <QDebug>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+// Bytes of output kept for each unit
+#define UNIT_OUTPUT_SIZE 16384
+// Longer lines are split
+#define UNIT_OUTPUT_LINE_MAX 2048
+// Bytes read from a pipe before going back to the event loop
+#define UNIT_OUTPUT_READ_MAX 65536
+// Lines a unit may log per interval, the rest is dropped
+#define UNIT_OUTPUT_RATE_BURST 1000
+#define UNIT_OUTPUT_RATE_INTERVAL 30000000 // usecs
+
+namespace {
+
+struct RecordHeader {
+    quint64 timestamp;
+    quint16 size;
+    quint8 stream;
+} Q_PACKED;
+
+qulonglong realtime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return qulonglong(ts.tv_sec) * Q_UINT64_C(1000000) + ts.tv_nsec / 1000;
+}
+
+}
+
+QDBusArgument &operator<<(QDBusArgument &argument, const LogRecord &record)
+{
+    argument.beginStructure();
+    argument << record.timestamp << record.stream << record.line;
+    argument.endStructure();
+    return argument;
+}
+
+const QDBusArgument &operator>>(const QDBusArgument &argument, LogRecord &record)
+{
+    argument.beginStructure();
+    argument >> record.timestamp >> record.stream >> record.line;
+    argument.endStructure();
+    return argument;
+}
+
+UnitOutput::UnitOutput(const QString &unit, QObject *parent) :
+    QObject(parent),
+    m_unit(unit),
+    m_tag(unit.toUtf8())
+{
+    static bool registered = false;
+    if (!registered) {
+        qDBusRegisterMetaType<LogRecord>();
+        qDBusRegisterMetaType<LogRecordList>();
+        registered = true;
+    }
+}
+
+UnitOutput::~UnitOutput()
+{
+    while (!m_pipes.isEmpty()) {
+        closePipe(m_pipes.first());
+    }
+}
+
+bool UnitOutput::open(int *stdoutFd, int *stderrFd)
+{
+    closeChildEnds();
+
+    Pipe *out = createPipe(StandardOutput);
+    if (!out) {
+        return false;
+    }
+
+    Pipe *err = createPipe(StandardError);
+    if (!err) {
+        closePipe(out);
+        return false;
+    }
+
+    *stdoutFd = out->childFd;
+    *stderrFd = err->childFd;
+    return true;
+}
+
+void UnitOutput::closeChildEnds()
+{
+    foreach (Pipe *pipe, m_pipes) {
+        if (pipe->childFd != -1) {
+            close(pipe->childFd);
+            pipe->childFd = -1;
+        }
+    }
+}
+
+UnitOutput::Pipe *UnitOutput::createPipe(Stream stream)
+{
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        qWarning() << m_unit << "unable to create an output pipe" << strerror(errno);
+        return 0;
+    }
+    // Only our end, the child gets a blocking one
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+    Pipe *pipe = new Pipe;
+    pipe->fd = fds[0];
+    pipe->childFd = fds[1];
+    pipe->stream = stream;
+    pipe->notifier = new QSocketNotifier(pipe->fd, QSocketNotifier::Read, this);
+    connect(pipe->notifier, &QSocketNotifier::activated, this, [this, pipe]() {
+        readPipe(pipe);
+    });
+    m_pipes.append(pipe);
+    return pipe;
+}
+
+void UnitOutput::closePipe(Pipe *pipe)
+{
+    if (!pipe->partial.isEmpty()) {
+        addLine(pipe->stream, realtime(), pipe->partial.constData(), pipe->partial.size(), 0);
+    }
+
+    m_pipes.removeOne(pipe);
+    // We might be in its activated() signal
+    pipe->notifier->setEnabled(false);
+    pipe->notifier->deleteLater();
+    close(pipe->fd);
+    if (pipe->childFd != -1) {
+        close(pipe->childFd);
+    }
+    delete pipe;
+}
+
+void UnitOutput::readPipe(Pipe *pipe)
+{
+    static const QMetaMethod linesSignal = QMetaMethod::fromSignal(&UnitOutput::lines);
+    LogRecordList records;
+    LogRecordList *followed = isSignalConnected(linesSignal) ? &records : 0;
+
+    char buffer[4096];
+    int total = 0;
+    bool eof = false;
+    while (total < UNIT_OUTPUT_READ_MAX) {
+        ssize_t size = read(pipe->fd, buffer, sizeof(buffer));
+        if (size < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            eof = errno != EAGAIN && errno != EWOULDBLOCK;
+            break;
+        } else if (size == 0) {
+            eof = true;
+            break;
+        }
+        total += size;
+
+        // One timestamp per read, lines of a write stay together
+        const qulonglong timestamp = realtime();
+        const char *begin = buffer;
+        const char *end = buffer + size;
+        while (begin < end) {
+            const char *newline = static_cast<const char *>(memchr(begin, '\n', end - begin));
+            if (!newline) {
+                pipe->partial.append(begin, end - begin);
+                if (pipe->partial.size() >= UNIT_OUTPUT_LINE_MAX) {
+                    addLine(pipe->stream, timestamp, pipe->partial.constData(), pipe->partial.size(), followed);
+                    pipe->partial.clear();
+                }
+                break;
+            }
+
+            if (pipe->partial.isEmpty()) {
+                addLine(pipe->stream, timestamp, begin, newline - begin, followed);
+            } else {
+                pipe->partial.append(begin, newline - begin);
+                addLine(pipe->stream, timestamp, pipe->partial.constData(), pipe->partial.size(), followed);
+                pipe->partial.clear();
+            }
+            begin = newline + 1;
+        }
+    }
+
+    if (eof) {
+        // Every writer is gone
+        closePipe(pipe);
+    }
+
+    if (!records.isEmpty()) {
+        emit lines(records);
+    }
+}
+
+void UnitOutput::addLine(Stream stream, qulonglong timestamp, const char *data, int size, LogRecordList *records)
+{
+    if (!admit(timestamp, records)) {
+        return;
+    }
+
+    while (size > 0) {
+        const int chunk = qMin(size, UNIT_OUTPUT_LINE_MAX);
+        store(stream, timestamp, data, chunk);
+        SessionLog::global()->append(m_tag, stream, timestamp, data, chunk);
+        if (records) {
+            LogRecord record;
+            record.timestamp = timestamp;
+            record.stream = stream;
+            record.line = QString::fromLocal8Bit(data, chunk);
+            records->append(record);
+        }
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+bool UnitOutput::admit(qulonglong timestamp, LogRecordList *records)
+{
+    if (timestamp - m_windowStart >= UNIT_OUTPUT_RATE_INTERVAL) {
+        m_windowStart = timestamp;
+        m_windowLines = 0;
+
+        if (m_suppressed) {
+            const QByteArray note = "Suppressed " + QByteArray::number(m_suppressed) + " lines";
+            m_suppressed = 0;
+            addLine(Session, timestamp, note.constData(), note.size(), records);
+        }
+    }
+
+    if (m_windowLines >= UNIT_OUTPUT_RATE_BURST) {
+        if (m_suppressed++ == 0) {
+            qWarning() << m_unit << "is logging too much, dropping its output for a while";
+        }
+        return false;
+    }
+    ++m_windowLines;
+    return true;
+}
+
+void UnitOutput::store(Stream stream, qulonglong timestamp, const char *data, int size)
+{
+    if (m_ring.isEmpty()) {
+        // Units that never print anything don't pay for it
+        m_ring.resize(UNIT_OUTPUT_SIZE);
+    }
+
+    const int needed = int(sizeof(RecordHeader)) + size;
+    while (m_used + needed > m_ring.size()) {
+        RecordHeader oldest;
+        copyOut(m_head, reinterpret_cast<char *>(&oldest), sizeof(oldest));
+        const int oldestSize = int(sizeof(RecordHeader)) + oldest.size;
+        m_head = (m_head + oldestSize) % m_ring.size();
+        m_used -= oldestSize;
+    }
+
+    RecordHeader header;
+    header.timestamp = timestamp;
+    header.size = quint16(size);
+    header.stream = quint8(stream);
+
+    const int offset = (m_head + m_used) % m_ring.size();
+    copyIn(offset, reinterpret_cast<const char *>(&header), sizeof(header));
+    copyIn((offset + int(sizeof(header))) % m_ring.size(), data, size);
+    m_used += needed;
+}
+
+void UnitOutput::copyOut(int offset, char *data, int size) const
+{
+    const int first = qMin(size, m_ring.size() - offset);
+    memcpy(data, m_ring.constData() + offset, first);
+    memcpy(data + first, m_ring.constData(), size - first);
+}
+
+void UnitOutput::copyIn(int offset, const char *data, int size)
+{
+    const int first = qMin(size, m_ring.size() - offset);
+    memcpy(m_ring.data() + offset, data, first);
+    memcpy(m_ring.data(), data + first, size - first);
+}
+
+LogRecordList UnitOutput::tail(int count) const
+{
+    QVector<int> offsets;
+    int offset = m_head;
+    int walked = 0;
+    while (walked < m_used) {
+        offsets.append(offset);
+        RecordHeader header;
+        copyOut(offset, reinterpret_cast<char *>(&header), sizeof(header));
+        const int recordSize = int(sizeof(RecordHeader)) + header.size;
+        offset = (offset + recordSize) % m_ring.size();
+        walked += recordSize;
+    }
+
+    LogRecordList ret;
+    char line[UNIT_OUTPUT_LINE_MAX];
+    for (int i = qMax(0, offsets.size() - count); i < offsets.size(); ++i) {
+        RecordHeader header;
+        copyOut(offsets.at(i), reinterpret_cast<char *>(&header), sizeof(header));
+        copyOut((offsets.at(i) + int(sizeof(header))) % m_ring.size(), line, header.size);
+
+        LogRecord record;
+        record.timestamp = header.timestamp;
+        record.stream = header.stream;
+        record.line = QString::fromLocal8Bit(line, header.size);
+        ret.append(record);
+    }
+    return ret;
+}
+
+QString UnitOutput::streamName(Stream stream)
+{
+    switch (stream) {
+    case StandardOutput:
+        return QStringLiteral("stdout");
+    case StandardError:
+        return QStringLiteral("stderr");
+    default:
+        return QStringLiteral("session");
+    }
+}
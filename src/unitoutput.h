@@ -0,0 +1,123 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef UNITOUTPUT_H
+#define UNITOUTPUT_H
+
+#include <QObject>
+#include <QString>
+#include <QList>
+#include <QMetaType>
+
+class QDBusArgument;
+class QSocketNotifier;
+
+struct LogRecord
+{
+    qulonglong timestamp; // usecs since the epoch
+    uint stream;          // UnitOutput::Stream
+    QString line;
+};
+typedef QList<LogRecord> LogRecordList;
+
+QDBusArgument &operator<<(QDBusArgument &argument, const LogRecord &record);
+const QDBusArgument &operator>>(const QDBusArgument &argument, LogRecord &record);
+
+Q_DECLARE_METATYPE(LogRecord)
+Q_DECLARE_METATYPE(LogRecordList)
+
+/**
+ * @brief The UnitOutput class
+ * Captures stdout and stderr of a unit through pipes. Lines
+ * are kept in a fixed size ring, the oldest ones are dropped
+ * when it's full, and copied to the SessionLog.
+ *
+ * A unit may log a burst of lines per interval, what goes
+ * beyond is dropped and counted. Reads are bounded per wakeup
+ * so a chatty unit can't stall the event loop, and the pipes
+ * are drained eagerly so writers don't block on them.
+ */
+class UnitOutput : public QObject
+{
+    Q_OBJECT
+public:
+    enum Stream {
+        Session,
+        StandardOutput,
+        StandardError
+    };
+
+    explicit UnitOutput(const QString &unit, QObject *parent = 0);
+    virtual ~UnitOutput();
+
+    /**
+     * Creates the pipes for a new child, \p stdoutFd and \p stderrFd
+     * get the ends the child writes to. Pipes of a previous child
+     * are read until whatever still holds them exits.
+     */
+    bool open(int *stdoutFd, int *stderrFd);
+
+    /**
+     * Closes our copy of the child ends once it was spawned
+     */
+    void closeChildEnds();
+
+    /**
+     * The last \p count lines, oldest first
+     */
+    LogRecordList tail(int count) const;
+
+    static QString streamName(Stream stream);
+
+Q_SIGNALS:
+    /**
+     * New lines of one read, only emitted while connected
+     */
+    void lines(const LogRecordList &records);
+
+private:
+    struct Pipe {
+        int fd = -1;
+        int childFd = -1;
+        Stream stream;
+        QSocketNotifier *notifier = 0;
+        QByteArray partial;
+    };
+
+    Pipe *createPipe(Stream stream);
+    void readPipe(Pipe *pipe);
+    void closePipe(Pipe *pipe);
+    void addLine(Stream stream, qulonglong timestamp, const char *data, int size, LogRecordList *records);
+    bool admit(qulonglong timestamp, LogRecordList *records);
+    void store(Stream stream, qulonglong timestamp, const char *data, int size);
+    void copyOut(int offset, char *data, int size) const;
+    void copyIn(int offset, const char *data, int size);
+
+    QString m_unit;
+    QByteArray m_tag;
+    QList<Pipe *> m_pipes;
+    QByteArray m_ring;
+    int m_head = 0;
+    int m_used = 0;
+    qulonglong m_windowStart = 0;
+    int m_windowLines = 0;
+    int m_suppressed = 0;
+};
+
+#endif // UNITOUTPUT_H
@@ -0,0 +1,236 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "unitprocess.h"
+
+#include "launcherclient.h"
+
+#include <QFile>
+
+#include <spawn.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+extern char **environ;
+
+UnitProcess::UnitProcess(const QStringList &arguments)
+{
+    m_arguments.reserve(arguments.size());
+    foreach (const QString &argument, arguments) {
+        m_arguments.append(QFile::encodeName(argument));
+    }
+
+    m_argv.reserve(m_arguments.size() + 1);
+    for (int i = 0; i < m_arguments.size(); ++i) {
+        m_argv.append(m_arguments[i].data());
+    }
+    m_argv.append(0);
+}
+
+UnitProcess::~UnitProcess()
+{
+    terminate();
+}
+
+void UnitProcess::start(char *const envp[], QObject *context, const std::function<void(int)> &callback)
+{
+    if (m_state != QProcess::NotRunning) {
+        callback(EBUSY);
+        return;
+    }
+
+    if (m_arguments.isEmpty()) {
+        callback(ENOENT);
+        return;
+    }
+
+    m_state = QProcess::Starting;
+
+    if (m_launcher) {
+        int ret = LauncherClient::global()->spawn(m_argv.data(), envp ? envp : environ,
+                                                  m_stdoutFd, m_stderrFd, m_cgroupFd, context,
+                                                  [this, envp, callback](int error, pid_t pid) {
+            if (error == 0) {
+                // Already in its cgroup, otherwise it's spawned as usual
+                m_pid = pid;
+                m_state = QProcess::Running;
+            } else {
+                error = startDirectly(envp);
+            }
+            callback(error);
+        });
+        if (ret == 0) {
+            return;
+        }
+    }
+
+    callback(startDirectly(envp));
+}
+
+int UnitProcess::startDirectly(char *const envp[])
+{
+    pid_t pid;
+    int ret;
+#ifdef POSIX_SPAWN_SETCGROUP
+    // glibc >= 2.39 and Linux >= 5.7 clone straight into the cgroup
+    ret = spawn(&pid, envp, m_cgroupFd >= 0);
+    if (ret != 0 && m_cgroupFd >= 0 && (ret == EINVAL || ret == EOPNOTSUPP || ret == ENOSYS)) {
+        ret = spawn(&pid, envp, false);
+        if (ret == 0) {
+            attachToCGroup(pid);
+        }
+    }
+#else
+    ret = spawn(&pid, envp, false);
+    if (ret == 0 && m_cgroupFd >= 0) {
+        // The child runs already, whatever it forks before
+        // this write stays in our cgroup
+        attachToCGroup(pid);
+    }
+#endif
+
+    if (ret != 0) {
+        m_state = QProcess::NotRunning;
+        return ret;
+    }
+
+    m_pid = pid;
+    m_state = QProcess::Running;
+    return 0;
+}
+
+void UnitProcess::setCGroup(int fd)
+{
+    m_cgroupFd = fd;
+}
+
+void UnitProcess::setOutput(int stdoutFd, int stderrFd)
+{
+    m_stdoutFd = stdoutFd;
+    m_stderrFd = stderrFd;
+}
+
+void UnitProcess::setLauncher(bool enabled)
+{
+    m_launcher = enabled;
+}
+
+int UnitProcess::spawn(pid_t *pid, char *const envp[], bool intoCGroup)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (m_stdoutFd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, m_stdoutFd, STDOUT_FILENO);
+    }
+    if (m_stderrFd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, m_stderrFd, STDERR_FILENO);
+    }
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+
+    // Don't leak our signal setup into the children
+    sigset_t mask;
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    sigset_t defaults;
+    sigfillset(&defaults);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+
+    short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+#ifdef POSIX_SPAWN_USEVFORK
+    flags |= POSIX_SPAWN_USEVFORK;
+#endif
+#ifdef POSIX_SPAWN_SETCGROUP
+    if (intoCGroup) {
+        posix_spawnattr_setcgroup_np(&attr, m_cgroupFd);
+        flags |= POSIX_SPAWN_SETCGROUP;
+    }
+#else
+    Q_UNUSED(intoCGroup)
+#endif
+    posix_spawnattr_setflags(&attr, flags);
+
+    int ret = posix_spawnp(pid, m_argv.first(), &actions, &attr,
+                           m_argv.data(), envp ? envp : environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    return ret;
+}
+
+void UnitProcess::attachToCGroup(pid_t pid)
+{
+    int fd = openat(m_cgroupFd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+
+    char buffer[32];
+    int size = snprintf(buffer, sizeof(buffer), "%d", int(pid));
+    if (write(fd, buffer, size) != size) {
+        qWarning("Failed to move %d to its cgroup: %s", int(pid), strerror(errno));
+    }
+    close(fd);
+}
+
+void UnitProcess::terminate()
+{
+    if (m_state != QProcess::NotRunning && m_pid > 0) {
+        ::kill(m_pid, SIGTERM);
+    }
+}
+
+void UnitProcess::kill()
+{
+    if (m_state != QProcess::NotRunning && m_pid > 0) {
+        ::kill(m_pid, SIGKILL);
+    }
+}
+
+void UnitProcess::setExited()
+{
+    m_state = QProcess::NotRunning;
+    m_pid = 0;
+}
+
+pid_t UnitProcess::pid() const
+{
+    return m_pid;
+}
+
+QProcess::ProcessState UnitProcess::state() const
+{
+    return m_state;
+}
+
+QProcess::ExitStatus UnitProcess::exitStatus(int status, int *exitCode)
+{
+    if (WIFSIGNALED(status)) {
+        *exitCode = WTERMSIG(status);
+        return QProcess::CrashExit;
+    }
+
+    *exitCode = WEXITSTATUS(status);
+    return QProcess::NormalExit;
+}
@@ -0,0 +1,104 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef UNITPROCESS_H
+#define UNITPROCESS_H
+
+#include <QProcess>
+#include <QVector>
+
+#include <functional>
+
+#include <sys/types.h>
+
+/**
+ * @brief The UnitProcess class
+ * Lightweight process backend for units, it's only
+ * created when a unit is started. The argv is tokenized
+ * once and the child is created with posix_spawn(), which
+ * uses vfork semantics, exit is reported by the ChildSupervisor.
+ *
+ * The state mirrors QProcess::ProcessState so the unit State
+ * property keeps its meaning.
+ */
+class UnitProcess
+{
+public:
+    explicit UnitProcess(const QStringList &arguments);
+    ~UnitProcess();
+
+    /**
+     * Spawns the process with \p envp, or our own environment
+     * when null. \p callback gets 0 or the errno that prevented
+     * the exec, right away unless the launcher helper forks the
+     * child, then \p envp must stay valid until it's called and
+     * deleting \p context drops it.
+     */
+    void start(char *const envp[], QObject *context, const std::function<void(int)> &callback);
+
+    /**
+     * The child is created in the cgroup \p fd refers to,
+     * the descriptor stays owned by the caller
+     */
+    void setCGroup(int fd);
+
+    /**
+     * The child gets \p stdoutFd and \p stderrFd as its
+     * stdout and stderr, -1 keeps ours
+     */
+    void setOutput(int stdoutFd, int stderrFd);
+
+    /**
+     * The child is forked by the launcher helper when it
+     * has a module for the program
+     */
+    void setLauncher(bool enabled);
+
+    void terminate();
+    void kill();
+
+    /**
+     * Called once the child was reaped
+     */
+    void setExited();
+
+    pid_t pid() const;
+    QProcess::ProcessState state() const;
+
+    /**
+     * Decodes a wait() status the way QProcess reports it
+     */
+    static QProcess::ExitStatus exitStatus(int status, int *exitCode);
+
+private:
+    int startDirectly(char *const envp[]);
+    int spawn(pid_t *pid, char *const envp[], bool intoCGroup);
+    void attachToCGroup(pid_t pid);
+
+    QVector<QByteArray> m_arguments;
+    QVector<char *> m_argv;
+    pid_t m_pid = 0;
+    int m_cgroupFd = -1;
+    int m_stdoutFd = -1;
+    int m_stderrFd = -1;
+    bool m_launcher = false;
+    QProcess::ProcessState m_state = QProcess::NotRunning;
+};
+
+#endif // UNITPROCESS_H
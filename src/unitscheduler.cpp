@@ -0,0 +1,585 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "unitscheduler.h"
+
+#include "startuptrace.h"
+#include "startupprofile.h"
+#include "timerqueue.h"
+#include "admissioncontroller.h"
+#include "idlemonitor.h"
+
+#include <QSet>
+#include <QDebug>
+
+#include <algorithm>
+
+// Deferred units are started after this even if
+// the milestone they wait for isn't reached
+#define DEFER_MAX_DELAY 3000
+
+UnitScheduler::UnitScheduler(QObject *parent) :
+    QObject(parent),
+    m_admission(new AdmissionController(this)),
+    m_idleMonitor(new IdleMonitor(this))
+{
+    connect(m_idleMonitor, &IdleMonitor::idle,
+            this, &UnitScheduler::releaseIdle);
+}
+
+UnitScheduler::~UnitScheduler()
+{
+    TimerQueue::global()->cancel(m_deferTimer);
+    foreach (Node *node, m_launchers) {
+        TimerQueue::global()->cancel(node->classTimer);
+    }
+    qDeleteAll(m_launchers);
+    qDeleteAll(m_milestones);
+}
+
+void UnitScheduler::addUnit(UnitLauncher *launcher)
+{
+    addUnits(QList<UnitLauncher *>() << launcher);
+}
+
+void UnitScheduler::addUnits(const QList<UnitLauncher *> &launchers)
+{
+    QVector<Node *> added;
+    foreach (UnitLauncher *launcher, launchers) {
+        if (m_launchers.contains(launcher)) {
+            continue;
+        }
+
+        Node *node = new Node;
+        node->launcher = launcher;
+        m_launchers.insert(launcher, node);
+        m_units.insert(launcher->name(), node);
+        added.append(node);
+
+        connect(launcher, &UnitLauncher::ready,
+                this, &UnitScheduler::unitReady);
+        connect(launcher, &UnitLauncher::failed,
+                this, &UnitScheduler::unitFailed);
+    }
+
+    if (!m_started) {
+        return;
+    }
+
+    // Only what is still pending can gate them, the whole
+    // batch is known by now so the order doesn't matter
+    QVector<Node *> broken;
+    foreach (Node *node, added) {
+        connectNode(node, &broken);
+    }
+
+    foreach (Node *node, broken) {
+        node->released = true;
+        complete(node, true);
+    }
+
+    QVector<Node *> ready;
+    foreach (Node *node, added) {
+        if (!node->done && node->pending == 0) {
+            ready.append(node);
+        }
+    }
+    releaseAll(ready);
+}
+
+void UnitScheduler::removeUnit(UnitLauncher *launcher)
+{
+    Node *node = m_launchers.take(launcher);
+    if (!node) {
+        return;
+    }
+
+    if (m_units.value(launcher->name()) == node) {
+        m_units.remove(launcher->name());
+    }
+    disconnect(launcher, 0, this, 0);
+    m_admission->remove(launcher);
+
+    // Whoever waits on it moves on, units
+    // requiring it are not started
+    if (m_started && !node->done) {
+        node->released = true;
+        complete(node, true);
+    }
+    m_deferred.removeAll(node);
+    TimerQueue::global()->cancel(node->classTimer);
+    m_classWaiting.removeAll(node);
+    m_idleWaiting.removeAll(node);
+    if (m_idleWaiting.isEmpty()) {
+        m_idleMonitor->stop();
+    }
+
+    QList<Node *> nodes = m_launchers.values() + m_milestones.values();
+    foreach (Node *other, nodes) {
+        other->dependents.removeAll(node);
+        other->requiredBy.removeAll(node);
+    }
+    delete node;
+}
+
+void UnitScheduler::addMilestone(int milestone, UnitLauncher::Type members, int after)
+{
+    Node *node = new Node;
+    node->milestone = milestone;
+    m_milestones.insert(milestone, node);
+    m_milestoneMembers.insert(milestone, members);
+    m_milestoneAfter.insert(milestone, after);
+}
+
+void UnitScheduler::setTypeDependency(UnitLauncher::Type type, int milestones)
+{
+    m_typeDependencies.insert(type, milestones);
+}
+
+bool UnitScheduler::isReached(int milestone) const
+{
+    return (m_reached & milestone) == milestone;
+}
+
+void UnitScheduler::setProfile(const StartupProfile *profile, int deferUntil)
+{
+    m_profile = profile;
+    m_deferUntil = deferUntil;
+}
+
+void UnitScheduler::setSpawnLimit(int limit)
+{
+    m_admission->setLimit(limit);
+}
+
+void UnitScheduler::setStartClassMilestone(int milestone)
+{
+    m_classMilestone = milestone;
+}
+
+void UnitScheduler::setIdleWindow(int msecs)
+{
+    m_idleMonitor->setWindow(msecs);
+}
+
+void UnitScheduler::start()
+{
+    if (m_started) {
+        return;
+    }
+    m_started = true;
+
+    QVector<Node *> broken;
+    foreach (Node *node, m_launchers) {
+        connectNode(node, &broken);
+    }
+
+    QHash<int, Node *>::ConstIterator milestoneIt = m_milestones.constBegin();
+    while (milestoneIt != m_milestones.constEnd()) {
+        int after = m_milestoneAfter.value(milestoneIt.key());
+        QHash<int, Node *>::ConstIterator afterIt = m_milestones.constBegin();
+        while (afterIt != m_milestones.constEnd()) {
+            if (after & afterIt.key()) {
+                addEdge(afterIt.value(), milestoneIt.value(), false);
+            }
+            ++afterIt;
+        }
+        ++milestoneIt;
+    }
+
+    breakCycles();
+
+    foreach (Node *node, broken) {
+        node->released = true;
+        complete(node, true);
+    }
+
+    QVector<Node *> ready;
+    foreach (Node *node, m_milestones) {
+        if (node->pending == 0) {
+            ready.append(node);
+        }
+    }
+    foreach (Node *node, m_launchers) {
+        if (node->pending == 0) {
+            ready.append(node);
+        }
+    }
+
+    releaseAll(ready);
+}
+
+void UnitScheduler::unitReady()
+{
+    UnitLauncher *launcher = qobject_cast<UnitLauncher *>(sender());
+    Node *node = m_launchers.value(launcher);
+    if (!node || !m_started) {
+        return;
+    }
+
+    node->released = true;
+    complete(node, false);
+}
+
+void UnitScheduler::unitFailed()
+{
+    UnitLauncher *launcher = qobject_cast<UnitLauncher *>(sender());
+    Node *node = m_launchers.value(launcher);
+    if (!node || !m_started) {
+        return;
+    }
+
+    qWarning() << "Unit failed" << launcher->name();
+    node->released = true;
+    complete(node, true);
+}
+
+void UnitScheduler::connectNode(Node *node, QVector<Node *> *broken)
+{
+    UnitLauncher *launcher = node->launcher;
+
+    // Nodes already done are satisfied, this only
+    // matters for units added after start()
+    foreach (const QString &name, launcher->after()) {
+        Node *dep = m_units.value(name);
+        if (!dep) {
+            qDebug() << launcher->name() << "ignoring After on unknown unit" << name;
+        } else if (dep != node && !dep->done) {
+            addEdge(dep, node, false);
+        }
+    }
+
+    foreach (const QString &name, launcher->requires()) {
+        Node *dep = m_units.value(name);
+        if (!dep) {
+            qWarning() << launcher->name() << "requires unknown unit" << name;
+            broken->append(node);
+        } else if (dep->done && dep->failed) {
+            qWarning() << launcher->name() << "requires failed unit" << name;
+            broken->append(node);
+        } else if (dep != node && !dep->done) {
+            addEdge(dep, node, true);
+        }
+    }
+
+    int typeDependencies = m_typeDependencies.value(launcher->type());
+    QHash<int, Node *>::ConstIterator milestoneIt = m_milestones.constBegin();
+    while (milestoneIt != m_milestones.constEnd()) {
+        Node *milestone = milestoneIt.value();
+        if ((typeDependencies & milestoneIt.key()) && !milestone->done) {
+            addEdge(milestone, node, false);
+        }
+        // Units started late would hold the milestone back
+        if (m_milestoneMembers.value(milestoneIt.key()) == launcher->type() && !milestone->done &&
+                launcher->startClass() == UnitLauncher::StartImmediate) {
+            addEdge(node, milestone, false);
+        }
+        ++milestoneIt;
+    }
+}
+
+void UnitScheduler::addEdge(Node *from, Node *to, bool required)
+{
+    if (required) {
+        from->requiredBy.append(to);
+    } else {
+        from->dependents.append(to);
+    }
+    ++to->pending;
+}
+
+void UnitScheduler::breakCycles()
+{
+    // Tarjan's strongly connected components, walked without
+    // recursion. Only units on a cycle lose the edges they
+    // share with it, whatever is merely behind it keeps its order
+    struct Frame {
+        Node *node;
+        QVector<Node *> edges;
+        int next;
+    };
+
+    QHash<Node *, int> index;
+    QHash<Node *, int> lowlink;
+    QHash<Node *, int> component;
+    QVector<int> componentSize;
+    QVector<Node *> stack;
+    QSet<Node *> onStack;
+    QVector<Frame> frames;
+
+    const QList<Node *> nodes = m_milestones.values() + m_launchers.values();
+    foreach (Node *root, nodes) {
+        if (index.contains(root)) {
+            continue;
+        }
+
+        Node *visit = root;
+        while (visit || !frames.isEmpty()) {
+            if (visit) {
+                index.insert(visit, index.size());
+                lowlink.insert(visit, index.value(visit));
+                stack.append(visit);
+                onStack.insert(visit);
+                Frame frame = { visit, visit->dependents + visit->requiredBy, 0 };
+                frames.append(frame);
+                visit = 0;
+            }
+
+            Frame &frame = frames.last();
+            if (frame.next < frame.edges.size()) {
+                Node *next = frame.edges.at(frame.next++);
+                if (!index.contains(next)) {
+                    visit = next;
+                } else if (onStack.contains(next)) {
+                    lowlink[frame.node] = qMin(lowlink.value(frame.node), index.value(next));
+                }
+                continue;
+            }
+
+            Node *node = frame.node;
+            frames.removeLast();
+            if (!frames.isEmpty()) {
+                Node *parent = frames.last().node;
+                lowlink[parent] = qMin(lowlink.value(parent), lowlink.value(node));
+            }
+
+            if (lowlink.value(node) == index.value(node)) {
+                int size = 0;
+                Node *member;
+                do {
+                    member = stack.takeLast();
+                    onStack.remove(member);
+                    component.insert(member, componentSize.size());
+                    ++size;
+                } while (member != node);
+                componentSize.append(size);
+            }
+        }
+    }
+
+    // Type and milestone edges can't form a cycle on their
+    // own, so dropping the unit to unit edges is enough
+    foreach (Node *node, m_launchers) {
+        const int id = component.value(node);
+        if (componentSize.at(id) < 2) {
+            continue;
+        }
+        qWarning() << "Dependency cycle, ignoring ordering of" << node->launcher->name();
+
+        QVector<Node *> *lists[] = { &node->dependents, &node->requiredBy };
+        for (QVector<Node *> *list : lists) {
+            QVector<Node *>::Iterator dep = list->begin();
+            while (dep != list->end()) {
+                if ((*dep)->launcher && component.value(*dep) == id) {
+                    --(*dep)->pending;
+                    dep = list->erase(dep);
+                } else {
+                    ++dep;
+                }
+            }
+        }
+    }
+}
+
+void UnitScheduler::release(Node *node)
+{
+    if (node->released || node->done) {
+        return;
+    }
+    node->released = true;
+
+    if (node->launcher) {
+        // Units like the Window Manager might have been
+        // started before the graph was resolved
+        if (node->launcher->isReady()) {
+            complete(node, false);
+        } else if (node->launcher->state() == QProcess::NotRunning) {
+            if (node->launcher->startClass() != UnitLauncher::StartImmediate && !node->classDeferred) {
+                node->classDeferred = true;
+                deferByClass(node);
+                return;
+            }
+
+            if (m_profile && m_deferUntil && !isReached(m_deferUntil) && !node->deferred &&
+                    m_profile->isDeferrable(node->launcher->name()) && !gatesDeferral(node)) {
+                qDebug() << "Deferring expensive unit" << node->launcher->name();
+                node->deferred = true;
+                m_deferred.append(node);
+                if (!m_deferTimer) {
+                    m_deferTimer = TimerQueue::global()->start(DEFER_MAX_DELAY, this, [this]() {
+                        m_deferTimer = 0;
+                        releaseDeferred();
+                    });
+                }
+                return;
+            }
+
+            qDebug() << "Releasing unit" << node->launcher->name();
+            StartupTrace::global()->record(StartupTrace::Released, node->launcher->name());
+            m_admission->submit(node->launcher, m_profile ? m_profile->priority(node->launcher->name()) : 0);
+        }
+    } else {
+        complete(node, false);
+    }
+}
+
+bool UnitScheduler::gatesDeferral(Node *node) const
+{
+    // Deferring what the milestone waits for would only
+    // stall it until DEFER_MAX_DELAY
+    const UnitLauncher::Type type = node->launcher->type();
+    if (type == UnitLauncher::Shell || type == UnitLauncher::Custom) {
+        return true;
+    }
+
+    Node *milestone = m_milestones.value(m_deferUntil);
+    if (!milestone) {
+        return false;
+    }
+
+    QSet<Node *> visited;
+    QVector<Node *> queue;
+    queue.append(node);
+    while (!queue.isEmpty()) {
+        Node *current = queue.takeLast();
+        foreach (Node *dependent, current->dependents + current->requiredBy) {
+            if (dependent == milestone) {
+                return true;
+            }
+            if (!visited.contains(dependent)) {
+                visited.insert(dependent);
+                queue.append(dependent);
+            }
+        }
+    }
+    return false;
+}
+
+void UnitScheduler::releaseAll(QVector<Node *> nodes)
+{
+    if (m_profile && nodes.size() > 1) {
+        // Milestones cost nothing and may release more
+        const StartupProfile *profile = m_profile;
+        std::stable_sort(nodes.begin(), nodes.end(), [profile](Node *a, Node *b) {
+            if (!a->launcher || !b->launcher) {
+                return !a->launcher && b->launcher;
+            }
+            return profile->priority(a->launcher->name()) > profile->priority(b->launcher->name());
+        });
+    }
+
+    foreach (Node *node, nodes) {
+        release(node);
+    }
+}
+
+void UnitScheduler::releaseDeferred()
+{
+    TimerQueue::global()->cancel(m_deferTimer);
+    m_deferTimer = 0;
+
+    const QVector<Node *> deferred = m_deferred;
+    m_deferred.clear();
+    foreach (Node *node, deferred) {
+        // Released again, without the profile check
+        node->released = false;
+    }
+    releaseAll(deferred);
+}
+
+void UnitScheduler::deferByClass(Node *node)
+{
+    if (m_classMilestone && !isReached(m_classMilestone)) {
+        m_classWaiting.append(node);
+        return;
+    }
+
+    UnitLauncher *launcher = node->launcher;
+    if (launcher->startClass() == UnitLauncher::StartOnIdle) {
+        qDebug() << "Starting unit once the session is idle" << launcher->name();
+        m_idleWaiting.append(node);
+        m_idleMonitor->start();
+        return;
+    }
+
+    // All of them share the TimerQueue, ordered by deadline
+    qDebug() << "Delaying unit" << launcher->name() << launcher->startDelay() << "msecs";
+    const qint64 origin = m_classMilestone ? m_classOrigin : TimerQueue::now();
+    node->classTimer = TimerQueue::global()->startAt(origin + launcher->startDelay(), this, [this, node]() {
+        node->classTimer = 0;
+        node->released = false;
+        release(node);
+    });
+}
+
+void UnitScheduler::releaseIdle()
+{
+    const QVector<Node *> idle = m_idleWaiting;
+    m_idleWaiting.clear();
+    foreach (Node *node, idle) {
+        node->released = false;
+    }
+    releaseAll(idle);
+}
+
+void UnitScheduler::complete(Node *node, bool failed)
+{
+    if (node->done) {
+        return;
+    }
+    node->done = true;
+    node->failed = failed;
+
+    if (node->milestone) {
+        m_reached |= node->milestone;
+        emit milestoneReached(node->milestone);
+        if (node->milestone == m_deferUntil && !m_deferred.isEmpty()) {
+            releaseDeferred();
+        }
+        if (node->milestone == m_classMilestone) {
+            m_classOrigin = TimerQueue::now();
+            const QVector<Node *> waiting = m_classWaiting;
+            m_classWaiting.clear();
+            foreach (Node *waitingNode, waiting) {
+                deferByClass(waitingNode);
+            }
+        }
+    }
+
+    QVector<Node *> ready;
+    foreach (Node *dependent, node->dependents) {
+        if (--dependent->pending == 0) {
+            ready.append(dependent);
+        }
+    }
+
+    foreach (Node *dependent, node->requiredBy) {
+        if (failed) {
+            if (!dependent->done) {
+                qWarning() << "Not starting" << dependent->launcher->name()
+                           << "a required unit failed" << node->launcher->name();
+                dependent->released = true;
+                complete(dependent, true);
+            }
+        } else if (--dependent->pending == 0) {
+            ready.append(dependent);
+        }
+    }
+    releaseAll(ready);
+}
@@ -0,0 +1,184 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Daniel Nicoletti <dantti12@gmail.com>           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef UNITSCHEDULER_H
+#define UNITSCHEDULER_H
+
+#include <QObject>
+#include <QHash>
+#include <QVector>
+
+#include "unitlauncher.h"
+
+class StartupProfile;
+class AdmissionController;
+class IdleMonitor;
+
+/**
+ * @brief The UnitScheduler class
+ * Builds a dependency graph out of the session units
+ * and starts each unit as soon as everything it depends
+ * on is ready, independent units start in parallel.
+ *
+ * Edges come from three places:
+ * - the unit type, a type can be made to wait for a milestone
+ * - the After= and Requires= keys of the unit file
+ * - milestones, which are reached when all units of a
+ *   given type are ready (or gave up)
+ *
+ * A unit listed in After= only orders the start, if it fails
+ * the dependent unit is started anyway, a unit listed in
+ * Requires= that fails or does not exist prevents the
+ * dependent unit from being started.
+ *
+ * With a StartupProfile units released together are started
+ * critical path first, expensive units that are off the
+ * critical path wait for a milestone (or a few seconds).
+ *
+ * Released units are spawned through an AdmissionController
+ * which bounds how many of a phase are starting at once.
+ *
+ * Units with a delayed or on-idle StartClass are held back
+ * once released, until a delay after a milestone expired or
+ * the session went quiet. They don't hold milestones back.
+ */
+class UnitScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    explicit UnitScheduler(QObject *parent = 0);
+    virtual ~UnitScheduler();
+
+    /**
+     * Adds \p launcher to the graph, once started the unit
+     * only waits on what is still pending and is released
+     * right away otherwise.
+     */
+    void addUnit(UnitLauncher *launcher);
+
+    /**
+     * Adds all of \p launchers before resolving any of them,
+     * so units of the batch may require each other in any order
+     */
+    void addUnits(const QList<UnitLauncher *> &launchers);
+
+    /**
+     * Drops \p launcher from the graph, if it was still pending
+     * it counts as failed for the units depending on it.
+     */
+    void removeUnit(UnitLauncher *launcher);
+
+    /**
+     * Declares a milestone that is reached once all units of
+     * type \p members are ready and all milestones in \p after
+     * have been reached.
+     */
+    void addMilestone(int milestone, UnitLauncher::Type members, int after = 0);
+
+    /**
+     * Units of \p type are only started once all
+     * \p milestones have been reached.
+     */
+    void setTypeDependency(UnitLauncher::Type type, int milestones);
+
+    bool isReached(int milestone) const;
+
+    /**
+     * Orders the starts by \p profile, deferrable units are
+     * held back until \p deferUntil is reached
+     */
+    void setProfile(const StartupProfile *profile, int deferUntil);
+
+    /**
+     * At most \p limit units of each type are starting
+     * at once, 0 starts released units right away
+     */
+    void setSpawnLimit(int limit);
+
+    /**
+     * Delayed and on-idle units wait for \p milestone,
+     * the delay is counted from it
+     */
+    void setStartClassMilestone(int milestone);
+
+    /**
+     * On-idle units need \p msecs without load or input
+     */
+    void setIdleWindow(int msecs);
+
+    /**
+     * Resolves the graph and starts every unit that
+     * has no pending dependency.
+     */
+    void start();
+
+Q_SIGNALS:
+    void milestoneReached(int milestone);
+
+private Q_SLOTS:
+    void unitReady();
+    void unitFailed();
+
+private:
+    struct Node {
+        UnitLauncher *launcher = 0;
+        int milestone = 0;
+        int pending = 0;
+        bool released = false;
+        bool done = false;
+        bool failed = false;
+        bool deferred = false;
+        bool classDeferred = false;
+        quint64 classTimer = 0;
+        QVector<Node *> dependents;
+        QVector<Node *> requiredBy;
+    };
+
+    void connectNode(Node *node, QVector<Node *> *broken);
+    void addEdge(Node *from, Node *to, bool required);
+    void breakCycles();
+    void release(Node *node);
+    void releaseAll(QVector<Node *> nodes);
+    void releaseDeferred();
+    bool gatesDeferral(Node *node) const;
+    void deferByClass(Node *node);
+    void releaseIdle();
+    void complete(Node *node, bool failed);
+
+    QHash<QString, Node *> m_units;
+    QHash<UnitLauncher *, Node *> m_launchers;
+    QHash<int, Node *> m_milestones;
+    QHash<int, UnitLauncher::Type> m_milestoneMembers;
+    QHash<int, int> m_milestoneAfter;
+    QHash<int, int> m_typeDependencies;
+    int m_reached = 0;
+    bool m_started = false;
+    const StartupProfile *m_profile = 0;
+    int m_deferUntil = 0;
+    QVector<Node *> m_deferred;
+    quint64 m_deferTimer = 0;
+    AdmissionController *m_admission;
+    IdleMonitor *m_idleMonitor;
+    int m_classMilestone = 0;
+    qint64 m_classOrigin = 0;
+    QVector<Node *> m_classWaiting;
+    QVector<Node *> m_idleWaiting;
+};
+
+#endif // UNITSCHEDULER_H